@@ -0,0 +1,196 @@
+// Compiler throughput benchmark.
+//
+// Runs each pipeline phase separately over the given source files and
+// reports the best time out of N iterations together with MB/s (of source
+// text) and forms/s (top-level forms) of the pipeline phases:
+//
+//   lex       lexer_next until TOKEN_EOF
+//   parse     parse_program (includes lexing)
+//   codegen   compile_to_sections into fresh section files
+//   finalize  gds_close_and_finalize (section concatenation)
+//   reparse   document_edit typing a space into the middle top-level form
+//             and deleting it again (latency only)
+//
+// The total covers parse, codegen and finalize: lex is reported on its own
+// since parse already includes it.
+//
+// Usage: compiler_bench [-n iterations] <file.lisp>...
+
+#include "codegen.h"
+#include "document.h"
+#include "global_data_sections.h"
+#include "lexer.h"
+#include "parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum BenchPhase {
+  PHASE_LEX,
+  PHASE_PARSE,
+  PHASE_CODEGEN,
+  PHASE_FINALIZE,
+  PHASE_REPARSE
+};
+
+static const char *phase_names[] = {"lex", "parse", "codegen", "finalize",
+                                    "reparse"};
+#define NUM_PHASES (sizeof(phase_names) / sizeof(phase_names[0]))
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *read_file_to_string(const char *filename, size_t *out_len) {
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    perror("Error opening file");
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (length == -1L) {
+    perror("ftell failed");
+    fclose(file);
+    return NULL;
+  }
+
+  char *buffer = malloc(length + 1);
+  if (!buffer || fread(buffer, 1, length, file) != (size_t)length) {
+    fprintf(stderr, "Failed to read '%s'\n", filename);
+    free(buffer);
+    fclose(file);
+    return NULL;
+  }
+
+  buffer[length] = '\0';
+  fclose(file);
+  *out_len = (size_t)length;
+  return buffer;
+}
+
+// Edits a document like a keystroke and its undo, after the first token of
+// the middle form, and returns the time both reparses took
+static double bench_reparse(const char *source) {
+  struct SourceDocument doc;
+  document_init(&doc, source);
+  if (doc.program.len == 0) {
+    document_cleanup(&doc);
+    return 0;
+  }
+  size_t offset = doc.spans[doc.program.len / 2].start + 1;
+  struct TextEdit type = {.offset = offset, .inserted = " ", .inserted_len = 1};
+  struct TextEdit undo = {.offset = offset, .removed = 1};
+  double t0 = now_seconds();
+  document_edit(&doc, &type);
+  document_edit(&doc, &undo);
+  double t = now_seconds() - t0;
+  document_cleanup(&doc);
+  return t;
+}
+
+static void bench_file(const char *filename, int iterations) {
+  size_t source_len = 0;
+  char *source = read_file_to_string(filename, &source_len);
+  if (!source) {
+    exit(EXIT_FAILURE);
+  }
+
+  char base[256];
+  strncpy(base, filename, sizeof(base) - 1);
+  base[sizeof(base) - 1] = '\0';
+  char *dot = strrchr(base, '.');
+  if (dot != NULL) {
+    *dot = '\0';
+  }
+
+  double best[NUM_PHASES];
+  for (size_t p = 0; p < NUM_PHASES; ++p) {
+    best[p] = 1e30;
+  }
+  size_t tokens = 0;
+  size_t forms = 0;
+
+  for (int it = 0; it < iterations; ++it) {
+    double times[NUM_PHASES];
+    double t0 = now_seconds();
+    tokens = lexer_count_tokens(source);
+    times[PHASE_LEX] = now_seconds() - t0;
+
+    t0 = now_seconds();
+    struct ParserContext parser = parser_make(source);
+    struct ExprVector ast = parse_program(&parser);
+    times[PHASE_PARSE] = now_seconds() - t0;
+    token_cleanup(&parser.current_token);
+    parser_cleanup(&parser);
+    forms = ast.len;
+
+    t0 = now_seconds();
+    struct GlobalDataSections *gds = gds_create(base);
+    if (!gds) {
+      exit(EXIT_FAILURE);
+    }
+    compile_to_sections(&ast, gds, NULL);
+    times[PHASE_CODEGEN] = now_seconds() - t0;
+
+    t0 = now_seconds();
+    gds_close_and_finalize(gds);
+    times[PHASE_FINALIZE] = now_seconds() - t0;
+
+    exprvector_cleanup(&ast);
+
+    times[PHASE_REPARSE] = bench_reparse(source);
+
+    for (size_t p = 0; p < NUM_PHASES; ++p) {
+      if (times[p] < best[p]) {
+        best[p] = times[p];
+      }
+    }
+  }
+
+  printf("%s: %.2f KiB, %zu tokens, %zu top-level forms (best of %d)\n",
+         filename, source_len / 1024.0, tokens, forms, iterations);
+  printf("  %-10s %12s %12s %14s\n", "phase", "ms", "MB/s", "forms/s");
+  double total = 0;
+  for (size_t p = 0; p < NUM_PHASES; ++p) {
+    if (p == PHASE_REPARSE) { // a small part of the file, not a pipeline pass
+      printf("  %-10s %12.3f %12s %14s\n", phase_names[p], best[p] * 1e3, "-",
+             "-");
+      continue;
+    }
+    if (p != PHASE_LEX) { // parse lexes too
+      total += best[p];
+    }
+    printf("  %-10s %12.3f %12.2f %14.0f\n", phase_names[p], best[p] * 1e3,
+           source_len / 1e6 / best[p], forms / best[p]);
+  }
+  printf("  %-10s %12.3f %12.2f %14.0f\n\n", "total", total * 1e3,
+         source_len / 1e6 / total, forms / total);
+  fflush(stdout);
+
+  free(source);
+}
+
+int main(int argc, char **argv) {
+  int iterations = 5;
+  int first_file = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    first_file = 3;
+  }
+  if (first_file >= argc || iterations <= 0) {
+    fprintf(stderr, "Usage: %s [-n iterations] <file.lisp>...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (int i = first_file; i < argc; ++i) {
+    bench_file(argv[i], iterations);
+  }
+  return 0;
+}
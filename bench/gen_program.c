@@ -0,0 +1,172 @@
+// Synthetic program generator for the compiler throughput benchmarks.
+//
+// Emits a Lisp program restricted to the subset the compiler supports, shaped
+// to stress one part of the pipeline at a time:
+//
+//   globals   many top-level (define g_N ...) forms -> symbol map, .data
+//   nesting   deeply nested arithmetic             -> parser recursion, codegen
+//   bodies    long function bodies with locals      -> scopes, func section
+//   literals  many numeric literals                 -> lexer numbers, .rodata
+//   comments  comment-heavy source                  -> lexer skipping
+//   mixed     a bit of everything
+//
+// Usage: gen_program <shape> <size> [seed] > out.lisp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long rng_state = 88172645463325252UL;
+
+static unsigned long rng_next(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static int rng_range(int n) { return (int)(rng_next() % (unsigned long)n); }
+
+static void emit_comment_block(FILE *out, int lines) {
+  for (int i = 0; i < lines; ++i) {
+    fprintf(out, ";; %d: the quick brown fox jumps over the lazy dog "
+                 "(define (ignored x) (+ x 1)) \"not a string\"\n",
+            rng_range(100000));
+  }
+}
+
+static void emit_number(FILE *out) {
+  if (rng_range(2)) {
+    fprintf(out, "%d", rng_range(1000));
+  } else {
+    fprintf(out, "%d.%d", rng_range(1000), rng_range(1000));
+  }
+}
+
+static void emit_nested_sum(FILE *out, int depth) {
+  for (int i = 0; i < depth; ++i) {
+    fprintf(out, "(%s ", rng_range(2) ? "+" : "-");
+    emit_number(out);
+    fprintf(out, " ");
+  }
+  emit_number(out);
+  for (int i = 0; i < depth; ++i) {
+    fprintf(out, ")");
+  }
+}
+
+static void gen_globals(FILE *out, int size) {
+  for (int i = 0; i < size; ++i) {
+    fprintf(out, "(define g_%d ", i);
+    if (i > 0 && rng_range(2)) {
+      fprintf(out, "(+ g_%d ", rng_range(i));
+      emit_number(out);
+      fprintf(out, ")");
+    } else {
+      emit_number(out);
+    }
+    fprintf(out, ")\n");
+  }
+}
+
+static void gen_nesting(FILE *out, int size) {
+  const int depth = 64;
+  for (int i = 0; i < size / depth + 1; ++i) {
+    fprintf(out, "(define n_%d ", i);
+    emit_nested_sum(out, depth);
+    fprintf(out, ")\n");
+  }
+}
+
+static void emit_function(FILE *out, int id, int body_len) {
+  fprintf(out, "(define (f_%d a b)\n", id);
+  fprintf(out, "  (define l_0 (+ a b))\n");
+  for (int i = 1; i < body_len; ++i) {
+    fprintf(out, "  (define l_%d (if #t (+ l_%d ", i, i - 1);
+    emit_number(out);
+    fprintf(out, ") (- l_%d a)))\n", rng_range(i));
+  }
+  fprintf(out, "  (+ l_%d a))\n", body_len - 1);
+}
+
+static void gen_bodies(FILE *out, int size) {
+  const int body_len = 64;
+  int funcs = size / body_len + 1;
+  for (int i = 0; i < funcs; ++i) {
+    emit_function(out, i, body_len);
+  }
+  for (int i = 0; i < funcs; ++i) {
+    fprintf(out, "(define r_%d (f_%d %d %d))\n", i, i, rng_range(100),
+            rng_range(100));
+  }
+}
+
+static void gen_literals(FILE *out, int size) {
+  for (int i = 0; i < size; ++i) {
+    fprintf(out, "(+ ");
+    emit_number(out);
+    fprintf(out, " ");
+    emit_number(out);
+    fprintf(out, ")\n");
+  }
+}
+
+static void gen_comments(FILE *out, int size) {
+  for (int i = 0; i < size; ++i) {
+    emit_comment_block(out, 8);
+    fprintf(out, "(define c_%d %d) ; trailing comment\n", i, i);
+  }
+}
+
+static void gen_mixed(FILE *out, int size) {
+  int chunk = size / 4 + 1;
+  emit_comment_block(out, chunk / 8 + 1);
+  gen_globals(out, chunk);
+  for (int i = 0; i < chunk / 16 + 1; ++i) {
+    emit_function(out, i, 16);
+    fprintf(out, "(define m_%d (f_%d g_%d ", i, i, rng_range(chunk));
+    emit_nested_sum(out, 8);
+    fprintf(out, "))\n");
+  }
+  gen_literals(out, chunk);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "Usage: %s <globals|nesting|bodies|literals|comments|mixed> "
+            "<size> [seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *shape = argv[1];
+  int size = atoi(argv[2]);
+  if (argc > 3) {
+    rng_state ^= strtoul(argv[3], NULL, 10) * 2654435761UL;
+  }
+  if (size <= 0) {
+    fprintf(stderr, "Error: size must be positive.\n");
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stdout, "; generated by gen_program: shape=%s size=%d\n", shape,
+          size);
+  if (strcmp(shape, "globals") == 0)
+    gen_globals(stdout, size);
+  else if (strcmp(shape, "nesting") == 0)
+    gen_nesting(stdout, size);
+  else if (strcmp(shape, "bodies") == 0)
+    gen_bodies(stdout, size);
+  else if (strcmp(shape, "literals") == 0)
+    gen_literals(stdout, size);
+  else if (strcmp(shape, "comments") == 0)
+    gen_comments(stdout, size);
+  else if (strcmp(shape, "mixed") == 0)
+    gen_mixed(stdout, size);
+  else {
+    fprintf(stderr, "Error: unknown shape '%s'.\n", shape);
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
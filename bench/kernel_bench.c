@@ -0,0 +1,283 @@
+// Generated-code benchmark.
+//
+// For every kernel base path given on the command line, runs <base>.out (the
+// compiled Lisp program), <base>.source-order.out (the same program compiled
+// with --no-function-layout) and <base>.c.out (the C baseline) as child
+// processes and reports the best wall time out of N runs. When
+// perf_event_open is available the cycles, instructions, cache misses and
+// iTLB and L1 instruction cache misses of the same run are reported too;
+// otherwise those columns read "n/a".
+//
+// The C baselines check their result through the exit status. The Lisp
+// kernels print theirs, and their output is compared with the
+// "; Expected output: " line of <base>.lisp.
+//
+// Usage: kernel_bench [-n runs] <kernel-base>...
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct CounterSpec {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+static const struct CounterSpec counter_specs[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"itlb-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_ITLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+         PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {"l1i-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1I | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+         PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+};
+#define NUM_COUNTERS (sizeof(counter_specs) / sizeof(counter_specs[0]))
+
+#define MAX_OUTPUT 256
+
+struct RunResult {
+  int ok;
+  int exit_status;
+  int wrong_output; // stdout differs from the expected output
+  char output[MAX_OUTPUT];
+  double seconds;
+  int have_counter[NUM_COUNTERS];
+  uint64_t counters[NUM_COUNTERS];
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int open_counter(const struct CounterSpec *spec, pid_t pid) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = spec->type;
+  attr.config = spec->config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+// The child blocks on a pipe until the parent has attached the counters, so
+// that enable_on_exec starts them exactly at the exec of the kernel. Its
+// stdout goes to a temporary file, checked against expected unless that is
+// NULL.
+static struct RunResult run_once(const char *path, const char *expected) {
+  struct RunResult result;
+  memset(&result, 0, sizeof(result));
+
+  FILE *output = tmpfile();
+  if (!output) {
+    perror("tmpfile");
+    return result;
+  }
+  int sync_pipe[2];
+  if (pipe(sync_pipe) != 0) {
+    perror("pipe");
+    fclose(output);
+    return result;
+  }
+
+  double t0 = now_seconds();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    fclose(output);
+    return result;
+  }
+  if (pid == 0) {
+    char go;
+    close(sync_pipe[1]);
+    if (read(sync_pipe[0], &go, 1) != 1 ||
+        dup2(fileno(output), STDOUT_FILENO) < 0) {
+      _exit(127);
+    }
+    execl(path, path, (char *)NULL);
+    perror("execl");
+    _exit(127);
+  }
+
+  close(sync_pipe[0]);
+  int fds[NUM_COUNTERS];
+  for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+    fds[i] = open_counter(&counter_specs[i], pid);
+  }
+  if (write(sync_pipe[1], "g", 1) != 1) {
+    perror("write");
+  }
+  close(sync_pipe[1]);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  result.seconds = now_seconds() - t0;
+  result.ok = WIFEXITED(status) && WEXITSTATUS(status) != 127;
+  result.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+  for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+    if (fds[i] < 0) {
+      continue;
+    }
+    uint64_t value;
+    if (read(fds[i], &value, sizeof(value)) == sizeof(value)) {
+      result.have_counter[i] = 1;
+      result.counters[i] = value;
+    }
+    close(fds[i]);
+  }
+
+  rewind(output);
+  size_t len = fread(result.output, 1, MAX_OUTPUT - 1, output);
+  result.output[len] = '\0';
+  fclose(output);
+  result.output[strcspn(result.output, "\n")] = '\0';
+  result.wrong_output = expected && strcmp(result.output, expected) != 0;
+  return result;
+}
+
+// Reads the expected output of a Lisp kernel from its source into buf;
+// returns NULL if there is none
+static const char *expected_output(const char *base, char *buf, size_t size) {
+  static const char marker[] = "; Expected output: ";
+  char path[512];
+  snprintf(path, sizeof(path), "%s.lisp", base);
+  FILE *source = fopen(path, "r");
+  if (!source) {
+    return NULL;
+  }
+  const char *found = NULL;
+  char line[MAX_OUTPUT];
+  while (!found && fgets(line, sizeof(line), source)) {
+    if (strncmp(line, marker, sizeof(marker) - 1) == 0) {
+      snprintf(buf, size, "%s", line + sizeof(marker) - 1);
+      buf[strcspn(buf, "\n")] = '\0';
+      found = buf;
+    }
+  }
+  fclose(source);
+  return found;
+}
+
+static int best_of(const char *path, const char *expected, int runs,
+                   struct RunResult *best) {
+  if (access(path, X_OK) != 0) {
+    return 0;
+  }
+  for (int i = 0; i < runs; ++i) {
+    struct RunResult r = run_once(path, expected);
+    if (!r.ok) {
+      return 0;
+    }
+    if (i == 0 || r.seconds < best->seconds) {
+      *best = r;
+    }
+  }
+  return 1;
+}
+
+static void print_row(const char *label, const struct RunResult *r) {
+  printf("  %-8s %10.3f", label, r->seconds * 1e3);
+  for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+    if (r->have_counter[i]) {
+      printf(" %14llu", (unsigned long long)r->counters[i]);
+    } else {
+      printf(" %14s", "n/a");
+    }
+  }
+  if (r->exit_status != 0) {
+    printf("  (exit status %d)", r->exit_status);
+  }
+  if (r->wrong_output) {
+    printf("  (wrong output \"%s\")", r->output);
+  }
+  printf("\n");
+}
+
+struct Variant {
+  const char *label;
+  const char *suffix;
+  int prints_result; // checked by output rather than exit status
+};
+
+static const struct Variant variants[] = {
+    {"lisp", ".out", 1},
+    {"lisp-src", ".source-order.out", 1},
+    {"c", ".c.out", 0},
+};
+#define NUM_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static void bench_kernel(const char *base, int runs) {
+  printf("%s\n", base);
+  printf("  %-8s %10s", "", "ms");
+  for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+    printf(" %14s", counter_specs[i].name);
+  }
+  printf("\n");
+
+  char expected_buf[MAX_OUTPUT];
+  const char *expected =
+      expected_output(base, expected_buf, sizeof(expected_buf));
+  if (!expected) {
+    printf("  (no expected output in %s.lisp, Lisp results unchecked)\n",
+           base);
+  }
+
+  struct RunResult results[NUM_VARIANTS];
+  int have[NUM_VARIANTS];
+  for (size_t v = 0; v < NUM_VARIANTS; ++v) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s%s", base, variants[v].suffix);
+    have[v] = best_of(path, variants[v].prints_result ? expected : NULL, runs,
+                      &results[v]);
+    if (have[v]) {
+      print_row(variants[v].label, &results[v]);
+    } else {
+      printf("  %-8s skipped (%s missing or failed)\n", variants[v].label,
+             path);
+    }
+  }
+  const struct RunResult *lisp = &results[0];
+  const struct RunResult *c = &results[NUM_VARIANTS - 1];
+  if (have[0] && have[NUM_VARIANTS - 1] && c->seconds > 0) {
+    printf("  lisp/c time ratio: %.2fx\n", lisp->seconds / c->seconds);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+  int runs = 5;
+  int first_kernel = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    runs = atoi(argv[2]);
+    first_kernel = 3;
+  }
+  if (first_kernel >= argc || runs <= 0) {
+    fprintf(stderr, "Usage: %s [-n runs] <kernel-base>...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (int i = first_kernel; i < argc; ++i) {
+    bench_kernel(argv[i], runs);
+  }
+  return 0;
+}
@@ -0,0 +1,15 @@
+// C baseline for ackermann.lisp
+#include <stdio.h>
+
+static double ack(double m, double n) {
+  if (m == 0)
+    return n + 1;
+  if (n == 0)
+    return ack(m - 1, 1);
+  return ack(m - 1, ack(m, n - 1));
+}
+
+int main(void) {
+  volatile double result = ack(3, 8);
+  return result == 2045.0 ? 0 : 1;
+}
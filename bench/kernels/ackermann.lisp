@@ -0,0 +1,12 @@
+; ackermann.lisp - Ackermann function, very deep non-tail recursion.
+; Expected output: 2045
+
+(define (ack m n)
+  (if (= m 0)
+      (+ n 1)
+      (if (= n 0)
+          (ack (- m 1) 1)
+          (ack (- m 1) (ack m (- n 1))))))
+
+(define result (ack 3 8))
+(print result)
@@ -0,0 +1,13 @@
+// C baseline for fib.lisp
+#include <stdio.h>
+
+static double fib(double n) {
+  if (n < 2)
+    return n;
+  return fib(n - 1) + fib(n - 2);
+}
+
+int main(void) {
+  volatile double result = fib(30);
+  return result == 832040.0 ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+; fib.lisp - doubly recursive Fibonacci, dominated by call overhead and
+; boxing of small arithmetic results.
+; Expected output: 832040
+
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define result (fib 30))
+(print result)
@@ -0,0 +1,15 @@
+// C baseline for integrate.lisp
+#include <stdio.h>
+
+static double f(double x) { return 4 / (1 + x * x); }
+
+int main(void) {
+  const double steps = 1000000;
+  const double h = 1 / steps;
+  double acc = 0;
+  for (double i = 0; i < steps; i += 1) {
+    acc += h * f(h * (i + 0.5));
+  }
+  volatile double result = acc;
+  return result > 3.14 && result < 3.15 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+; integrate.lisp - midpoint rule for the integral of 4/(1+x^2) over [0, 1],
+; i.e. pi. Floating point heavy; the range is split into chunks to keep the
+; recursion depth bounded.
+; Expected output: 3.141592653589975
+
+(define (f x) (/ 4 (+ 1 (* x x))))
+
+(define (integrate-chunk i end h acc)
+  (if (< i end)
+      (integrate-chunk (+ i 1) end h (+ acc (* h (f (* h (+ i 0.5))))))
+      acc))
+
+(define (integrate-range lo hi chunk h acc)
+  (if (< lo hi)
+      (integrate-range (+ lo chunk) hi chunk h
+                       (integrate-chunk lo (+ lo chunk) h acc))
+      acc))
+
+(define steps 1000000)
+(define result (integrate-range 0 steps 1000 (/ 1 steps) 0))
+(print result)
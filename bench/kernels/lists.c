@@ -0,0 +1,35 @@
+// C baseline for lists.lisp
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Cell {
+  double car;
+  struct Cell *cdr;
+};
+
+static struct Cell *build(double n, struct Cell *acc) {
+  while (n != 0) {
+    struct Cell *c = malloc(sizeof(struct Cell));
+    c->car = n;
+    c->cdr = acc;
+    acc = c;
+    n -= 1;
+  }
+  return acc;
+}
+
+static double sum_list(struct Cell *lst, double acc) {
+  for (; lst != NULL; lst = lst->cdr) {
+    acc += lst->car;
+  }
+  return acc;
+}
+
+int main(void) {
+  double acc = 0;
+  for (int k = 0; k < 100; ++k) {
+    acc += sum_list(build(10000, NULL), 0);
+  }
+  volatile double result = acc;
+  return result == 5000500000.0 ? 0 : 1;
+}
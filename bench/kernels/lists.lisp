@@ -0,0 +1,21 @@
+; lists.lisp - builds and walks a 10000 element list 100 times; allocation
+; and pointer chasing.
+; Expected output: 5000500000
+
+(define (build n acc)
+  (if (= n 0)
+      acc
+      (build (- n 1) (cons n acc))))
+
+(define (sum-list lst acc)
+  (if (null? lst)
+      acc
+      (sum-list (cdr lst) (+ acc (car lst)))))
+
+(define (repeat k acc)
+  (if (= k 0)
+      acc
+      (repeat (- k 1) (+ acc (sum-list (build 10000 '()) 0)))))
+
+(define result (repeat 100 0))
+(print result)
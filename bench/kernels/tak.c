@@ -0,0 +1,13 @@
+// C baseline for tak.lisp
+#include <stdio.h>
+
+static double tak(double x, double y, double z) {
+  if (y < x)
+    return tak(tak(x - 1, y, z), tak(y - 1, z, x), tak(z - 1, x, y));
+  return z;
+}
+
+int main(void) {
+  volatile double result = tak(24, 16, 8);
+  return result == 9.0 ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+; tak.lisp - Takeuchi function, three-argument calls and deep recursion.
+; Expected output: 9
+
+(define (tak x y z)
+  (if (< y x)
+      (tak (tak (- x 1) y z)
+           (tak (- y 1) z x)
+           (tak (- z 1) x y))
+      z))
+
+(define result (tak 24 16 8))
+(print result)
@@ -0,0 +1,179 @@
+// Pair space benchmark.
+//
+// Builds and walks N-element lists (10M by default) through the runtime's
+// list primitives and compares them with a baseline that mallocs every cell
+// separately, which is what LVAL_PAIR values inside LispValue would cost:
+//
+//   cons      lisp_cons from the last element to the first
+//   list      lisp_list over an argument array (one contiguous block)
+//   malloc    one malloc'd LispValue-sized cell per element
+//
+// Each variant reports the best build and walk (sum of the cars) time out
+// of N iterations. The element values are shared by all variants.
+//
+// Usage: pair_bench [-n iterations] [length]
+
+#include "lispvalue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Normally emitted into every compiled program's data section
+struct LispValue G_LISP_TRUE = {.type = LVAL_TRUE};
+struct LispValue G_LISP_NIL = {.type = LVAL_NIL};
+
+struct LispValue *lisp_make_number(double num);
+struct LispValue *lisp_cons(struct LispValue *car, struct LispValue *cdr);
+struct LispValue *lisp_list(size_t count, struct LispValue **args);
+struct LispValue *lisp_car(struct LispValue *pair);
+struct LispValue *lisp_cdr(struct LispValue *pair);
+
+// Same footprint as a pair stored inside a tagged LispValue
+struct MallocCell {
+  enum LispValueType type;
+  struct LispValue *car;
+  struct MallocCell *cdr;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct LispValue *build_cons(struct LispValue **values, size_t n) {
+  struct LispValue *list = &G_LISP_NIL;
+  for (size_t i = n; i > 0; --i) {
+    list = lisp_cons(values[i - 1], list);
+  }
+  return list;
+}
+
+static double walk_pairs(struct LispValue *list) {
+  double sum = 0;
+  while (list != &G_LISP_NIL) {
+    sum += lisp_car(list)->value.num_val;
+    list = lisp_cdr(list);
+  }
+  return sum;
+}
+
+static struct MallocCell *build_malloc(struct LispValue **values, size_t n) {
+  struct MallocCell *list = NULL;
+  for (size_t i = n; i > 0; --i) {
+    struct MallocCell *cell = malloc(sizeof(struct MallocCell));
+    if (!cell) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    cell->type = LVAL_PAIR;
+    cell->car = values[i - 1];
+    cell->cdr = list;
+    list = cell;
+  }
+  return list;
+}
+
+static double walk_malloc(struct MallocCell *list) {
+  double sum = 0;
+  for (; list != NULL; list = list->cdr) {
+    sum += list->car->value.num_val;
+  }
+  return sum;
+}
+
+static void free_malloc(struct MallocCell *list) {
+  while (list != NULL) {
+    struct MallocCell *next = list->cdr;
+    free(list);
+    list = next;
+  }
+}
+
+static void report(const char *name, double build, double walk, size_t n) {
+  printf("  %-8s %12.3f %12.3f %14.2f\n", name, build * 1e3, walk * 1e3,
+         walk * 1e9 / n);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+  int iterations = 3;
+  size_t n = 10 * 1000 * 1000;
+  int argi = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    argi = 3;
+  }
+  if (argi < argc) {
+    n = strtoul(argv[argi], NULL, 10);
+  }
+  if (iterations <= 0 || n == 0) {
+    fprintf(stderr, "Usage: %s [-n iterations] [length]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  struct LispValue **values = malloc(n * sizeof(*values));
+  if (!values) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  double expected = 0;
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = lisp_make_number((double)(i % 1000));
+    expected += (double)(i % 1000);
+  }
+
+  printf("%zu-element lists (best of %d)\n", n, iterations);
+  printf("  %-8s %12s %12s %14s\n", "variant", "build ms", "walk ms",
+         "walk ns/elem");
+
+  double best_build[3] = {1e30, 1e30, 1e30};
+  double best_walk[3] = {1e30, 1e30, 1e30};
+  for (int it = 0; it < iterations; ++it) {
+    double times[3][2];
+    double sums[3];
+
+    double t0 = now_seconds();
+    struct LispValue *consed = build_cons(values, n);
+    times[0][0] = now_seconds() - t0;
+    t0 = now_seconds();
+    sums[0] = walk_pairs(consed);
+    times[0][1] = now_seconds() - t0;
+
+    t0 = now_seconds();
+    struct LispValue *listed = lisp_list(n, values);
+    times[1][0] = now_seconds() - t0;
+    t0 = now_seconds();
+    sums[1] = walk_pairs(listed);
+    times[1][1] = now_seconds() - t0;
+
+    t0 = now_seconds();
+    struct MallocCell *malloced = build_malloc(values, n);
+    times[2][0] = now_seconds() - t0;
+    t0 = now_seconds();
+    sums[2] = walk_malloc(malloced);
+    times[2][1] = now_seconds() - t0;
+    free_malloc(malloced);
+
+    for (int v = 0; v < 3; ++v) {
+      if (sums[v] != expected) {
+        fprintf(stderr, "Error: variant %d summed to %f, expected %f\n", v,
+                sums[v], expected);
+        return EXIT_FAILURE;
+      }
+      if (times[v][0] < best_build[v]) {
+        best_build[v] = times[v][0];
+      }
+      if (times[v][1] < best_walk[v]) {
+        best_walk[v] = times[v][1];
+      }
+    }
+  }
+
+  report("cons", best_build[0], best_walk[0], n);
+  report("list", best_build[1], best_walk[1], n);
+  report("malloc", best_build[2], best_walk[2], n);
+  return 0;
+}
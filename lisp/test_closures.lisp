@@ -0,0 +1,52 @@
+; Closures: lambda and nested define, with free variables copied into flat
+; closure records. Records that never leave their frame live on the stack,
+; and nested functions that are only ever called directly get none at all.
+; Expected output: 15 18 13 28 385 42 6 32
+
+; Passed to a parameter that is only called, so the lambda's record is
+; built in the caller's frame
+(define (apply-twice f x)
+  (f (f x)))
+
+(define (scale-twice k x)
+  (apply-twice (lambda (y) (* k y)) x))
+
+; Returned, so the record is allocated on the heap
+(define (make-adder n)
+  (lambda (x) (+ x n)))
+
+(define (compose f g)
+  (lambda (x) (f (g x))))
+
+; Only called directly: lifted, n is passed as an extra argument
+(define (sum-of-squares-to n)
+  (define (term i) (* i i))
+  (define (go i acc)
+    (if (> i n)
+        acc
+        (go (+ i 1) (+ acc (term i)))))
+  (go 1 0))
+
+; Escapes through a list, so it is a heap closure
+(define (counter-list start)
+  (define (next) (+ start 1))
+  (list next))
+
+(define (double x) (* 2 x))
+
+(define add5 (make-adder 5))
+(define add5_result (add5 10))
+(define twice_scaled (scale-twice 3 2))
+(define composed ((compose add5 double) 4))
+(define global_as_value (apply-twice double 7))
+(define squares (sum-of-squares-to 10))
+(define from_list ((car (counter-list 41))))
+(define immediate ((lambda (a b) (- a b)) 10 4))
+(define let_bound
+  (let ((k 4))
+    (let ((times-k (lambda (x) (* x k))))
+      (times-k (times-k 2)))))
+
+(print add5_result) (print twice_scaled) (print composed)
+(print global_as_value) (print squares) (print from_list) (print immediate)
+(print let_bound)
@@ -0,0 +1,28 @@
+; Dead code elimination: only what the program's output depends on is
+; compiled. Compare the assembly with and without --no-dce.
+
+; A small library, of which the program uses two functions
+(define (square x) (* x x))
+(define (cube x) (* x (square x)))
+(define (average a b) (/ (+ a b) 2))
+(define (fact n) (if (< n 2) 1 (* n (fact (- n 1)))))
+
+; Unused, and their initializers have no side effects: removed, together
+; with the string literal
+(define table (list 1 2 3))
+(define greeting "never printed")
+(define big (fact 10))
+
+; Its initializer prints, so it is kept even though nothing reads it
+(define (log-value x) (display x) (newline) x)
+(define logged (log-value 7))
+
+; Only assigned by a function that the program calls: kept
+(define counter 0)
+(define (count!) (set! counter (+ counter 1)) counter)
+
+(display (cube 3))
+(newline)
+(count!)
+(display (count!))
+(newline)
@@ -0,0 +1,24 @@
+; future runs its body as a task on the runtime's work-stealing scheduler and
+; touch waits for the result. LISP_WORKERS=n sets the number of workers.
+; Expected output: 832040 (10 9 8 7 6 5 4 3 2 1) 2000 5 #<future> 6
+
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (pfib n)
+  (if (< n 20)
+      (fib n)
+      (let ((a (future (pfib (- n 1))))
+            (b (pfib (- n 2))))
+        (+ (touch a) b))))
+
+(define (build n) (if (< n 1) '() (cons n (build (- n 1)))))
+(define (length-of l) (if (null? l) 0 (+ 1 (length-of (cdr l)))))
+
+(define lists (list (future (build 10)) (future (length-of (build 2000)))))
+(print (pfib 30))
+(print (touch (car lists)))
+(print (touch (car (cdr lists))))
+(print (touch 5))
+(print (future 1))
+(define k 3)
+(print (touch (spawn (lambda () (* k 2)))))
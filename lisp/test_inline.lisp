@@ -0,0 +1,49 @@
+; Inlining: calls to small, non-recursive global functions are replaced by
+; their bodies, and the inlined code is folded where arguments are constants.
+; Expected output: 9 10 25 120 42 15 11
+
+(define (square x) (* x x))
+
+(define (clamp x lo hi)
+  (if (< x lo) lo (if (> x hi) hi x)))
+
+; Constant arguments are substituted, then (* 3 3) folds to 9
+(define nine (square 3))
+
+; Folds to 10: both comparisons are decided at compile time
+(define clamped (clamp 12 0 10))
+
+; Non-constant arguments are bound by a let around the body
+(define (sum-of-squares a b)
+  (+ (square a) (square b)))
+
+(define twenty-five (sum-of-squares 3 4))
+
+; Recursive, so it is never inlined
+(define (fact n)
+  (if (< n 2) 1 (* n (fact (- n 1)))))
+
+(define fact-5 (fact 5))
+
+; The parameter is assigned, so the argument is bound rather than substituted
+(define (bump x)
+  (set! x (+ x 1))
+  x)
+
+(define bumped (bump 41))
+
+; add-offset's body refers to the global offset, which the caller's
+; parameter shadows: not inlined there
+(define offset 10)
+
+(define (add-offset x) (+ x offset))
+
+(define (shadowed offset)
+  (add-offset offset))
+
+(define shadowed-result (shadowed 5))
+
+(define offset-result (add-offset 1))
+
+(print nine) (print clamped) (print twenty-five) (print fact-5) (print bumped)
+(print shadowed-result) (print offset-result)
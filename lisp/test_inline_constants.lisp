@@ -0,0 +1,16 @@
+; Inlining and folding must not change what a program computes: `make
+; check-inline` runs this at the default threshold and with
+; --inline-threshold 0 and compares the output. Expected output:
+; 1.0000003 0.0000007 #t 1.0000001 6.0000001 #t
+
+(define (f x) (* x 0.0000001))
+(define (g x y) (+ x y 0.0000001))
+(define (small? x) (< x 0.0000002))
+(define (shift x) (- x 0.0000001))
+
+(print (+ 1 (f 3)))
+(print (f 7))
+(print (small? (f 1)))
+(print (g 1 0))
+(print (g 2 4))
+(print (< (shift 0.0000002) 0.0000002))
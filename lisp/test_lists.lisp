@@ -0,0 +1,32 @@
+; test_lists.lisp - cons cells live in the runtime's pair space. Expected
+; output: (1 2 3 4) 2 10 60 #t #t () 500500 1000
+
+(define (build n acc)
+  (if (= n 0)
+      acc
+      (build (- n 1) (cons n acc))))
+
+(define (sum-list lst)
+  (let loop ((rest lst) (acc 0))
+    (if (null? rest)
+        acc
+        (loop (cdr rest) (+ acc (car rest))))))
+
+(define (length-of lst)
+  (do ((rest lst (cdr rest))
+       (n 0 (+ n 1)))
+      ((null? rest) n)))
+
+(define small (list 1 2 3 4))
+(define second (car (cdr small)))
+(define small_sum (sum-list small))
+(define quoted_sum (sum-list '(10 20 30)))
+(define empty_is_null (null? '()))
+(define pair_is_pair (pair? (cons 1 2)))
+(define number_is_pair (pair? 5))
+(define built_sum (sum-list (build 1000 '())))
+(define built_len (length-of (build 1000 '())))
+
+(print small) (print second) (print small_sum) (print quoted_sum)
+(print empty_is_null) (print pair_is_pair) (print number_is_pair)
+(print built_sum) (print built_len)
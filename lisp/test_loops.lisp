@@ -0,0 +1,59 @@
+; Iteration without recursion: while, do and named let all compile to a
+; back-edge inside the current frame. Expected output:
+; 45 10 500000500000 1000 832040 2 1 6 303
+
+(define (sum-to n)
+  (let loop ((i 0) (acc 0))
+    (if (> i n)
+        acc
+        (loop (+ i 1) (+ acc i)))))
+
+(define (count-down n)
+  (define steps 0)
+  (while (> n 0)
+    (set! n (- n 1))
+    (set! steps (+ steps 1)))
+  steps)
+
+(define (fib n)
+  (do ((i 0 (+ i 1))
+       (a 0 b)
+       (b 1 (+ a b)))
+      ((= i n) a)))
+
+(define total 0)
+(define i 0)
+(while (< i 10)
+  (set! total (+ total i))
+  (set! i (+ i 1)))
+
+(define sum_million (sum-to 1000000))
+(define countdown (count-down 1000))
+(define fib_30 (fib 30))
+(define diff (- 5 3))
+(define shadow
+  (let ((x 1) (y 2))
+    (let ((x y) (y x))
+      (- x y))))
+
+; An inner named let in tail position of the outer one can go on with
+; either loop; the pairs (i, j) with j < i
+(define pairs
+  (let outer ((i 0) (n 0))
+    (if (< i 4)
+        (let inner ((j 0) (n n))
+          (if (< j i) (inner (+ j 1) (+ n 1)) (outer (+ i 1) n)))
+        n)))
+
+; Outside tail position the inner loop cannot jump to the outer one, whose
+; pending (+ 100 ...) it would skip: (outer (+ i 1)) in place of j below is
+; a compile error
+(define nested-sum
+  (let outer ((i 0) (acc 0))
+    (if (< i 3)
+        (outer (+ i 1)
+               (+ acc 100 (let inner ((j 0)) (if (< j i) (inner (+ j 1)) j))))
+        acc)))
+
+(print total) (print i) (print sum_million) (print countdown) (print fib_30)
+(print diff) (print shadow) (print pairs) (print nested-sum)
@@ -0,0 +1,36 @@
+; Functions with more than six parameters take the rest on the stack, as in
+; the System V ABI, and the stack stays 16-byte aligned at every call.
+; Expected output: 204 44 120 56 1315
+
+; Weights every argument differently, so that a swapped one shows
+(define (weigh a b c d e f g h)
+  (+ a (* 2 b) (* 3 c) (* 4 d) (* 5 e) (* 6 f) (* 7 g) (* 8 h)))
+
+(define direct (weigh 1 2 3 4 5 6 7 8))
+
+; Arguments that are calls themselves
+(define nested (weigh (weigh 1 1 1 1 1 1 1 1) 0 0 0 0 0 0 (- 10 9)))
+
+; Through the closure entry, which moves the sixth argument back into r9
+(define (call-with-eight fn)
+  (fn 8 7 6 5 4 3 2 1))
+(define as-value (call-with-eight weigh))
+
+; Closure code gets its record in rdi, so it has one register less
+(define (make-weigher k)
+  (lambda (a b c d e f g) (* k (+ a b c d e f g))))
+(define closure-seven ((make-weigher 2) 1 2 3 4 5 6 7))
+
+; A lifted function whose free variables go on the stack after its arguments
+(define (lifted x)
+  (define u 100)
+  (define v 200)
+  (define (sum a b c d e) (+ a b c d e u v x))
+  (sum 1 2 3 4 5))
+(define lifted-sum (lifted 1000))
+
+(print direct)
+(print nested)
+(print as-value)
+(print closure-seven)
+(print lifted-sum)
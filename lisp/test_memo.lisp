@@ -0,0 +1,32 @@
+; define-memo caches a function's results keyed on its numeric arguments,
+; which makes recurrences like these linear instead of exponential.
+
+(define-memo (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+; Number of paths through an m by n grid, two arguments per key
+(define-memo (paths m n)
+  (if (= m 0)
+      1
+      (if (= n 0)
+          1
+          (+ (paths (- m 1) n) (paths m (- n 1))))))
+
+; With a bound, entries are evicted once 8 are cached
+(define-memo (bounded n) :limit 8
+  (if (< n 2)
+      n
+      (+ (bounded (- n 1)) (bounded (- n 2)))))
+
+(define fib-80 (fib 80))
+(define paths-16 (paths 16 16))
+(define bounded-40 (bounded 40))
+
+(display fib-80)
+(newline)
+(display paths-16)
+(newline)
+(display bounded-40)
+(newline)
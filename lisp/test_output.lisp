@@ -0,0 +1,15 @@
+; test_output.lisp - display, print and newline write to a buffered stdout
+
+(display "squares:")
+(newline)
+(do ((i 0 (+ i 1)))
+    ((= i 5))
+  (display (* i i))
+  (display " "))
+(newline)
+(print "quoted")
+(print (list 1 2.5 (list 3 0.1)))
+(print (cons 1 2))
+(print (vector 0.5 -1.25 1e21))
+(print (< 1 2))
+(print (/ 1 3))
@@ -0,0 +1,29 @@
+; pmap, preduce and psort split lists and vectors into ranges that run on
+; the task scheduler's workers; short collections run serially.
+; Expected output: 333328333350000 4999950000 0 99999 (1 4 9) 10 (1 2 3 5)
+; 20 6
+
+(define n 100000)
+(define v (make-vector n 0))
+(define (fill i)
+  (if (< i n)
+      (let ((x (vector-set! v i (- n (+ i 1))))) (fill (+ i 1)))
+      v))
+(fill 0)
+
+(define (square x) (* x x))
+(define (add a b) (+ a b))
+
+(define squares (pmap square v))
+(print (preduce add 0 squares))
+(print (preduce (lambda (a b) (+ a b)) 0 v))
+(define sorted (psort v))
+(print (vector-ref sorted 0))
+(print (vector-ref sorted (- n 1)))
+
+(print (pmap square (list 1 2 3)))
+(print (preduce add 4 (list 1 2 3)))
+(print (psort (list 3 1 5 2)))
+(define k 5)
+(print (preduce add 0 (pmap (lambda (x) (+ x k)) (list -3 -2 -1 0 1))))
+(print (preduce add 6 '()))
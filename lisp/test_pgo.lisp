@@ -0,0 +1,30 @@
+; --profile-generate counts function entries and if branches and writes them
+; to test_pgo.profdata at exit; compiling again with
+; --profile-use lisp/test_pgo.profdata makes the else branches of classify
+; and the floor-div loop fall through, inlines the hot small functions more
+; readily and lays out sum-classes first in the func section.
+; Expected output: 3 333 -499
+
+(define (rarely-called x) (* x 3))
+
+(define (classify n)
+  (if (= n 0)
+      1
+      (if (< n 0) -1 0)))
+
+(define (floor-div a b)
+  (let loop ((q 0) (r a))
+    (if (< r b) q (loop (+ q 1) (- r b)))))
+
+(define (count-multiples n k acc)
+  (if (> n 0)
+      (count-multiples (- n 1) k
+                       (if (= (- n (* k (floor-div n k))) 0) (+ acc 1) acc))
+      acc))
+
+(define (sum-classes n acc)
+  (if (< n 1000) (sum-classes (+ n 1) (+ acc (classify n))) acc))
+
+(print (rarely-called 1))
+(print (count-multiples 1000 3 0))
+(print (sum-classes (- 0 500) 0))
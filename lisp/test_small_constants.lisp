@@ -0,0 +1,13 @@
+; Literal operands of fused arithmetic and comparisons keep every bit of
+; their value, however small. Expected output:
+; 1.0000001 #t () 1.00000020000001 0.0000003 #t 1
+
+(define x 0.0000001)
+(define (scale y) (* y 0.0000001))
+(print (+ 1 0.0000001))
+(print (< 0.0000001 0.0000002))
+(print (= x 0.0000002))
+(print (+ 1 0.0000001 0.0000001 0.00000000000001))
+(print (scale 3))
+(print (= x 0.0000001))
+(print (if (< 0 (- 0.0000001 0.00000009)) 1 0))
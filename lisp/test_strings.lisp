@@ -0,0 +1,16 @@
+; test_strings.lisp - literals are static, substrings share storage.
+; Expected output: "hello, world" "hello, world" 12 "hello" "world"
+; "world says hello!" 17 "" 0
+
+(define greeting "hello, world")
+(define same_literal "hello, world")
+(define len (string-length greeting))
+(define hello (substring greeting 0 5))
+(define world (substring greeting 7 12))
+(define joined (string-append world " says " hello "!"))
+(define joined_len (string-length joined))
+(define empty (substring hello 2 2))
+(define empty_len (string-length empty))
+
+(print greeting) (print same_literal) (print len) (print hello) (print world)
+(print joined) (print joined_len) (print empty) (print empty_len)
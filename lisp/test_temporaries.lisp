@@ -0,0 +1,21 @@
+; Numbers that are only read before the call they are passed to returns are
+; boxed in the caller's frame instead of the heap. Expected output:
+; 668168750 14 #(3 3.5 28) 1610.5 5 19 76.25
+
+(define (sq x) (* x x))
+(define (dist2 x y) (+ (sq x) (sq y)))
+(define (count-down n acc)
+  (if (< n 1) acc (count-down (- n 1) (+ acc (dist2 (- n 0.5) (+ n 1))))))
+(define v (make-vector 8 1.5))
+(vector-set! v 3 (+ 2 (vector-ref v 2)))
+(define (sum-first v i)
+  (if (< i 1) 0 (+ (vector-ref v (- i 1)) (sum-first v (- i 1)))))
+(define total (count-down 1000 0))
+(define s (sum-first v (vector-length v)))
+(define w (vector (+ 1 2) (vector-ref v 3) (* 2 (vector-sum v))))
+(define d (vector-dot w (vector-map * w (- 5 3))))
+(define cmp (if (= (vector-length v) (+ 4 4)) (string-length "hello") 0))
+(define (deep k x) (if (< k 1) (+ x 0) (+ 0 (deep (- k 1) (+ x 1)))))
+(define dd (deep 10 (sq 3)))
+(print total) (print s) (print w) (print d) (print cmp) (print dd)
+(print (dist2 (vector-ref v 3) (vector-length v)))
@@ -0,0 +1,26 @@
+; test_vectors.lisp - flat double vectors and their SIMD builtins. Expected
+; output: 1003 3 502503 1005006 1005006 1005006 251251.5 500497 32 42 0.25
+
+(define (iota n)
+  (define v (make-vector n 0))
+  (do ((i 0 (+ i 1)))
+      ((= i n) v)
+    (vector-set! v i i)))
+
+(define a (iota 1003))
+(define b (make-vector 1003 2))
+(define len (vector-length a))
+(define third (vector-ref a 3))
+(define sum (vector-sum a))
+(define dot (vector-dot a b))
+(define doubled_sum (vector-sum (vector+ a a)))
+(define scaled_sum (vector-sum (vector* a b)))
+(define halved_sum (vector-sum (vector-map / a 2)))
+(define diff_sum (vector-sum (vector-map - a b)))
+(define literal_dot (vector-dot (vector 1 2 3) (vector 4 5 6)))
+(define product (* 6 7))
+(define quotient (/ 1 4))
+
+(print len) (print third) (print sum) (print dot) (print doubled_sum)
+(print scaled_sum) (print halved_sum) (print diff_sum) (print literal_dot)
+(print product) (print quotient)
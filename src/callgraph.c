@@ -0,0 +1,386 @@
+#include "callgraph.h"
+#include "closure.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_NODE ((size_t)-1)
+
+struct GraphNode {
+  const char *name;
+  unsigned long entries; // from the profile, 0 without one
+  bool cold;
+  size_t chain; // the node that started the chain it is in
+  size_t next;  // in the chain, or NO_NODE
+  long rank;    // increases along the chain
+};
+
+// A chain is identified by the node that started it
+struct Chain {
+  size_t head;
+  size_t tail;
+  size_t len; // 0 once merged into another chain
+  unsigned long hottest;
+  size_t first_index; // lowest node index, for source order
+};
+
+struct CallEdge {
+  size_t a;
+  size_t b;
+  double weight;
+};
+
+struct NodeName {
+  const char *name; // NULL for a free slot
+  size_t node;
+};
+
+struct CallGraph {
+  struct GraphNode *nodes;
+  size_t num_nodes; // the top-level forms call as node num_nodes
+  struct NodeName *by_name; // open addressing, by_name_mask + 1 slots
+  size_t by_name_mask;
+  struct CallEdge *edges;
+  size_t num_edges;
+  size_t capacity;
+};
+
+static bool is_symbol(const struct Expr *expr) {
+  return expr->type == S_TYPE_ATOM &&
+         expr->val.atom_val.type == ATOM_TYPE_SYMBOL;
+}
+
+// The name defined by a top-level (define (name params...) body...) or
+// define-memo, or NULL
+static const char *function_name(const struct Expr *form) {
+  if (form->type != S_TYPE_LIST || form->val.list_val.len < 3 ||
+      !is_symbol(&form->val.list_val.elements[0])) {
+    return NULL;
+  }
+  const char *op = form->val.list_val.elements[0].val.atom_val.value.symbol;
+  if (strcmp(op, "define") != 0 && strcmp(op, "define-memo") != 0) {
+    return NULL;
+  }
+  const struct Expr *target = &form->val.list_val.elements[1];
+  if (target->type != S_TYPE_LIST || target->val.list_val.len == 0 ||
+      !is_symbol(&target->val.list_val.elements[0])) {
+    return NULL;
+  }
+  return target->val.list_val.elements[0].val.atom_val.value.symbol;
+}
+
+// DJB2, as for symbol maps
+static size_t hash_name(const char *name) {
+  size_t hash = 5381;
+  for (const unsigned char *c = (const unsigned char *)name; *c; ++c) {
+    hash = hash * 33 + *c;
+  }
+  return hash;
+}
+
+static struct NodeName *name_slot(const struct CallGraph *g,
+                                  const char *name) {
+  size_t i = hash_name(name) & g->by_name_mask;
+  while (g->by_name[i].name && strcmp(g->by_name[i].name, name) != 0) {
+    i = (i + 1) & g->by_name_mask;
+  }
+  return &g->by_name[i];
+}
+
+// Every symbol of the program is looked up here, so this is a hash table
+static size_t find_node(const struct CallGraph *g, const char *name) {
+  const struct NodeName *slot = name_slot(g, name);
+  return slot->name ? slot->node : NO_NODE;
+}
+
+static void add_edge(struct CallGraph *g, size_t a, size_t b, double weight) {
+  if (g->num_edges == g->capacity) {
+    g->capacity = g->capacity ? g->capacity * 2 : 64;
+    g->edges = realloc(g->edges, g->capacity * sizeof(struct CallEdge));
+    if (!g->edges) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  g->edges[g->num_edges++] = (struct CallEdge){a, b, weight};
+}
+
+// Adds an edge of weight 1 from caller for every reference in expr to a
+// global function
+static void add_call_sites(struct CallGraph *g, size_t caller,
+                           const struct Expr *expr) {
+  if (is_symbol(expr)) {
+    size_t callee = find_node(g, expr->val.atom_val.value.symbol);
+    if (callee != NO_NODE) {
+      add_edge(g, caller, callee, 1);
+    }
+    return;
+  }
+  if (expr->type != S_TYPE_LIST) {
+    return;
+  }
+  const struct ExprVector *vec = &expr->val.list_val;
+  if (vec->len > 0 && is_symbol(&vec->elements[0]) &&
+      strcmp(vec->elements[0].val.atom_val.value.symbol, "quote") == 0) {
+    return;
+  }
+  for (size_t i = 0; i < vec->len; ++i) {
+    add_call_sites(g, caller, &vec->elements[i]);
+  }
+}
+
+static int compare_edge_ends(const void *a, const void *b) {
+  const struct CallEdge *ea = a;
+  const struct CallEdge *eb = b;
+  if (ea->a != eb->a) {
+    return ea->a < eb->a ? -1 : 1;
+  }
+  return ea->b < eb->b ? -1 : ea->b > eb->b;
+}
+
+static int compare_edge_weights(const void *a, const void *b) {
+  const struct CallEdge *ea = a;
+  const struct CallEdge *eb = b;
+  if (ea->weight != eb->weight) {
+    return ea->weight > eb->weight ? -1 : 1;
+  }
+  return compare_edge_ends(a, b);
+}
+
+// Sorts the edges by their ends and adds up the weights of equal ones
+static void merge_edges(struct CallGraph *g) {
+  qsort(g->edges, g->num_edges, sizeof(struct CallEdge), compare_edge_ends);
+  size_t kept = 0;
+  for (size_t i = 0; i < g->num_edges; ++i) {
+    if (kept > 0 && compare_edge_ends(&g->edges[kept - 1], &g->edges[i]) == 0) {
+      g->edges[kept - 1].weight += g->edges[i].weight;
+    } else {
+      g->edges[kept++] = g->edges[i];
+    }
+  }
+  g->num_edges = kept;
+}
+
+static void build_graph(struct CallGraph *g, const struct ExprVector *program,
+                        const struct Profile *profile) {
+  size_t slots = 2;
+  while (slots < 2 * program->len) {
+    slots *= 2;
+  }
+  g->nodes = calloc(program->len ? program->len : 1, sizeof(struct GraphNode));
+  g->by_name = calloc(slots, sizeof(struct NodeName));
+  if (!g->nodes || !g->by_name) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  g->by_name_mask = slots - 1;
+  for (size_t i = 0; i < program->len; ++i) {
+    const char *name = function_name(&program->elements[i]);
+    struct NodeName *slot = name ? name_slot(g, name) : NULL;
+    if (!slot || slot->name) {
+      continue; // the first definition of a name stands for all of them
+    }
+    struct GraphNode *node = &g->nodes[g->num_nodes];
+    node->name = name;
+    if (profile) {
+      profile_function_count(profile, name, &node->entries);
+      node->cold = profile_function_heat(profile, name) == PROFILE_COLD;
+    }
+    *slot = (struct NodeName){name, g->num_nodes};
+    g->num_nodes++;
+  }
+
+  // Call sites, from each function and from the rest of the program. A
+  // local that shadows a function counts as a call of it too: working out
+  // free names would cost more than the layout gets out of it.
+  for (size_t i = 0; i < program->len; ++i) {
+    const struct Expr *form = &program->elements[i];
+    const char *name = function_name(form);
+    if (!name) {
+      add_call_sites(g, g->num_nodes, form);
+      continue;
+    }
+    const struct ExprVector *vec = &form->val.list_val;
+    bool memo =
+        strcmp(vec->elements[0].val.atom_val.value.symbol, "define-memo") == 0;
+    size_t caller = find_node(g, name);
+    for (size_t j = memo ? closure_memo_body_first(vec) : 2; j < vec->len;
+         ++j) {
+      add_call_sites(g, caller, &vec->elements[j]);
+    }
+  }
+  merge_edges(g);
+
+  // Site counts become weights, and each pair of functions one edge
+  double *sites_to = calloc(g->num_nodes + 1, sizeof(double));
+  if (!sites_to) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < g->num_edges; ++i) {
+    sites_to[g->edges[i].b] += g->edges[i].weight;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < g->num_edges; ++i) {
+    struct CallEdge e = g->edges[i];
+    if (e.a == e.b || e.a == g->num_nodes || g->nodes[e.a].cold ||
+        g->nodes[e.b].cold) {
+      continue;
+    }
+    if (g->nodes[e.b].entries > 0) {
+      e.weight = g->nodes[e.b].entries * e.weight / sites_to[e.b];
+    }
+    if (e.a > e.b) {
+      size_t t = e.a;
+      e.a = e.b;
+      e.b = t;
+    }
+    g->edges[kept++] = e;
+  }
+  g->num_edges = kept;
+  free(sites_to);
+  merge_edges(g);
+}
+
+// Joins the chains of f and g, keeping the longer one's order
+static void join_chains(struct CallGraph *g, struct Chain *chains, size_t f,
+                        size_t h, size_t *buffer) {
+  struct Chain *a = &chains[g->nodes[f].chain];
+  struct Chain *b = &chains[g->nodes[h].chain];
+  if (a->len < b->len) {
+    struct Chain *t = a;
+    a = b;
+    b = t;
+    size_t n = f;
+    f = h;
+    h = n;
+  }
+  size_t pf = (size_t)(g->nodes[f].rank - g->nodes[a->head].rank);
+  size_t ph = (size_t)(g->nodes[h].rank - g->nodes[b->head].rank);
+  size_t after_f = a->len - 1 - pf;
+  size_t after_h = b->len - 1 - ph;
+  // Distance between f and h for b appended, appended reversed, prepended
+  // reversed and prepended
+  size_t distance[4] = {after_f + ph, after_f + after_h, pf + ph,
+                        pf + after_h};
+  int best = 0;
+  for (int i = 1; i < 4; ++i) {
+    if (distance[i] < distance[best]) {
+      best = i;
+    }
+  }
+
+  size_t len = 0;
+  for (size_t n = b->head; n != NO_NODE; n = g->nodes[n].next) {
+    buffer[len++] = n;
+  }
+  bool append = best < 2;
+  bool reverse = best == 1 || best == 2;
+  size_t chain = g->nodes[a->head].chain;
+  for (size_t i = 0; i < len; ++i) {
+    // Prepending goes from the end of the sequence to its start
+    size_t k = append != reverse ? i : len - 1 - i;
+    size_t n = buffer[k];
+    g->nodes[n].chain = chain;
+    if (append) {
+      g->nodes[n].rank = g->nodes[a->tail].rank + 1;
+      g->nodes[n].next = NO_NODE;
+      g->nodes[a->tail].next = n;
+      a->tail = n;
+    } else {
+      g->nodes[n].rank = g->nodes[a->head].rank - 1;
+      g->nodes[n].next = a->head;
+      a->head = n;
+    }
+  }
+  a->len += b->len;
+  if (b->hottest > a->hottest) {
+    a->hottest = b->hottest;
+  }
+  if (b->first_index < a->first_index) {
+    a->first_index = b->first_index;
+  }
+  b->len = 0;
+}
+
+static const struct Profile *sort_profile;
+
+static int compare_chains(const void *x, const void *y) {
+  const struct Chain *a = x;
+  const struct Chain *b = y;
+  if (sort_profile && a->hottest != b->hottest) {
+    return a->hottest > b->hottest ? -1 : 1;
+  }
+  return a->first_index < b->first_index ? -1
+                                         : a->first_index > b->first_index;
+}
+
+void callgraph_layout(const struct ExprVector *program,
+                      const struct Profile *profile,
+                      struct FunctionLayout *layout) {
+  struct CallGraph g = {0};
+  build_graph(&g, program, profile);
+
+  size_t n = g.num_nodes;
+  struct Chain *chains = calloc(n ? n : 1, sizeof(struct Chain));
+  size_t *buffer = calloc(n ? n : 1, sizeof(size_t));
+  layout->names = calloc(n ? n : 1, sizeof(const char *));
+  if (!chains || !buffer || !layout->names) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    g.nodes[i].chain = i;
+    g.nodes[i].next = NO_NODE;
+    chains[i] = (struct Chain){.head = i,
+                               .tail = i,
+                               .len = 1,
+                               .hottest = g.nodes[i].entries,
+                               .first_index = i};
+  }
+
+  qsort(g.edges, g.num_edges, sizeof(struct CallEdge), compare_edge_weights);
+  for (size_t i = 0; i < g.num_edges; ++i) {
+    size_t a = g.edges[i].a;
+    size_t b = g.edges[i].b;
+    if (g.nodes[a].chain != g.nodes[b].chain) {
+      join_chains(&g, chains, a, b, buffer);
+    }
+  }
+
+  size_t num_chains = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (chains[i].len > 0 && !g.nodes[chains[i].head].cold) {
+      chains[num_chains++] = chains[i];
+    }
+  }
+  sort_profile = profile;
+  qsort(chains, num_chains, sizeof(struct Chain), compare_chains);
+  layout->len = 0;
+  for (size_t c = 0; c < num_chains; ++c) {
+    for (size_t i = chains[c].head; i != NO_NODE; i = g.nodes[i].next) {
+      layout->names[layout->len++] = g.nodes[i].name;
+    }
+  }
+  layout->num_hot = layout->len;
+  for (size_t i = 0; i < n; ++i) {
+    if (g.nodes[i].cold) {
+      layout->names[layout->len++] = g.nodes[i].name;
+    }
+  }
+
+  free(chains);
+  free(buffer);
+  free(g.nodes);
+  free(g.by_name);
+  free(g.edges);
+}
+
+void function_layout_cleanup(struct FunctionLayout *layout) {
+  free(layout->names);
+  layout->names = NULL;
+  layout->len = 0;
+  layout->num_hot = 0;
+}
@@ -0,0 +1,30 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "expr.h"
+#include "profile.h"
+#include <stddef.h>
+
+// Order of the global functions in the func section.
+struct FunctionLayout
+{
+  const char **names; // borrowed from the AST; hot functions first
+  size_t len;
+  size_t num_hot; // names[num_hot..] go to .text.unlikely
+};
+
+// Lays out the global functions of program so that callers and callees sit
+// next to each other, after Pettis and Hansen: each function starts as a
+// chain of its own, and going through the call graph's edges from the
+// heaviest, the chains at the two ends of an edge are joined in whichever
+// orientation puts the two functions closest. An edge weighs the number of
+// call sites between the functions, or with a profile the share of the
+// callee's entries that those sites account for. Chains are placed from the
+// hottest, or in source order without a profile. With a profile, functions
+// never entered are left out of the graph and placed last, as cold.
+void callgraph_layout (const struct ExprVector *program,
+                       const struct Profile *profile,
+                       struct FunctionLayout *layout);
+void function_layout_cleanup (struct FunctionLayout *layout);
+
+#endif
@@ -0,0 +1,427 @@
+#include "closure.h"
+#include "scope.h"
+#include "symbol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void name_list_push(struct NameList *list, const char *name) {
+  if (list->len == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 8;
+    const char **names = realloc(list->names, capacity * sizeof(char *));
+    if (!names) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    list->names = names;
+    list->capacity = capacity;
+  }
+  list->names[list->len++] = name;
+}
+
+bool name_list_contains(const struct NameList *list, const char *name) {
+  for (size_t i = list->len; i-- > 0;) {
+    if (strcmp(list->names[i], name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void name_list_cleanup(struct NameList *list) {
+  free(list->names);
+  list->names = NULL;
+  list->len = 0;
+  list->capacity = 0;
+}
+
+static bool is_symbol(const struct Expr *expr) {
+  return expr->type == S_TYPE_ATOM &&
+         expr->val.atom_val.type == ATOM_TYPE_SYMBOL;
+}
+
+static bool is_form(const struct Expr *expr, const char *name) {
+  return expr->type == S_TYPE_LIST && expr->val.list_val.len > 0 &&
+         is_symbol(&expr->val.list_val.elements[0]) &&
+         strcmp(expr->val.list_val.elements[0].val.atom_val.value.symbol,
+                name) == 0;
+}
+
+bool closure_is_lambda(const struct Expr *expr) {
+  return is_form(expr, "lambda") && expr->val.list_val.len >= 3 &&
+         expr->val.list_val.elements[1].type == S_TYPE_LIST;
+}
+
+size_t closure_memo_body_first(const struct ExprVector *vec) {
+  if (vec->len > 3 && is_symbol(&vec->elements[2]) &&
+      strcmp(vec->elements[2].val.atom_val.value.symbol, ":limit") == 0) {
+    return 4;
+  }
+  return 2;
+}
+
+// --- AST walker ---
+// Visits every reference to a name that is not bound within the walked code,
+// following the scoping of the special forms the compiler knows. Names are
+// bound sequentially like the compiler does: a body-level define is visible
+// from the next form on, a function define also within its own body.
+
+enum WalkUse { WALK_VALUE, WALK_CALL, WALK_ARG, WALK_SET };
+
+struct Walker {
+  struct NameList bound;
+  int lambda_depth;
+  // For WALK_ARG, call is the call and arg_index counts from 0
+  void (*visit)(struct Walker *w, const char *name, enum WalkUse use,
+                const struct ExprVector *call, size_t arg_index);
+  void *data;
+};
+
+static void walk_expr(struct Walker *w, const struct Expr *expr);
+
+static bool is_unbound_symbol(struct Walker *w, const struct Expr *expr) {
+  return is_symbol(expr) &&
+         !name_list_contains(&w->bound, expr->val.atom_val.value.symbol);
+}
+
+static void bind_params(struct Walker *w, const struct ExprVector *params,
+                        size_t first) {
+  for (size_t i = first; params && i < params->len; ++i) {
+    if (is_symbol(&params->elements[i])) {
+      name_list_push(&w->bound, params->elements[i].val.atom_val.value.symbol);
+    }
+  }
+}
+
+static void walk_range(struct Walker *w, const struct ExprVector *vec,
+                       size_t first) {
+  for (size_t i = first; i < vec->len; ++i) {
+    walk_expr(w, &vec->elements[i]);
+  }
+}
+
+static void walk_body(struct Walker *w, const struct ExprVector *body,
+                      size_t first) {
+  size_t mark = w->bound.len;
+  for (size_t i = first; i < body->len; ++i) {
+    const struct Expr *form = &body->elements[i];
+    if (is_form(form, "define") && form->val.list_val.len >= 3) {
+      const struct Expr *name_part = &form->val.list_val.elements[1];
+      if (is_symbol(name_part)) {
+        walk_expr(w, form);
+        name_list_push(&w->bound, name_part->val.atom_val.value.symbol);
+        continue;
+      }
+      if (name_part->type == S_TYPE_LIST && name_part->val.list_val.len > 0 &&
+          is_symbol(&name_part->val.list_val.elements[0])) {
+        name_list_push(
+            &w->bound,
+            name_part->val.list_val.elements[0].val.atom_val.value.symbol);
+      }
+    }
+    walk_expr(w, form);
+  }
+  w->bound.len = mark;
+}
+
+static void walk_function(struct Walker *w, const struct ExprVector *params,
+                          size_t params_first, const char *self,
+                          const struct ExprVector *body, size_t first) {
+  size_t mark = w->bound.len;
+  w->lambda_depth++;
+  if (self) {
+    name_list_push(&w->bound, self);
+  }
+  bind_params(w, params, params_first);
+  walk_body(w, body, first);
+  w->lambda_depth--;
+  w->bound.len = mark;
+}
+
+static bool is_binding_list(const struct Expr *expr) {
+  if (expr->type != S_TYPE_LIST) {
+    return false;
+  }
+  for (size_t i = 0; i < expr->val.list_val.len; ++i) {
+    const struct Expr *binding = &expr->val.list_val.elements[i];
+    if (binding->type != S_TYPE_LIST || binding->val.list_val.len < 2 ||
+        !is_symbol(&binding->val.list_val.elements[0])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void walk_binding_inits(struct Walker *w,
+                               const struct ExprVector *bindings) {
+  for (size_t i = 0; i < bindings->len; ++i) {
+    walk_expr(w, &bindings->elements[i].val.list_val.elements[1]);
+  }
+}
+
+static void bind_binding_names(struct Walker *w,
+                               const struct ExprVector *bindings) {
+  for (size_t i = 0; i < bindings->len; ++i) {
+    const struct Expr *name = &bindings->elements[i].val.list_val.elements[0];
+    name_list_push(&w->bound, name->val.atom_val.value.symbol);
+  }
+}
+
+// Returns false if the form is malformed, so that the caller walks it as an
+// ordinary call instead.
+static bool walk_special_form(struct Walker *w, const char *op,
+                              const struct ExprVector *vec) {
+  size_t mark = w->bound.len;
+  if (strcmp(op, "quote") == 0) {
+    return true;
+  }
+  if (strcmp(op, "if") == 0 || strcmp(op, "while") == 0) {
+    walk_range(w, vec, 1);
+    return true;
+  }
+  if (strcmp(op, "vector-map") == 0) {
+    walk_range(w, vec, 2);
+    return true;
+  }
+  if (strcmp(op, "set!") == 0) {
+    if (vec->len != 3 || !is_symbol(&vec->elements[1])) {
+      return false;
+    }
+    if (is_unbound_symbol(w, &vec->elements[1])) {
+      w->visit(w, vec->elements[1].val.atom_val.value.symbol, WALK_SET, vec,
+               0);
+    }
+    walk_expr(w, &vec->elements[2]);
+    return true;
+  }
+  bool memo = strcmp(op, "define-memo") == 0;
+  if (strcmp(op, "define") == 0 || memo) {
+    if (vec->len < 3) {
+      return false;
+    }
+    const struct Expr *name_part = &vec->elements[1];
+    if (is_symbol(name_part) && !memo) {
+      walk_range(w, vec, 2);
+    } else if (name_part->type == S_TYPE_LIST &&
+               name_part->val.list_val.len > 0 &&
+               is_symbol(&name_part->val.list_val.elements[0])) {
+      walk_function(
+          w, &name_part->val.list_val, 1,
+          name_part->val.list_val.elements[0].val.atom_val.value.symbol, vec,
+          memo ? closure_memo_body_first(vec) : 2);
+    } else {
+      return false;
+    }
+    return true;
+  }
+  if (strcmp(op, "lambda") == 0) {
+    if (vec->len < 2 || vec->elements[1].type != S_TYPE_LIST) {
+      return false;
+    }
+    walk_function(w, &vec->elements[1].val.list_val, 0, NULL, vec, 2);
+    return true;
+  }
+  // The body of a future is compiled as a lambda without parameters
+  if (strcmp(op, "future") == 0) {
+    walk_function(w, NULL, 0, NULL, vec, 1);
+    return true;
+  }
+  if (strcmp(op, "let") == 0) {
+    size_t bindings_index =
+        vec->len > 1 && is_symbol(&vec->elements[1]) ? 2 : 1;
+    if (vec->len <= bindings_index ||
+        !is_binding_list(&vec->elements[bindings_index])) {
+      return false;
+    }
+    const struct ExprVector *bindings =
+        &vec->elements[bindings_index].val.list_val;
+    walk_binding_inits(w, bindings);
+    if (bindings_index == 2) {
+      name_list_push(&w->bound, vec->elements[1].val.atom_val.value.symbol);
+    }
+    bind_binding_names(w, bindings);
+    walk_body(w, vec, bindings_index + 1);
+    w->bound.len = mark;
+    return true;
+  }
+  if (strcmp(op, "do") == 0) {
+    if (vec->len < 3 || !is_binding_list(&vec->elements[1]) ||
+        vec->elements[2].type != S_TYPE_LIST) {
+      return false;
+    }
+    const struct ExprVector *bindings = &vec->elements[1].val.list_val;
+    walk_binding_inits(w, bindings);
+    bind_binding_names(w, bindings);
+    for (size_t i = 0; i < bindings->len; ++i) {
+      walk_range(w, &bindings->elements[i].val.list_val, 2);
+    }
+    walk_range(w, &vec->elements[2].val.list_val, 0);
+    walk_body(w, vec, 3);
+    w->bound.len = mark;
+    return true;
+  }
+  return false;
+}
+
+static void walk_expr(struct Walker *w, const struct Expr *expr) {
+  if (expr->type == S_TYPE_ATOM) {
+    if (is_unbound_symbol(w, expr)) {
+      w->visit(w, expr->val.atom_val.value.symbol, WALK_VALUE, NULL, 0);
+    }
+    return;
+  }
+  if (expr->type != S_TYPE_LIST || expr->val.list_val.len == 0) {
+    return;
+  }
+
+  const struct ExprVector *vec = &expr->val.list_val;
+  const struct Expr *head = &vec->elements[0];
+  bool direct = is_unbound_symbol(w, head);
+  if (direct) {
+    const char *op = head->val.atom_val.value.symbol;
+    if (walk_special_form(w, op, vec)) {
+      return;
+    }
+    w->visit(w, op, WALK_CALL, vec, 0);
+  } else {
+    walk_expr(w, head);
+  }
+
+  for (size_t i = 1; i < vec->len; ++i) {
+    const struct Expr *arg = &vec->elements[i];
+    if (direct && is_unbound_symbol(w, arg)) {
+      w->visit(w, arg->val.atom_val.value.symbol, WALK_ARG, vec, i - 1);
+    } else {
+      walk_expr(w, arg);
+    }
+  }
+}
+
+// --- Analyses ---
+
+static void visit_free_name(struct Walker *w, const char *name,
+                            enum WalkUse use, const struct ExprVector *call,
+                            size_t arg_index) {
+  (void)use;
+  (void)call;
+  (void)arg_index;
+  struct NameList *out = w->data;
+  if (!name_list_contains(out, name)) {
+    name_list_push(out, name);
+  }
+}
+
+void closure_free_names(const struct ExprVector *params, size_t params_first,
+                        const char *self, const struct ExprVector *body,
+                        size_t first, struct NameList *out) {
+  struct Walker w = {.visit = visit_free_name, .data = out};
+  if (self) {
+    name_list_push(&w.bound, self);
+  }
+  bind_params(&w, params, params_first);
+  walk_body(&w, body, first);
+  name_list_cleanup(&w.bound);
+}
+
+struct ClassifyState {
+  const char *name;
+  struct SymbolTable *st;
+  unsigned int uses;
+};
+
+static void visit_classify(struct Walker *w, const char *name,
+                           enum WalkUse use, const struct ExprVector *call,
+                           size_t arg_index) {
+  struct ClassifyState *state = w->data;
+  if (strcmp(name, state->name) != 0) {
+    return;
+  }
+
+  if (use == WALK_CALL) {
+    state->uses |= w->lambda_depth == 0 ? CLOSURE_USE_CALL
+                                        : CLOSURE_USE_CALL_IN_LAMBDA;
+    return;
+  }
+  if (use == WALK_ARG && w->lambda_depth == 0 &&
+      arg_index < sizeof(unsigned int) * 8) {
+    struct SymbolInfo *callee = symbol_table_lookup(
+        state->st, call->elements[0].val.atom_val.value.symbol);
+    if (callee &&
+        (callee->kind == SYM_USER_FUNC || callee->kind == SYM_BUILTIN_FUNC) &&
+        (callee->noescape_params >> arg_index) & 1) {
+      state->uses |= CLOSURE_USE_NOESCAPE_ARG;
+      return;
+    }
+  }
+  state->uses |= CLOSURE_USE_ESCAPE;
+}
+
+unsigned int closure_classify_uses(const char *name,
+                                   const struct ExprVector *params,
+                                   size_t params_first,
+                                   const struct ExprVector *body, size_t first,
+                                   struct SymbolTable *st) {
+  struct ClassifyState state = {.name = name, .st = st};
+  struct Walker w = {.visit = visit_classify, .data = &state};
+  bind_params(&w, params, params_first);
+  walk_body(&w, body, first);
+  name_list_cleanup(&w.bound);
+  return state.uses;
+}
+
+unsigned int closure_noescape_params(struct SymbolInfo *func,
+                                     const struct ExprVector *params,
+                                     size_t params_first,
+                                     const struct ExprVector *body,
+                                     size_t first, struct SymbolTable *st) {
+  size_t num_params = params->len - params_first;
+  if (num_params > sizeof(unsigned int) * 8) {
+    num_params = sizeof(unsigned int) * 8;
+  }
+  unsigned int mask = 0;
+  for (size_t i = 0; i < num_params; ++i) {
+    mask |= 1u << i;
+  }
+
+  // Only ever clears bits, so this stops after at most num_params rounds
+  while (true) {
+    func->noescape_params = mask;
+    unsigned int next = 0;
+    for (size_t i = 0; i < num_params; ++i) {
+      const struct Expr *param = &params->elements[params_first + i];
+      if (!is_symbol(param)) {
+        continue;
+      }
+      unsigned int uses = closure_classify_uses(
+          param->val.atom_val.value.symbol, NULL, 0, body, first, st);
+      if (!(uses & ~(CLOSURE_USE_CALL | CLOSURE_USE_NOESCAPE_ARG))) {
+        next |= 1u << i;
+      }
+    }
+    if (next == mask) {
+      return mask;
+    }
+    mask = next;
+  }
+}
+
+bool closure_is_assigned(const char *name, const struct Expr *form) {
+  if (form->type != S_TYPE_LIST) {
+    return false;
+  }
+  const struct ExprVector *vec = &form->val.list_val;
+  if (is_form(form, "quote")) {
+    return false;
+  }
+  if (is_form(form, "set!") && vec->len > 1 && is_symbol(&vec->elements[1]) &&
+      strcmp(vec->elements[1].val.atom_val.value.symbol, name) == 0) {
+    return true;
+  }
+  for (size_t i = 0; i < vec->len; ++i) {
+    if (closure_is_assigned(name, &vec->elements[i])) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,67 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "expr.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+struct SymbolInfo;
+struct SymbolTable;
+
+// Growable list of symbol names; the strings are borrowed from the AST.
+struct NameList
+{
+  const char **names;
+  size_t len;
+  size_t capacity;
+};
+
+void name_list_push (struct NameList *list, const char *name);
+bool name_list_contains (const struct NameList *list, const char *name);
+void name_list_cleanup (struct NameList *list);
+
+// How a name is used within a region of code, as a bit set.
+enum ClosureUse
+{
+  CLOSURE_USE_CALL = 1 << 0,           // operator of a call
+  CLOSURE_USE_CALL_IN_LAMBDA = 1 << 1, // operator of a call in a nested lambda
+  CLOSURE_USE_NOESCAPE_ARG = 1 << 2, // argument to a parameter of a global
+                                     // function or builtin that does not let
+                                     // it escape
+  CLOSURE_USE_ESCAPE = 1 << 3,       // anything else
+};
+
+// (lambda (params...) body...)
+bool closure_is_lambda (const struct Expr *expr);
+
+// Index of the first body form of (define-memo (name params...) body...),
+// which may have :limit n between the signature and the body.
+size_t closure_memo_body_first (const struct ExprVector *vec);
+
+// Appends to out every name that body[first..] refers to without binding it,
+// excluding self and the symbols of params[params_first..].
+void closure_free_names (const struct ExprVector *params, size_t params_first,
+                         const char *self, const struct ExprVector *body,
+                         size_t first, struct NameList *out);
+
+// Uses of name in body[first..], which params[params_first..] (if not NULL)
+// are bound around. Callees are resolved in st as it is at the call.
+unsigned int closure_classify_uses (const char *name,
+                                    const struct ExprVector *params,
+                                    size_t params_first,
+                                    const struct ExprVector *body,
+                                    size_t first, struct SymbolTable *st);
+
+// The noescape_params mask of the global function func with the given
+// parameters and body. Recursive calls are assumed not to let their
+// arguments escape until shown otherwise.
+unsigned int closure_noescape_params (struct SymbolInfo *func,
+                                      const struct ExprVector *params,
+                                      size_t params_first,
+                                      const struct ExprVector *body,
+                                      size_t first, struct SymbolTable *st);
+
+// Whether form contains (set! name ...) anywhere, whatever name refers to.
+bool closure_is_assigned (const char *name, const struct Expr *form);
+
+#endif
@@ -1,11 +1,15 @@
 #include "codegen.h"
+#include "callgraph.h"
+#include "closure.h"
 #include "expr.h"
 #include "global_data_sections.h"
 #include "lispvalue.h"
+#include "profile.h"
 #include "scope.h"
 #include "symbol.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,11 +18,135 @@ static void compile_expr(struct CompilerContext *ctx, struct Expr *expr);
 static void compile_atom(struct CompilerContext *ctx, struct Atom *atom);
 static void compile_list(struct CompilerContext *ctx, struct Expr *list_expr);
 static void compile_define_function(struct CompilerContext *ctx,
-                                    struct ExprVector *vec);
+                                    struct ExprVector *vec, bool memo);
 static void compile_function_call(struct CompilerContext *ctx,
                                   struct SymbolInfo *op_info,
                                   struct ExprVector *vec);
-static size_t count_local_defines(struct ExprVector *define_expr_vec);
+static void compile_set(struct CompilerContext *ctx, struct ExprVector *vec);
+static void compile_while(struct CompilerContext *ctx, struct ExprVector *vec);
+static void compile_do(struct CompilerContext *ctx, struct ExprVector *vec);
+static void compile_let(struct CompilerContext *ctx, struct Expr *let_expr);
+static void compile_loop_jump(struct CompilerContext *ctx,
+                              struct SymbolInfo *loop_info,
+                              struct ExprVector *vec);
+
+static void compile_quote(struct CompilerContext *ctx, struct Expr *datum);
+static void emit_pgo_output(struct CompilerContext *ctx);
+static void compile_temporary(struct CompilerContext *ctx, struct Expr *expr);
+static void compile_branch(struct CompilerContext *ctx, struct Expr *test,
+                           bool jump_if_true, const char *label);
+static void compile_scope_body(struct CompilerContext *ctx,
+                               struct ExprVector *vec, size_t first,
+                               bool tail);
+
+// Variadic builtins are called as f(count, args) with the arguments laid out
+// in order on the stack
+#define BUILTIN_VARIADIC ((size_t)-1)
+
+// Bit i of noescape_args is set if argument i never outlives the call, so
+// that it may live in the caller's frame (see compile_temporary). Builtins
+// that return a new number have a runtime_into variant that takes the
+// LispValue to write it into as an extra first argument.
+#define BUILTIN_NOESCAPE_ALL (~0u)
+
+struct BuiltinFunction {
+  const char *name;
+  const char *runtime_func;
+  size_t num_args;
+  unsigned int noescape_args;
+  const char *runtime_into;
+};
+
+static const struct BuiltinFunction builtin_functions[] = {
+    {"+", "lisp_add", 2, BUILTIN_NOESCAPE_ALL, NULL},
+    {"-", "lisp_subtract", 2, BUILTIN_NOESCAPE_ALL, NULL},
+    {"*", "lisp_multiply", 2, BUILTIN_NOESCAPE_ALL, NULL},
+    {"/", "lisp_divide", 2, BUILTIN_NOESCAPE_ALL, NULL},
+    {"=", "lisp_num_eq", 2, 0x3, NULL},
+    {"<", "lisp_num_lt", 2, 0x3, NULL},
+    {">", "lisp_num_gt", 2, 0x3, NULL},
+    {"<=", "lisp_num_le", 2, 0x3, NULL},
+    {">=", "lisp_num_ge", 2, 0x3, NULL},
+    {"cons", "lisp_cons", 2, 0, NULL},
+    {"car", "lisp_car", 1, 0x1, NULL},
+    {"cdr", "lisp_cdr", 1, 0x1, NULL},
+    {"null?", "lisp_null_p", 1, 0x1, NULL},
+    {"pair?", "lisp_pair_p", 1, 0x1, NULL},
+    {"list", "lisp_list", BUILTIN_VARIADIC, 0, NULL},
+    {"make-vector", "lisp_make_vector", 2, 0x3, NULL},
+    {"vector", "lisp_vector", BUILTIN_VARIADIC, BUILTIN_NOESCAPE_ALL, NULL},
+    {"vector-length", "lisp_vector_length", 1, 0x1,
+     "lisp_vector_length_into"},
+    {"vector-ref", "lisp_vector_ref", 2, 0x3, "lisp_vector_ref_into"},
+    // Returns the value it stores
+    {"vector-set!", "lisp_vector_set", 3, 0x3, NULL},
+    {"vector-sum", "lisp_vector_sum", 1, 0x1, "lisp_vector_sum_into"},
+    {"vector-dot", "lisp_vector_dot", 2, 0x3, "lisp_vector_dot_into"},
+    {"vector+", "lisp_vector_add", 2, 0x3, NULL},
+    {"vector*", "lisp_vector_mul", 2, 0x3, NULL},
+    {"string-length", "lisp_string_length", 1, 0x1,
+     "lisp_string_length_into"},
+    {"string-append", "lisp_string_append", BUILTIN_VARIADIC,
+     BUILTIN_NOESCAPE_ALL, NULL},
+    {"substring", "lisp_substring", 3, 0x7, NULL},
+    {"display", "lisp_display", 1, 0x1, NULL},
+    {"print", "lisp_print", 1, 0x1, NULL},
+    {"newline", "lisp_newline", 0, 0, NULL},
+    {"spawn", "lisp_spawn", 1, 0, NULL},
+    {"touch", "lisp_touch", 1, 0, NULL},
+    // The procedure runs on other workers, but only while the call waits
+    {"pmap", "lisp_pmap", 2, 0x3, NULL},
+    {"preduce", "lisp_preduce", 3, 0x5, NULL},
+    {"psort", "lisp_psort", 1, 0x1, NULL},
+};
+
+// + - * / take any number of operands and compile to one chain of SSE
+// instructions over the operands' doubles, with a single box for the result.
+// With one operand, - and / apply to the identity: (- x) is 0 - x.
+static const struct {
+  const char *name;
+  const char *instruction;
+  double identity;
+  size_t min_args;
+} arithmetic_ops[] = {
+    {"+", "addsd", 0, 0},
+    {"-", "subsd", 0, 1},
+    {"*", "mulsd", 1, 0},
+    {"/", "divsd", 1, 1},
+};
+
+// Comparisons that a test of if or while compiles to ucomisd and a jump on
+// the operands' doubles, without a #t or #f in between. < and <= compare the
+// second operand against the first so that, like the runtime's C
+// comparisons, every comparison involving a NaN is false.
+static const struct {
+  const char *name;
+  bool swap;
+  const char *jump_if_false;
+  const char *jump_if_unordered; // for =, where ZF alone does not tell
+  const char *jump_if_true;      // for =, only once unordered is ruled out
+} fused_comparisons[] = {
+    {"=", false, "jne", "jp", "je"}, {"<", true, "jbe", NULL, "ja"},
+    {">", false, "jbe", NULL, "ja"}, {"<=", true, "jb", NULL, "jae"},
+    {">=", false, "jb", NULL, "jae"},
+};
+
+// Arithmetic builtins that vector-map can apply element-wise
+static const struct {
+  const char *name;
+  enum LispVectorOp op;
+} vector_map_ops[] = {
+    {"+", LISP_VECTOR_ADD},
+    {"-", LISP_VECTOR_SUB},
+    {"*", LISP_VECTOR_MUL},
+    {"/", LISP_VECTOR_DIV},
+};
+#define NUM_BUILTIN_FUNCTIONS                                                  \
+  (sizeof(builtin_functions) / sizeof(builtin_functions[0]))
+
+static const char *special_forms[] = {
+    "define", "if",         "set!",   "while",       "do",    "let",
+    "quote",  "vector-map", "lambda", "define-memo", "future"};
 
 static int new_label_id() {
   static int label_counter = 0;
@@ -45,6 +173,9 @@ static void sanitize_label(char *buffer, size_t buf_size, const char *prefix,
 
 static void generate_runtime_globals(struct CompilerContext *ctx) {
   fprintf(ctx->gds->data_file, "\n; --- Global LispValue Constants ---\n");
+  // Exported so that runtime functions can return #t and #f
+  fprintf(ctx->gds->data_file, "global G_LISP_TRUE\n");
+  fprintf(ctx->gds->data_file, "global G_LISP_NIL\n");
 
   fprintf(ctx->gds->data_file, "align 8\n");
   fprintf(ctx->gds->data_file, "G_LISP_TRUE:\n");
@@ -58,16 +189,18 @@ static void generate_runtime_globals(struct CompilerContext *ctx) {
 }
 
 static void populate_global_scope(struct SymbolTable *st) {
-  struct SymbolInfo *define_info = symbol_make_special_form("define", NULL);
-  symbol_map_emplace(st->global_scope->symbol_map, "define", define_info);
-
-  struct SymbolInfo *if_info = symbol_make_special_form("if", NULL);
-  symbol_map_emplace(st->global_scope->symbol_map, "if", if_info);
+  for (size_t i = 0; i < sizeof(special_forms) / sizeof(special_forms[0]);
+       ++i) {
+    struct SymbolInfo *info = symbol_make_special_form(special_forms[i], NULL);
+    symbol_map_emplace(st->global_scope->symbol_map, special_forms[i], info);
+  }
 
-  struct SymbolInfo *add_info = symbol_make_builtin_func("+", NULL, NULL);
-  symbol_map_emplace(st->global_scope->symbol_map, "+", add_info);
-  struct SymbolInfo *subtr_info = symbol_make_builtin_func("-", NULL, NULL);
-  symbol_map_emplace(st->global_scope->symbol_map, "-", subtr_info);
+  for (size_t i = 0; i < NUM_BUILTIN_FUNCTIONS; ++i) {
+    const char *name = builtin_functions[i].name;
+    struct SymbolInfo *info = symbol_make_builtin_func(name, NULL, NULL);
+    info->noescape_params = builtin_functions[i].noescape_args;
+    symbol_map_emplace(st->global_scope->symbol_map, name, info);
+  }
 
   // NEW: Add #t and #f as global variables pointing to our constant LispValues
   struct SymbolInfo *true_info =
@@ -80,25 +213,81 @@ static void populate_global_scope(struct SymbolTable *st) {
 }
 
 static void generate_prologue(FILE *text_section) {
-  // Define constants for LispValue types to make assembly readable
-  const char *prologue = "global main\n"
-                         "extern lisp_add\n"
-                         "extern lisp_subtract\n"
-                         "extern lisp_multiply\n"
-                         "extern lisp_divide\n"
-                         "extern lisp_make_number\n\n";
+  fprintf(text_section, "global main:function (main.end - main)\n");
+  fprintf(text_section, "extern lisp_make_number\n");
+  fprintf(text_section, "extern lisp_vector_map\n");
+  fprintf(text_section, "extern lisp_make_closure\n");
+  fprintf(text_section, "extern lisp_error_not_procedure\n");
+  fprintf(text_section, "extern lisp_memo_lookup\n");
+  fprintf(text_section, "extern lisp_memo_store\n");
+  for (size_t i = 0; i < NUM_BUILTIN_FUNCTIONS; ++i) {
+    fprintf(text_section, "extern %s\n", builtin_functions[i].runtime_func);
+    if (builtin_functions[i].runtime_into) {
+      fprintf(text_section, "extern %s\n", builtin_functions[i].runtime_into);
+    }
+  }
+  fprintf(text_section, "\n");
+}
+
+// Locals are addressed as [rbp - N]; the frame is reserved in the prologue as
+// <label>.frame_size, which is defined after the body once the deepest slot
+// used by any nested scope is known. Kept a multiple of 16 so that rsp stays
+// aligned after the prologue.
+static void emit_frame_size(FILE *out, const char *label, int high_water) {
+  int frame_size = (high_water + 15) & ~15;
+  fprintf(out, "%s.frame_size equ %d\n", label, frame_size);
+}
+
+// Reserves count consecutive slots in the current frame that stay allocated
+// until the current scope is exited, and returns the offset of the lowest
+// addressed one.
+static int reserve_frame_slots(struct CompilerContext *ctx, size_t count) {
+  struct Scope *scope = ctx->sym_table->current_scope;
+  scope->current_stack_offset += (int)count * 8;
+  if (scope->current_stack_offset > ctx->frame_high_water) {
+    ctx->frame_high_water = scope->current_stack_offset;
+  }
+  return scope->current_stack_offset;
+}
+
+static void append_file(FILE *dest, FILE *src) {
+  char buffer[4096];
+  size_t bytes_read;
+  rewind(src);
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+    if (fwrite(buffer, 1, bytes_read, dest) != bytes_read) {
+      perror("fwrite");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
 
-  fprintf(text_section, prologue);
+static int define_local_var(struct CompilerContext *ctx, const char *name,
+                            struct Expr *definition_node) {
+  struct SymbolInfo *info = symbol_make_local_var(name, 0, definition_node);
+  int stack_offset = symbol_table_define(ctx->sym_table, info);
+  if (stack_offset > ctx->frame_high_water) {
+    ctx->frame_high_water = stack_offset;
+  }
+  return stack_offset;
 }
 
 static void generate_main(struct CompilerContext *ctx,
                           struct ExprVector *program) {
   const char *prologue = "main:\n"
                          "  push rbp\n"
-                         "  mov rbp, rsp\n\n";
+                         "  mov rbp, rsp\n"
+                         "  sub rsp, main.frame_size\n\n";
   fprintf(ctx->gds->text_file, prologue);
+  ctx->frame_high_water = 0;
+  if (ctx->options.profile_generate) {
+    fprintf(ctx->gds->text_file, "  mov rdi, L_pgo_last\n");
+    fprintf(ctx->gds->text_file, "  mov rsi, L_pgo_file\n");
+    fprintf(ctx->gds->text_file, "  call lisp_pgo_start\n\n");
+  }
 
   for (size_t i = 0; i < program->len; ++i) {
+    ctx->toplevel_form = &program->elements[i];
     compile_expr(ctx, &program->elements[i]);
   }
 
@@ -106,25 +295,160 @@ static void generate_main(struct CompilerContext *ctx,
                          "  mov rax, 0      ; Return 0 for success\n"
                          "  mov rsp, rbp\n"
                          "  pop rbp\n"
-                         "  ret\n";
+                         "  ret\n"
+                         "main.end:\n";
   fprintf(ctx->gds->text_file, epilogue);
+  emit_frame_size(ctx->gds->text_file, "main", ctx->frame_high_water);
 }
 
-void compile_program(struct ExprVector *program, const char *output_filename) {
-  struct SymbolTable *sym_table = symbol_table_create();
+// A global function compiled to code that is not in the func section yet
+struct CompiledFunction {
+  const char *name;
+  size_t index; // in source order
+  bool cold;    // goes to .text.unlikely
+  char *code;
+  size_t size;
+};
+
+static int compare_function_names(const void *a, const void *b) {
+  const struct CompiledFunction *fa = a;
+  const struct CompiledFunction *fb = b;
+  int cmp = strcmp(fa->name, fb->name);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return fa->index < fb->index ? -1 : fa->index > fb->index;
+}
 
-  struct GlobalDataSections *gds = gds_create(output_filename);
-  if (!gds) {
-    symbol_table_destroy(sym_table);
+static int compare_function_indices(const void *a, const void *b) {
+  const struct CompiledFunction *fa = a;
+  const struct CompiledFunction *fb = b;
+  return fa->index < fb->index ? -1 : fa->index > fb->index;
+}
+
+static void add_compiled_function(struct CompilerContext *ctx,
+                                  const char *name, char *code, size_t size) {
+  if (ctx->num_functions == ctx->functions_capacity) {
+    size_t capacity = ctx->functions_capacity ? ctx->functions_capacity * 2
+                                              : 16;
+    struct CompiledFunction *functions =
+        realloc(ctx->functions, capacity * sizeof(struct CompiledFunction));
+    if (!functions) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    ctx->functions = functions;
+    ctx->functions_capacity = capacity;
+  }
+  struct CompiledFunction *f = &ctx->functions[ctx->num_functions];
+  *f = (struct CompiledFunction){
+      .name = name, .index = ctx->num_functions, .code = code, .size = size};
+  ctx->num_functions++;
+}
+
+static void write_function(struct CompilerContext *ctx,
+                           struct CompiledFunction *f) {
+  if (!f->code) {
+    return;
+  }
+  if (fwrite(f->code, 1, f->size, ctx->gds->func_file) != f->size) {
+    perror("fwrite");
     exit(EXIT_FAILURE);
   }
+  free(f->code);
+  f->code = NULL;
+}
+
+// Index of the first of ctx->functions, sorted by name, that is named name
+static size_t find_functions_named(const struct CompilerContext *ctx,
+                                   const char *name) {
+  struct CompiledFunction key = {.name = name};
+  size_t lo = 0;
+  size_t hi = ctx->num_functions;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (compare_function_names(&ctx->functions[mid], &key) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static bool is_named(const struct CompilerContext *ctx, size_t i,
+                     const char *name) {
+  return i < ctx->num_functions && strcmp(ctx->functions[i].name, name) == 0;
+}
+
+// Writes the global functions to the func section, in the order of
+// callgraph_layout, with the cold ones in .text.unlikely
+static void emit_functions(struct CompilerContext *ctx,
+                           const struct ExprVector *program) {
+  if (ctx->options.source_order_functions) {
+    for (size_t i = 0; i < ctx->num_functions; ++i) {
+      write_function(ctx, &ctx->functions[i]);
+    }
+    free(ctx->functions);
+    return;
+  }
+
+  struct FunctionLayout layout;
+  callgraph_layout(program, ctx->options.profile, &layout);
+  qsort(ctx->functions, ctx->num_functions, sizeof(struct CompiledFunction),
+        compare_function_names);
+  for (size_t i = 0; i < layout.len; ++i) {
+    for (size_t j = find_functions_named(ctx, layout.names[i]);
+         is_named(ctx, j, layout.names[i]); ++j) {
+      if (i < layout.num_hot) {
+        write_function(ctx, &ctx->functions[j]);
+      } else {
+        ctx->functions[j].cold = true;
+      }
+    }
+  }
+  // Anything the layout does not know about stays hot, in source order
+  qsort(ctx->functions, ctx->num_functions, sizeof(struct CompiledFunction),
+        compare_function_indices);
+  for (size_t i = 0; i < ctx->num_functions; ++i) {
+    if (!ctx->functions[i].cold) {
+      write_function(ctx, &ctx->functions[i]);
+    }
+  }
+  if (layout.num_hot < layout.len) {
+    fprintf(ctx->gds->func_file,
+            "\nsection .text.unlikely progbits alloc exec nowrite align=16\n");
+    for (size_t i = 0; i < ctx->num_functions; ++i) {
+      write_function(ctx, &ctx->functions[i]);
+    }
+    fprintf(ctx->gds->func_file, "\nsection .text\n");
+  }
+  function_layout_cleanup(&layout);
+  free(ctx->functions);
+}
 
-  struct CompilerContext ctx = {.sym_table = sym_table, .gds = gds};
+void compile_to_sections(struct ExprVector *program,
+                         struct GlobalDataSections *gds,
+                         const struct CompileOptions *options) {
+  struct SymbolTable *sym_table = symbol_table_create();
+  struct CompilerContext ctx = {.sym_table = sym_table,
+                                .gds = gds,
+                                .string_literals = symbol_map_create(),
+                                .static_numbers = symbol_map_create(),
+                                .lambda_file = tmpfile(),
+                                .last_pgo_counter = -1};
+  if (options) {
+    ctx.options = *options;
+  }
 
   // *after* creating ctx but *before* compiling any code
   populate_global_scope(sym_table);
   generate_runtime_globals(&ctx);
 
+  if (!ctx.lambda_file) {
+    perror("tmpfile");
+    exit(EXIT_FAILURE);
+  }
   if (!ctx.gds->text_file) {
     fprintf(stderr, "Fatal: Could not get .text section file.\n");
     gds_close_and_finalize(gds);
@@ -133,14 +457,47 @@ void compile_program(struct ExprVector *program, const char *output_filename) {
   }
 
   generate_prologue(ctx.gds->text_file);
+  if (ctx.options.profile_generate) {
+    fprintf(ctx.gds->text_file, "extern lisp_pgo_start\n\n");
+  }
   generate_main(&ctx, program);
-  gds_close_and_finalize(gds);
+  if (ctx.options.profile_generate) {
+    emit_pgo_output(&ctx);
+  }
+  emit_functions(&ctx, program);
+  append_file(ctx.gds->func_file, ctx.lambda_file);
+  fclose(ctx.lambda_file);
+  symbol_map_free(ctx.string_literals);
+  symbol_map_free(ctx.static_numbers);
   symbol_table_destroy(sym_table);
 }
 
+void compile_program(struct ExprVector *program, const char *output_filename,
+                     const struct CompileOptions *options) {
+  struct GlobalDataSections *gds = gds_create(output_filename);
+  if (!gds) {
+    exit(EXIT_FAILURE);
+  }
+
+  compile_to_sections(program, gds, options);
+  gds_close_and_finalize(gds);
+}
+
+static void emit_line_directive(struct CompilerContext *ctx, FILE *out,
+                                size_t line) {
+  if (!ctx->options.debug_lines || line == 0 || line == ctx->current_line) {
+    return;
+  }
+  fprintf(out, "%%line %zu+0 %s\n", line, ctx->options.source_filename);
+  ctx->current_line = line;
+}
+
 static void compile_expr(struct CompilerContext *ctx, struct Expr *expr) {
+  emit_line_directive(ctx, ctx->gds->text_file, expr->start_line);
   switch (expr->type) {
   case S_TYPE_ATOM:
+    ctx->tail_position = false;
+    ctx->noescape = false;
     compile_atom(ctx, &expr->val.atom_val);
     break;
   case S_TYPE_LIST:
@@ -152,20 +509,169 @@ static void compile_expr(struct CompilerContext *ctx, struct Expr *expr) {
   }
 }
 
-static void compile_atom(struct CompilerContext *ctx, struct Atom *atom) {
+// Writes text as a NASM db operand list, quoting runs of printable
+// characters and spelling everything else (including quotes) as numbers.
+static void emit_db_string(FILE *out, const char *text, size_t len) {
+  fprintf(out, "  db ");
+  bool in_quotes = false;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)text[i];
+    bool printable = isprint(c) && c != '"';
+    if (printable && !in_quotes) {
+      fprintf(out, "%s\"", i > 0 ? ", " : "");
+      in_quotes = true;
+    } else if (!printable && in_quotes) {
+      fprintf(out, "\"");
+      in_quotes = false;
+    }
+    if (printable) {
+      fputc(c, out);
+    } else {
+      fprintf(out, "%s%u", i > 0 ? ", " : "", c);
+    }
+  }
+  fprintf(out, "%s%s0\n", in_quotes ? "\"" : "", len > 0 ? ", " : "");
+}
+
+// Every distinct string literal is emitted once into .rodata as a static
+// LVAL_STR LispValue followed by its LispString header and characters, so
+// evaluating a literal is just a mov of its address and never allocates.
+static const char *string_literal_label(struct CompilerContext *ctx,
+                                        const char *text) {
+  struct SymbolInfo *info = symbol_map_lookup(ctx->string_literals, text);
+  if (info) {
+    return info->location.global_asm_label;
+  }
+
+  char label[32];
+  snprintf(label, sizeof(label), "L_str_%d", new_label_id());
+  size_t len = strlen(text);
+
+  FILE *rodata = ctx->gds->rodata_file;
+  fprintf(rodata, "align 8\n");
+  fprintf(rodata, "%s:\n", label);
+  fprintf(rodata, "  dq %d\t; type = LVAL_STR\n", LVAL_STR);
+  fprintf(rodata, "  dq %s.header\n", label);
+  fprintf(rodata, "%s.header:\n", label);
+  fprintf(rodata, "  dq %zu\t; length\n", len);
+  fprintf(rodata, "  dq %s.chars\n", label);
+  fprintf(rodata, "%s.chars:\n", label);
+  emit_db_string(rodata, text, len);
+
+  info = symbol_make_global_var(text, label, NULL);
+  symbol_map_emplace(ctx->string_literals, text, info);
+  return info->location.global_asm_label;
+}
+
+// Numbers that initialize globals are emitted once per distinct value into
+// .rodata as static LVAL_NUM LispValues, which is safe since nothing writes
+// to a number once it is made. Keyed by bit pattern to keep 0 and -0 apart.
+static const char *static_number_label(struct CompilerContext *ctx,
+                                       double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  char key[32];
+  snprintf(key, sizeof(key), "%016" PRIx64, bits);
+  struct SymbolInfo *info = symbol_map_lookup(ctx->static_numbers, key);
+  if (info) {
+    return info->location.global_asm_label;
+  }
+
+  char label[32];
+  snprintf(label, sizeof(label), "L_num_%d", new_label_id());
+  FILE *rodata = ctx->gds->rodata_file;
+  fprintf(rodata, "align 8\n");
+  fprintf(rodata, "%s:\n", label);
+  fprintf(rodata, "  dq %d\t; type = LVAL_NUM\n", LVAL_NUM);
+  fprintf(rodata, "  dq 0x%s\t; %.17g\n", key, value);
+
+  info = symbol_make_global_var(key, label, NULL);
+  symbol_map_emplace(ctx->static_numbers, key, info);
+  return info->location.global_asm_label;
+}
+
+// If the value of expr is a constant the assembler can lay out, writes the
+// dq operand that points at it to buf and returns true: numbers, strings,
+// #t, #f, the empty list, quoted numbers and global functions.
+static bool static_initializer(struct CompilerContext *ctx, struct Expr *expr,
+                               char *buf, size_t size) {
+  if (expr->type == S_TYPE_LIST) {
+    struct ExprVector *vec = &expr->val.list_val;
+    if (vec->len == 0) {
+      snprintf(buf, size, "G_LISP_NIL");
+      return true;
+    }
+    struct Expr *head = &vec->elements[0];
+    if (vec->len != 2 || head->type != S_TYPE_ATOM ||
+        head->val.atom_val.type != ATOM_TYPE_SYMBOL ||
+        strcmp(head->val.atom_val.value.symbol, "quote") != 0) {
+      return false;
+    }
+    struct Expr *datum = &vec->elements[1];
+    bool number = datum->type == S_TYPE_ATOM &&
+                  datum->val.atom_val.type == ATOM_TYPE_NUMBER;
+    bool empty = datum->type == S_TYPE_LIST && datum->val.list_val.len == 0;
+    return (number || empty) && static_initializer(ctx, datum, buf, size);
+  }
+  if (expr->type != S_TYPE_ATOM) {
+    return false;
+  }
+
+  struct Atom *atom = &expr->val.atom_val;
   switch (atom->type) {
-  case ATOM_TYPE_NUMBER: {
-    FILE *rodata = ctx->gds->rodata_file;
-    int label_id = new_label_id();
-    fprintf(rodata, "L_double_%d: dq %lf\n", label_id, atom->value.number);
+  case ATOM_TYPE_NUMBER:
+    snprintf(buf, size, "%s", static_number_label(ctx, atom->value.number));
+    return true;
+  case ATOM_TYPE_STRING:
+    snprintf(buf, size, "%s", string_literal_label(ctx, atom->value.string));
+    return true;
+  case ATOM_TYPE_SYMBOL: {
+    struct SymbolInfo *info =
+        symbol_table_lookup(ctx->sym_table, atom->value.symbol);
+    if (info && info->kind == SYM_USER_FUNC) {
+      snprintf(buf, size, "%s.closure", info->location.global_asm_label);
+      return true;
+    }
+    if (info && info->kind == SYM_GLOBAL_VAR &&
+        (strcmp(info->name, "#t") == 0 || strcmp(info->name, "#f") == 0)) {
+      snprintf(buf, size, "%s", info->location.global_asm_label);
+      return true;
+    }
+    return false;
+  }
+  }
+  return false;
+}
 
-    fprintf(ctx->gds->text_file,
-            "\n  ; Create LispValue for number %.2f on the heap\n",
-            atom->value.number);
-    fprintf(ctx->gds->text_file, "  movsd xmm0, [rel L_double_%d]\n", label_id);
-    fprintf(ctx->gds->text_file, "  call lisp_make_number\n");
-    break;
+// Loads a local or captured variable into reg
+static void emit_load_var(struct CompilerContext *ctx, struct SymbolInfo *info,
+                          const char *reg) {
+  if (info->kind == SYM_LOCAL_VAR) {
+    fprintf(ctx->gds->text_file, "  mov %s, [rbp - %d]\n", reg,
+            info->location.stack_offset);
+  } else {
+    fprintf(ctx->gds->text_file, "  mov %s, [rbp - %d]\n", reg,
+            info->location.free_var.env_offset);
+    fprintf(ctx->gds->text_file, "  mov %s, [%s + %zu]\n", reg, reg,
+            LISPCLOSURE_VARS_OFFSET + info->location.free_var.index * 8);
   }
+}
+
+// Writes the memory operand that holds value exactly to buf: the double of
+// its static number, so every use of a value shares one bit pattern
+static void double_constant_location(struct CompilerContext *ctx,
+                                     double value, char *buf, size_t size) {
+  snprintf(buf, size, "[rel %s + %d]", static_number_label(ctx, value),
+           LISPVALUE_VALUE_OFFSET);
+}
+
+static void compile_atom(struct CompilerContext *ctx, struct Atom *atom) {
+  switch (atom->type) {
+  case ATOM_TYPE_NUMBER:
+    // Numbers are never written once made, so a literal can be static
+    fprintf(ctx->gds->text_file, "  mov rax, %s\n",
+            static_number_label(ctx, atom->value.number));
+    break;
   case ATOM_TYPE_SYMBOL: {
     struct SymbolInfo *info =
         symbol_table_lookup(ctx->sym_table, atom->value.symbol);
@@ -179,8 +685,13 @@ static void compile_atom(struct CompilerContext *ctx, struct Atom *atom) {
             atom->value.symbol);
     switch (info->kind) {
     case SYM_LOCAL_VAR:
-      fprintf(ctx->gds->text_file, "  mov rax, [rbp - %d]\n",
-              info->location.stack_offset);
+    case SYM_FREE_VAR:
+      emit_load_var(ctx, info, "rax");
+      break;
+    case SYM_USER_FUNC:
+      // Static closure record of the function, see compile_define_function
+      fprintf(ctx->gds->text_file, "  mov rax, %s.closure\n",
+              info->location.global_asm_label);
       break;
     case SYM_GLOBAL_VAR:
       // Handle global variables vs constants like #t and #f
@@ -203,36 +714,249 @@ static void compile_atom(struct CompilerContext *ctx, struct Atom *atom) {
     }
     break;
   }
-  case ATOM_TYPE_STRING:
-    fprintf(stderr, "Strings are not implemented yet.\n");
-    exit(EXIT_FAILURE);
+  case ATOM_TYPE_STRING: {
+    const char *label = string_literal_label(ctx, atom->value.string);
+    fprintf(ctx->gds->text_file, "\n  ; Load string literal\n");
+    fprintf(ctx->gds->text_file, "  mov rax, %s\n", label);
     break;
   }
+  }
 }
 
-static size_t count_local_defines(struct ExprVector *define_expr_vec) {
-  size_t count = 0;
-  for (size_t i = 2; i < define_expr_vec->len; ++i) {
-    struct Expr *stmt = &define_expr_vec->elements[i];
-    if (stmt->type == S_TYPE_LIST && stmt->val.list_val.len >= 2) {
-      struct ExprVector *list = &stmt->val.list_val;
-      struct Expr *op = &list->elements[0];
-      struct Expr *name = &list->elements[1];
+// --- Calls ---
+// Arguments are passed as in the System V ABI: the first six in registers,
+// the rest on the stack from [rsp] up when the call is made. Closure code
+// takes its record in rdi, so it gets one argument less in registers.
+// Nothing is pushed while arguments are evaluated, so rsp stays where the
+// prologue left it, 16-byte aligned, and the area for stack arguments is
+// padded to keep it so.
+static const char *arg_registers[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+#define NUM_ARG_REGISTERS (sizeof(arg_registers) / sizeof(arg_registers[0]))
+
+// Where an argument is kept from its evaluation until the call
+struct CallArg {
+  enum { ARG_SLOT, ARG_RAX, ARG_ATOM, ARG_VAR } kind;
+  struct Expr *expr;      // ARG_ATOM
+  struct SymbolInfo *var; // ARG_VAR
+  int slot;               // ARG_SLOT, as [rbp - slot]
+};
+
+// Evaluates count argument expressions in order. When defer_atoms and they
+// are all atoms, which load without a call, they are loaded straight into
+// place instead. Otherwise each value goes into a frame slot, except the
+// last one, which stays in rax when last_in_rax. The slots stay reserved
+// until the caller restores the scope offset it had before. Bit i of
+// noescape_params tells that argument i may be a lambda or a number kept in
+// the caller's frame.
+static void evaluate_call_args(struct CompilerContext *ctx, struct Expr *exprs,
+                               size_t count, unsigned int noescape_params,
+                               bool defer_atoms, bool last_in_rax,
+                               struct CallArg *out) {
+  for (size_t i = 0; i < count; ++i) {
+    defer_atoms = defer_atoms && exprs[i].type == S_TYPE_ATOM;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    out[i].expr = &exprs[i];
+    if (defer_atoms) {
+      out[i].kind = ARG_ATOM;
+      continue;
+    }
+    ctx->noescape = i < 32 && ((noescape_params >> i) & 1);
+    if (ctx->noescape) {
+      compile_temporary(ctx, &exprs[i]);
+    } else {
+      compile_expr(ctx, &exprs[i]);
+    }
+    if (last_in_rax && i + 1 == count) {
+      out[i].kind = ARG_RAX;
+    } else {
+      out[i].kind = ARG_SLOT;
+      out[i].slot = reserve_frame_slots(ctx, 1);
+      fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n", out[i].slot);
+    }
+  }
+}
 
-      if (op->type == S_TYPE_ATOM &&
-          op->val.atom_val.type == ATOM_TYPE_SYMBOL &&
-          strcmp(op->val.atom_val.value.symbol, "define") == 0) {
-        if (name->type == S_TYPE_ATOM) {
-          count++;
-        }
+static void load_call_arg(struct CompilerContext *ctx,
+                          const struct CallArg *arg, const char *reg) {
+  switch (arg->kind) {
+  case ARG_SLOT:
+    fprintf(ctx->gds->text_file, "  mov %s, [rbp - %d]\n", reg, arg->slot);
+    break;
+  case ARG_RAX:
+    fprintf(ctx->gds->text_file, "  mov %s, rax\n", reg);
+    break;
+  case ARG_ATOM:
+    compile_atom(ctx, &arg->expr->val.atom_val);
+    fprintf(ctx->gds->text_file, "  mov %s, rax\n", reg);
+    break;
+  case ARG_VAR:
+    emit_load_var(ctx, arg->var, reg);
+    break;
+  }
+}
+
+// Moves args into the argument registers from first_register on, and the
+// ones that do not fit onto the stack. Only rax and the argument registers
+// are written. Returns the bytes of stack taken, to give back after the call.
+static size_t place_call_args(struct CompilerContext *ctx,
+                              const struct CallArg *args, size_t count,
+                              size_t first_register) {
+  FILE *out = ctx->gds->text_file;
+  size_t num_registers = NUM_ARG_REGISTERS - first_register;
+  size_t stack_bytes = 0;
+  if (count > num_registers) {
+    stack_bytes = ((count - num_registers) * 8 + 15) & ~(size_t)15;
+    fprintf(out, "  sub rsp, %zu\n", stack_bytes);
+  }
+  // Stack arguments are copied through rax, so the value in rax goes first
+  for (size_t i = 0; i < count; ++i) {
+    if (args[i].kind != ARG_RAX) {
+      continue;
+    }
+    if (i < num_registers) {
+      load_call_arg(ctx, &args[i], arg_registers[first_register + i]);
+    } else {
+      fprintf(out, "  mov [rsp + %zu], rax\n", (i - num_registers) * 8);
+    }
+  }
+  for (size_t i = num_registers; i < count; ++i) {
+    if (args[i].kind != ARG_RAX) {
+      load_call_arg(ctx, &args[i], "rax");
+      fprintf(out, "  mov [rsp + %zu], rax\n", (i - num_registers) * 8);
+    }
+  }
+  for (size_t i = 0; i < count && i < num_registers; ++i) {
+    if (args[i].kind != ARG_RAX) {
+      load_call_arg(ctx, &args[i], arg_registers[first_register + i]);
+    }
+  }
+  return stack_bytes;
+}
+
+static void emit_call(struct CompilerContext *ctx, const char *target,
+                      size_t stack_bytes) {
+  fprintf(ctx->gds->text_file, "  call %s\n", target);
+  if (stack_bytes > 0) {
+    fprintf(ctx->gds->text_file, "  add rsp, %zu\n", stack_bytes);
+  }
+}
+
+// Stores incoming argument index, counting from rdi, into [rbp - stack_offset]
+static void emit_store_param(FILE *out, size_t index, int stack_offset) {
+  if (index < NUM_ARG_REGISTERS) {
+    fprintf(out, "  mov [rbp - %d], %s\n", stack_offset,
+            arg_registers[index]);
+  } else {
+    // Above the saved rbp and the return address
+    fprintf(out, "  mov rax, [rbp + %zu]\n",
+            16 + (index - NUM_ARG_REGISTERS) * 8);
+    fprintf(out, "  mov [rbp - %d], rax\n", stack_offset);
+  }
+}
+
+// Emits a LispPgoCounter record with num_counts counters under key, linked
+// to the previous one, and returns the id of its label L_pgo_<id>.
+static int emit_pgo_counter(struct CompilerContext *ctx, const char *key,
+                            size_t num_counts) {
+  int id = new_label_id();
+  fprintf(ctx->gds->rodata_file, "L_pgo_%d.key:\n", id);
+  emit_db_string(ctx->gds->rodata_file, key, strlen(key));
+  FILE *data = ctx->gds->data_file;
+  fprintf(data, "align 8\n");
+  fprintf(data, "L_pgo_%d:\n", id);
+  fprintf(data, "  dq L_pgo_%d.key\n", id);
+  if (ctx->last_pgo_counter >= 0) {
+    fprintf(data, "  dq L_pgo_%d\t; prev\n", ctx->last_pgo_counter);
+  } else {
+    fprintf(data, "  dq 0\t; prev\n");
+  }
+  fprintf(data, "  dq %zu\t; num_counts\n", num_counts);
+  fprintf(data, "  dq 0, 0\t; counts\n");
+  ctx->last_pgo_counter = id;
+  return id;
+}
+
+static void emit_pgo_increment(FILE *out, int counter, size_t index) {
+  fprintf(out, "  inc qword [L_pgo_%d + %zu]\n", counter,
+          LISPPGOCOUNTER_COUNTS_OFFSET + index * 8);
+}
+
+// The head of the counter list and the default profile file for main
+static void emit_pgo_output(struct CompilerContext *ctx) {
+  if (ctx->last_pgo_counter >= 0) {
+    fprintf(ctx->gds->data_file, "L_pgo_last equ L_pgo_%d\n",
+            ctx->last_pgo_counter);
+  } else {
+    fprintf(ctx->gds->data_file, "L_pgo_last equ 0\n");
+  }
+  const char *filename = ctx->options.profile_output
+                             ? ctx->options.profile_output
+                             : "lisp.profdata";
+  fprintf(ctx->gds->rodata_file, "L_pgo_file:\n");
+  emit_db_string(ctx->gds->rodata_file, filename, strlen(filename));
+}
+
+// Checks (define-memo (name params...) [:limit n] body...) and emits the
+// function's LispMemo record into .data. Returns the index of the body.
+static size_t emit_memo_record(struct CompilerContext *ctx,
+                               struct ExprVector *vec, const char *asm_label) {
+  size_t body_first = closure_memo_body_first(vec);
+  size_t limit = 0;
+  if (body_first > 2) {
+    struct Expr *limit_expr = &vec->elements[3];
+    if (limit_expr->type != S_TYPE_ATOM ||
+        limit_expr->val.atom_val.type != ATOM_TYPE_NUMBER ||
+        limit_expr->val.atom_val.value.number < 1 ||
+        limit_expr->val.atom_val.value.number !=
+            (double)(size_t)limit_expr->val.atom_val.value.number) {
+      fprintf(stderr, "Error: ':limit' of 'define-memo' must be a positive "
+                      "integer.\n");
+      exit(EXIT_FAILURE);
+    }
+    limit = (size_t)limit_expr->val.atom_val.value.number;
+  }
+  if (vec->len <= body_first) {
+    fprintf(stderr, "Error: 'define-memo' requires a body.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The parameter slots are the key, so they must still hold the arguments
+  // when the result is stored
+  struct ExprVector *sig_vec = &vec->elements[1].val.list_val;
+  for (size_t i = 1; i < sig_vec->len; ++i) {
+    const char *param = sig_vec->elements[i].val.atom_val.value.symbol;
+    for (size_t j = body_first; j < vec->len; ++j) {
+      if (closure_is_assigned(param, &vec->elements[j])) {
+        fprintf(stderr,
+                "Error: Parameter '%s' of a 'define-memo' function cannot be "
+                "assigned with 'set!'.\n",
+                param);
+        exit(EXIT_FAILURE);
       }
     }
   }
-  return count;
+
+  const char *name = sig_vec->elements[0].val.atom_val.value.symbol;
+  fprintf(ctx->gds->rodata_file, "%s.memo_name:\n", asm_label);
+  emit_db_string(ctx->gds->rodata_file, name, strlen(name));
+  FILE *data = ctx->gds->data_file;
+  fprintf(data, "align 8\n");
+  fprintf(data, "%s.memo:\n", asm_label);
+  fprintf(data, "  dq %s.memo_name\n", asm_label);
+  fprintf(data, "  dq %zu\t; num_args\n", sig_vec->len - 1);
+  fprintf(data, "  dq %zu\t; limit\n", limit);
+  fprintf(data, "  times %zu db 0\n",
+          sizeof(struct LispMemo) - LISPMEMO_RUNTIME_OFFSET);
+  return body_first;
 }
 
+// (define (name params...) body...) at top level. With memo, the function
+// was defined with define-memo and looks its arguments up in its LispMemo
+// record before running the body, and stores the result after.
 static void compile_define_function(struct CompilerContext *ctx,
-                                    struct ExprVector *vec) {
+                                    struct ExprVector *vec, bool memo) {
   struct Expr *signature = &vec->elements[1];
   struct ExprVector *sig_vec = &signature->val.list_val;
   struct Expr *func_name_expr = &sig_vec->elements[0];
@@ -250,51 +974,70 @@ static void compile_define_function(struct CompilerContext *ctx,
   struct SymbolInfo *func_info =
       symbol_make_user_func(func_name, asm_label, func_name_expr);
   symbol_table_define(ctx->sym_table, func_info);
+  size_t body_first = memo ? emit_memo_record(ctx, vec, asm_label) : 2;
 
-  if (ctx->gds->func_file == NULL) {
+  if (ctx->gds->func_file == NULL ||
+      ctx->sym_table->current_scope != ctx->sym_table->global_scope) {
     printf("\nFunction file is NULL: are you trying to create a nested "
            "function? \n");
     exit(1);
   }
+  FILE *func_section = ctx->gds->func_file;
+  char *code;
+  size_t code_size;
+  ctx->gds->func_file = open_memstream(&code, &code_size);
+  if (!ctx->gds->func_file) {
+    perror("open_memstream");
+    exit(EXIT_FAILURE);
+  }
 
   fprintf(ctx->gds->func_file, "\n; ---- Function Definition: %s ----\n",
           func_name);
+  // Exported with type and size so that profilers and dladdr can name it
+  fprintf(ctx->gds->func_file, "global %s:function (%s.end - %s)\n",
+          asm_label, asm_label, asm_label);
   fprintf(ctx->gds->func_file, "%s:\n", asm_label);
-  free(asm_label);
+  ctx->current_line = 0;
+  emit_line_directive(ctx, ctx->gds->func_file, func_name_expr->start_line);
 
   fprintf(ctx->gds->func_file, "  push rbp\n");
   fprintf(ctx->gds->func_file, "  mov rbp, rsp\n");
+  fprintf(ctx->gds->func_file, "  sub rsp, %s.frame_size\n", asm_label);
+  if (ctx->options.profile_generate) {
+    char key[280];
+    profile_function_key(key, sizeof(key), func_name);
+    emit_pgo_increment(ctx->gds->func_file, emit_pgo_counter(ctx, key, 1), 0);
+  }
 
   symbol_table_enter_scope(ctx->sym_table);
+  // Frame slots reserved in main do not carry over into the function
+  ctx->sym_table->current_scope->current_stack_offset = 0;
+  int outer_high_water = ctx->frame_high_water;
+  ctx->frame_high_water = 0;
 
-  const char *arg_registers[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
   size_t num_params = sig_vec->len - 1;
-  if (num_params > 6) {
-    fprintf(stderr, "Error: Functions with more than 6 parameters are not "
-                    "yet supported.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  size_t num_locals = count_local_defines(vec);
-  size_t total_stack_vars = num_params + num_locals;
-
-  if (total_stack_vars > 0) {
-    fprintf(ctx->gds->func_file, "  sub rsp, %zu\n", total_stack_vars * 8);
-  }
-
   for (size_t i = 0; i < num_params; ++i) {
     struct Expr *param_expr = &sig_vec->elements[i + 1];
     const char *param_name = param_expr->val.atom_val.value.symbol;
 
-    struct SymbolInfo *param_info =
-        symbol_make_local_var(param_name, 0, param_expr);
-    int stack_offset = symbol_table_define(ctx->sym_table, param_info);
+    int stack_offset = define_local_var(ctx, param_name, param_expr);
 
-    fprintf(ctx->gds->func_file,
-            "  ; Store parameter '%s' from %s to [rbp - %d]\n", param_name,
-            arg_registers[i], stack_offset);
-    fprintf(ctx->gds->func_file, "  mov [rbp - %d], %s\n", stack_offset,
-            arg_registers[i]);
+    fprintf(ctx->gds->func_file, "  ; Store parameter '%s' to [rbp - %d]\n",
+            param_name, stack_offset);
+    emit_store_param(ctx->gds->func_file, i, stack_offset);
+  }
+
+  // Before the body, so that recursive calls can pass closures on the stack
+  func_info->noescape_params = closure_noescape_params(
+      func_info, sig_vec, 1, vec, body_first, ctx->sym_table);
+
+  // The parameters were stored from [rbp - 8] down, so the last one is first
+  if (memo) {
+    fprintf(ctx->gds->func_file, "  mov rdi, %s.memo\n", asm_label);
+    fprintf(ctx->gds->func_file, "  lea rsi, [rbp - %zu]\n", num_params * 8);
+    fprintf(ctx->gds->func_file, "  call lisp_memo_lookup\n");
+    fprintf(ctx->gds->func_file, "  test rax, rax\n");
+    fprintf(ctx->gds->func_file, "  jnz %s.return\n", asm_label);
   }
 
   fprintf(ctx->gds->func_file, "\n  ; Function Body for %s\n", func_name);
@@ -302,116 +1045,1423 @@ static void compile_define_function(struct CompilerContext *ctx,
   FILE *temp_text_file = ctx->gds->text_file;
   ctx->gds->text_file = ctx->gds->func_file;
   ctx->gds->func_file = NULL;
-  for (size_t i = 2; i < vec->len; ++i) {
-    compile_expr(ctx, &vec->elements[i]);
-  }
+  compile_scope_body(ctx, vec, body_first, false);
   ctx->gds->func_file = ctx->gds->text_file;
   ctx->gds->text_file = temp_text_file;
+  // The next line directive lands in the other section file
+  ctx->current_line = 0;
+
+  if (memo) {
+    fprintf(ctx->gds->func_file, "  mov rdx, rax\n");
+    fprintf(ctx->gds->func_file, "  mov rdi, %s.memo\n", asm_label);
+    fprintf(ctx->gds->func_file, "  lea rsi, [rbp - %zu]\n", num_params * 8);
+    fprintf(ctx->gds->func_file, "  call lisp_memo_store\n");
+    fprintf(ctx->gds->func_file, "%s.return:\n", asm_label);
+  }
 
   fprintf(ctx->gds->func_file, "\n  ; Epilogue for %s\n", func_name);
   fprintf(ctx->gds->func_file, "  mov rsp, rbp\n");
   fprintf(ctx->gds->func_file, "  pop rbp\n");
   fprintf(ctx->gds->func_file, "  ret\n");
+  fprintf(ctx->gds->func_file, "%s.end:\n", asm_label);
+  emit_frame_size(ctx->gds->func_file, asm_label, ctx->frame_high_water);
+
+  // Used as a value, the function is a closure without free variables whose
+  // code drops the closure argument and jumps to the function. From six
+  // parameters on, the sixth comes on the stack and the function wants it
+  // in r9, so the stack arguments are passed again one slot lower by a call.
+  FILE *out = ctx->gds->func_file;
+  fprintf(out, "%s.entry:\n", asm_label);
+  size_t stack_bytes = 0;
+  if (num_params >= NUM_ARG_REGISTERS) {
+    size_t num_stack = num_params - NUM_ARG_REGISTERS;
+    stack_bytes = (num_stack * 8 + 15) & ~(size_t)15;
+    fprintf(out, "  push rbp\n");
+    fprintf(out, "  mov rbp, rsp\n");
+    if (stack_bytes > 0) {
+      fprintf(out, "  sub rsp, %zu\n", stack_bytes);
+    }
+    for (size_t i = 0; i < num_stack; ++i) {
+      fprintf(out, "  mov rax, [rbp + %zu]\n", 24 + i * 8);
+      fprintf(out, "  mov [rsp + %zu], rax\n", i * 8);
+    }
+  }
+  for (size_t i = 0; i < num_params && i + 1 < NUM_ARG_REGISTERS; ++i) {
+    fprintf(out, "  mov %s, %s\n", arg_registers[i], arg_registers[i + 1]);
+  }
+  if (num_params >= NUM_ARG_REGISTERS) {
+    fprintf(out, "  mov r9, [rbp + 16]\n");
+    fprintf(out, "  call %s\n", asm_label);
+    fprintf(out, "  mov rsp, rbp\n");
+    fprintf(out, "  pop rbp\n");
+    fprintf(out, "  ret\n");
+  } else {
+    fprintf(out, "  jmp %s\n", asm_label);
+  }
+  fprintf(ctx->gds->rodata_file, "align 8\n");
+  fprintf(ctx->gds->rodata_file, "%s.closure: dq %d, %s.entry\n", asm_label,
+          LVAL_FUNC, asm_label);
   fprintf(ctx->gds->func_file, "; ---- End Function: %s ----\n", func_name);
+  free(asm_label);
+  fclose(ctx->gds->func_file);
+  ctx->gds->func_file = func_section;
+  add_compiled_function(ctx, func_name, code, code_size);
 
+  ctx->frame_high_water = outer_high_water;
   symbol_table_exit_scope(ctx->sym_table);
 }
 
+static const struct BuiltinFunction *lookup_builtin(const char *op_name) {
+  for (size_t i = 0; i < NUM_BUILTIN_FUNCTIONS; ++i) {
+    if (strcmp(op_name, builtin_functions[i].name) == 0) {
+      return &builtin_functions[i];
+    }
+  }
+  return NULL;
+}
+
 const char *match_builtin_function(const char *op_name) {
-  const char *extern_func = "UNKNOWN_FUNCTION";
-  if (strcmp(op_name, "+") == 0)
-    extern_func = "lisp_add";
-  else if (strcmp(op_name, "-"))
-    extern_func = "lisp_subtract";
-  else if (strcmp(op_name, "*"))
-    extern_func = "lisp_multiply";
-  else if (strcmp(op_name, "/"))
-    extern_func = "lisp_divide";
-  return extern_func;
+  const struct BuiltinFunction *builtin = lookup_builtin(op_name);
+  return builtin ? builtin->runtime_func : "UNKNOWN_FUNCTION";
 }
 
-static void compile_function_call(struct CompilerContext *ctx,
-                                  struct SymbolInfo *op_info,
-                                  struct ExprVector *vec) {
-  const char *op_name = op_info->name;
-  size_t num_args = vec->len - 1;
+// The builtin that expr calls directly by name, or NULL
+static const struct BuiltinFunction *called_builtin(struct CompilerContext *ctx,
+                                                    struct Expr *expr) {
+  if (expr->type != S_TYPE_LIST || expr->val.list_val.len == 0) {
+    return NULL;
+  }
+  struct Expr *head = &expr->val.list_val.elements[0];
+  if (head->type != S_TYPE_ATOM ||
+      head->val.atom_val.type != ATOM_TYPE_SYMBOL) {
+    return NULL;
+  }
+  struct SymbolInfo *info =
+      symbol_table_lookup(ctx->sym_table, head->val.atom_val.value.symbol);
+  return info && info->kind == SYM_BUILTIN_FUNC ? lookup_builtin(info->name)
+                                                : NULL;
+}
 
-  fprintf(ctx->gds->text_file, "\n  ; --- Function Call to '%s' ---\n",
-          op_name);
+static void check_builtin_args(const struct BuiltinFunction *builtin,
+                               size_t num_args) {
+  if (builtin->num_args != BUILTIN_VARIADIC && num_args != builtin->num_args) {
+    fprintf(stderr, "Error: Built-in '%s' requires %zu arguments, got %zu.\n",
+            builtin->name, builtin->num_args, num_args);
+    exit(EXIT_FAILURE);
+  }
+}
 
-  if (op_info->kind == SYM_BUILTIN_FUNC) {
-    if (strcmp(op_name, "+") == 0 || strcmp(op_name, "-") == 0) {
-      if (num_args != 2) {
-        fprintf(stderr, "Error: Built-in '%s' requires 2 arguments, got %zu.\n",
-                op_name, num_args);
-        exit(EXIT_FAILURE);
-      }
-      compile_expr(ctx, &vec->elements[2]);
-      fprintf(ctx->gds->text_file, "  push rax\n");
-      compile_expr(ctx, &vec->elements[1]);
-      fprintf(ctx->gds->text_file, "  mov rdi, rax\n");
-      fprintf(ctx->gds->text_file, "  pop rsi\n");
+// The index of name in arithmetic_ops, or -1
+static int arithmetic_op_index(const char *name) {
+  for (size_t i = 0; i < sizeof(arithmetic_ops) / sizeof(arithmetic_ops[0]);
+       ++i) {
+    if (strcmp(name, arithmetic_ops[i].name) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
 
-      const char *extern_func = match_builtin_function(op_name);
-      fprintf(ctx->gds->text_file, "  call %s\n", extern_func);
-      return;
+static void compile_arithmetic_double(struct CompilerContext *ctx, size_t op,
+                                      struct ExprVector *vec);
+
+// Where an operand of a fused arithmetic chain or comparison has its double
+struct DoubleOperand {
+  enum { OPERAND_LITERAL, OPERAND_VARIABLE, OPERAND_SLOT } kind;
+  struct Expr *expr;
+  int location; // [rbp - location] of a slot
+};
+
+// Gets the doubles of operands ready to be read without any call in
+// between. Literals stay in .rodata and are never boxed. If every operand
+// is an atom, variables are loaded as they are read; otherwise all operands
+// that are not literals are evaluated in order into frame slots, which
+// stay reserved until the caller restores the returned scope offset.
+// Arithmetic operands are computed into their slot without being boxed.
+static int prepare_double_operands(struct CompilerContext *ctx,
+                                   struct Expr *operands, size_t count,
+                                   struct DoubleOperand *out) {
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  bool all_atoms = true;
+  for (size_t i = 0; i < count; ++i) {
+    all_atoms = all_atoms && operands[i].type == S_TYPE_ATOM;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    struct Expr *operand = &operands[i];
+    out[i].expr = operand;
+    if (operand->type == S_TYPE_ATOM &&
+        operand->val.atom_val.type == ATOM_TYPE_NUMBER) {
+      out[i].kind = OPERAND_LITERAL;
+    } else if (all_atoms && operand->val.atom_val.type == ATOM_TYPE_SYMBOL) {
+      out[i].kind = OPERAND_VARIABLE;
+    } else {
+      out[i].kind = OPERAND_SLOT;
+      out[i].location = reserve_frame_slots(ctx, 1);
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (out[i].kind != OPERAND_SLOT) {
+      continue;
+    }
+    const struct BuiltinFunction *builtin = called_builtin(ctx, out[i].expr);
+    int op = builtin ? arithmetic_op_index(builtin->name) : -1;
+    if (op >= 0) {
+      emit_line_directive(ctx, ctx->gds->text_file, out[i].expr->start_line);
+      compile_arithmetic_double(ctx, (size_t)op, &out[i].expr->val.list_val);
+    } else {
+      int temporaries = ctx->sym_table->current_scope->current_stack_offset;
+      compile_temporary(ctx, out[i].expr);
+      ctx->sym_table->current_scope->current_stack_offset = temporaries;
+      fprintf(ctx->gds->text_file, "  movsd xmm0, [rax + %d]\n",
+              LISPVALUE_VALUE_OFFSET);
     }
+    fprintf(ctx->gds->text_file, "  movsd [rbp - %d], xmm0\n",
+            out[i].location);
   }
+  return saved_offset;
+}
 
-  const char *arg_registers[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-  if (num_args > 6) {
-    fprintf(stderr, "Error: Calling functions with more than 6 arguments "
-                    "is not supported.\n");
-    exit(EXIT_FAILURE);
+// Emits whatever loads operand needs, which leave xmm registers alone, and
+// writes the memory operand that holds its double to buf
+static void double_operand_location(struct CompilerContext *ctx,
+                                    const struct DoubleOperand *operand,
+                                    char *buf, size_t size) {
+  switch (operand->kind) {
+  case OPERAND_LITERAL:
+    double_constant_location(ctx, operand->expr->val.atom_val.value.number,
+                             buf, size);
+    break;
+  case OPERAND_SLOT:
+    snprintf(buf, size, "[rbp - %d]", operand->location);
+    break;
+  case OPERAND_VARIABLE:
+    compile_atom(ctx, &operand->expr->val.atom_val);
+    snprintf(buf, size, "[rax + %d]", LISPVALUE_VALUE_OFFSET);
+    break;
   }
+}
 
-  fprintf(ctx->gds->text_file, "  ; Evaluate arguments (push args to stack)\n");
-  for (size_t i = 1; i <= num_args; ++i) {
-    compile_expr(ctx, &vec->elements[i]);
-    fprintf(ctx->gds->text_file, "  push rax\n");
+// Leaves the result of an arithmetic builtin in xmm0
+static void compile_arithmetic_double(struct CompilerContext *ctx, size_t op,
+                                      struct ExprVector *vec) {
+  FILE *out = ctx->gds->text_file;
+  size_t count = vec->len - 1;
+  if (count < arithmetic_ops[op].min_args) {
+    fprintf(stderr, "Error: '%s' requires at least %zu argument.\n",
+            arithmetic_ops[op].name, arithmetic_ops[op].min_args);
+    exit(EXIT_FAILURE);
   }
 
-  fprintf(ctx->gds->text_file,
-          "  ; Load arguments from stack into registers\n");
-  for (int i = num_args - 1; i >= 0; --i) {
-    fprintf(ctx->gds->text_file, "  pop %s\n", arg_registers[i]);
+  // (- x) and (/ x) start from the identity, (+) and (*) are just it
+  bool from_identity = count < 2;
+  struct DoubleOperand *operands =
+      malloc((count + 1) * sizeof(struct DoubleOperand));
+  if (!operands) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  int saved_offset =
+      prepare_double_operands(ctx, &vec->elements[1], count, operands);
+
+  char location[64];
+  if (from_identity) {
+    double_constant_location(ctx, arithmetic_ops[op].identity, location,
+                             sizeof(location));
+    fprintf(out, "  movsd xmm0, %s\n", location);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    double_operand_location(ctx, &operands[i], location, sizeof(location));
+    fprintf(out, "  %s xmm0, %s\n",
+            i == 0 && !from_identity ? "movsd" : arithmetic_ops[op].instruction,
+            location);
   }
 
-  fprintf(ctx->gds->text_file, "  call %s\n",
-          op_info->location.global_asm_label);
-  fprintf(ctx->gds->text_file,
-          "  ; --- End Call to '%s', result is in RAX ---\n", op_name);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  free(operands);
 }
 
-static void compile_list(struct CompilerContext *ctx, struct Expr *list_expr) {
-  struct ExprVector *vec = &list_expr->val.list_val;
+static void compile_arithmetic(struct CompilerContext *ctx, size_t op,
+                               struct ExprVector *vec) {
+  compile_arithmetic_double(ctx, op, vec);
+  fprintf(ctx->gds->text_file, "  call lisp_make_number\n");
+}
 
-  if (vec->len == 0) {
-    fprintf(ctx->gds->text_file, "\n  ; Load '() -> nil value\n");
-    fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+// Compiles expr for a value that is only read until the caller restores the
+// scope offset it had before, like an argument that the callee does not let
+// escape. A number made by arithmetic or by a builtin with a runtime_into
+// variant is put into two frame slots reserved for it instead of the heap.
+static void compile_temporary(struct CompilerContext *ctx, struct Expr *expr) {
+  const struct BuiltinFunction *builtin = called_builtin(ctx, expr);
+  int op = builtin ? arithmetic_op_index(builtin->name) : -1;
+  if (op < 0 && !(builtin && builtin->runtime_into)) {
+    compile_expr(ctx, expr);
     return;
   }
 
-  struct Expr *first = &vec->elements[0];
-  if (first->type != S_TYPE_ATOM ||
-      first->val.atom_val.type != ATOM_TYPE_SYMBOL) {
-    fprintf(stderr, "Error: Expression starting with a non-symbol.\n");
-    exit(EXIT_FAILURE);
+  FILE *out = ctx->gds->text_file;
+  struct ExprVector *vec = &expr->val.list_val;
+  size_t num_args = vec->len - 1;
+  emit_line_directive(ctx, out, expr->start_line);
+  ctx->tail_position = false;
+  ctx->noescape = false;
+  int box = reserve_frame_slots(ctx, 2);
+  if (op >= 0) {
+    compile_arithmetic_double(ctx, (size_t)op, vec);
+    fprintf(out, "  mov qword [rbp - %d], %d\n", box, LVAL_NUM);
+    fprintf(out, "  movsd [rbp - %d], xmm0\n", box - LISPVALUE_VALUE_OFFSET);
+    fprintf(out, "  lea rax, [rbp - %d]\n", box);
+    return;
   }
 
-  const char *op_name = first->val.atom_val.value.symbol;
-  struct SymbolInfo *op_info = symbol_table_lookup(ctx->sym_table, op_name);
-
-  if (!op_info) {
-    fprintf(stderr, "Error: Undefined operator '%s'\n", op_name);
+  check_builtin_args(builtin, num_args);
+  struct CallArg *args = malloc((num_args + 1) * sizeof(struct CallArg));
+  if (!args) {
+    perror("malloc");
     exit(EXIT_FAILURE);
   }
+  fprintf(out, "\n  ; --- '%s' into the frame ---\n", builtin->name);
+  evaluate_call_args(ctx, &vec->elements[1], num_args, builtin->noescape_args,
+                     true, true, args);
+  size_t stack_bytes = place_call_args(ctx, args, num_args, 1);
+  fprintf(out, "  lea rdi, [rbp - %d]\n", box);
+  emit_call(ctx, builtin->runtime_into, stack_bytes);
+  free(args);
+}
 
-  if (op_info->kind == SYM_SPECIAL_FORM) {
-    if (strcmp(op_name, "define") == 0) {
-      if (vec->len < 3) {
-        fprintf(stderr, "Error: Invalid 'define' syntax. Too few parts.\n");
-        exit(EXIT_FAILURE);
+// Evaluates exprs with compile in order into consecutive frame slots, the
+// first one lowest, for the runtime functions that take a count in rdi and
+// an array of values in rsi. Returns the scope offset for the caller to
+// restore once the call is made.
+static int compile_value_array(struct CompilerContext *ctx, struct Expr *exprs,
+                               size_t count,
+                               void (*compile)(struct CompilerContext *,
+                                               struct Expr *)) {
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  int base = reserve_frame_slots(ctx, count);
+  for (size_t i = 0; i < count; ++i) {
+    compile(ctx, &exprs[i]);
+    fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n",
+            base - (int)i * 8);
+  }
+  fprintf(ctx->gds->text_file, "  mov rdi, %zu\n", count);
+  fprintf(ctx->gds->text_file, "  lea rsi, [rbp - %d]\n", base);
+  return saved_offset;
+}
+
+static void compile_function_call(struct CompilerContext *ctx,
+                                  struct SymbolInfo *op_info,
+                                  struct ExprVector *vec) {
+  const char *op_name = op_info->name;
+  size_t num_args = vec->len - 1;
+
+  fprintf(ctx->gds->text_file, "\n  ; --- Function Call to '%s' ---\n",
+          op_name);
+
+  const struct BuiltinFunction *builtin = NULL;
+  if (op_info->kind == SYM_BUILTIN_FUNC) {
+    int op = arithmetic_op_index(op_name);
+    if (op >= 0) {
+      compile_arithmetic(ctx, (size_t)op, vec);
+      return;
+    }
+    builtin = lookup_builtin(op_name);
+    if (builtin->num_args == BUILTIN_VARIADIC) {
+      if (num_args == 0) {
+        fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+        return;
+      }
+      int saved_offset = compile_value_array(
+          ctx, &vec->elements[1], num_args,
+          builtin->noescape_args ? compile_temporary : compile_expr);
+      fprintf(ctx->gds->text_file, "  call %s\n", builtin->runtime_func);
+      ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+      return;
+    }
+    check_builtin_args(builtin, num_args);
+  }
+
+  struct CallArg *args = malloc((num_args + 1) * sizeof(struct CallArg));
+  if (!args) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  // A lambda or number passed where the callee does not let it escape can be
+  // made in this frame
+  evaluate_call_args(ctx, &vec->elements[1], num_args,
+                     op_info->noescape_params, true, true, args);
+  size_t stack_bytes = place_call_args(ctx, args, num_args, 0);
+  emit_call(ctx,
+            builtin ? builtin->runtime_func
+                    : op_info->location.global_asm_label,
+            stack_bytes);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  free(args);
+  fprintf(ctx->gds->text_file,
+          "  ; --- End Call to '%s', result is in RAX ---\n", op_name);
+}
+
+static void compile_set(struct CompilerContext *ctx, struct ExprVector *vec) {
+  if (vec->len != 3 || vec->elements[1].type != S_TYPE_ATOM ||
+      vec->elements[1].val.atom_val.type != ATOM_TYPE_SYMBOL) {
+    fprintf(stderr, "Error: 'set!' expects a variable name and a value.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const char *name = vec->elements[1].val.atom_val.value.symbol;
+  struct SymbolInfo *info = symbol_table_lookup(ctx->sym_table, name);
+  if (info && info->kind == SYM_FREE_VAR) {
+    fprintf(stderr,
+            "Error: Cannot 'set!' '%s', closures capture it by value.\n",
+            name);
+    exit(EXIT_FAILURE);
+  }
+  if (!info || (info->kind != SYM_LOCAL_VAR && info->kind != SYM_GLOBAL_VAR) ||
+      strcmp(name, "#t") == 0 || strcmp(name, "#f") == 0) {
+    fprintf(stderr, "Error: Cannot 'set!' '%s', it is not a variable.\n",
+            name);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(ctx->gds->text_file, "\n  ; --- SET! '%s' ---\n", name);
+  compile_expr(ctx, &vec->elements[2]);
+  if (info->kind == SYM_LOCAL_VAR) {
+    fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n",
+            info->location.stack_offset);
+  } else {
+    fprintf(ctx->gds->text_file, "  mov [%s], rax\n",
+            info->location.global_asm_label);
+  }
+}
+
+// Compiles the forms of a body in order, leaving the value of the last one in
+// RAX. Only the last form inherits the tail position of the body.
+static void compile_body(struct CompilerContext *ctx, struct ExprVector *vec,
+                         size_t first, bool tail) {
+  if (first >= vec->len) {
+    fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+    return;
+  }
+  for (size_t i = first; i < vec->len; ++i) {
+    if (ctx->current_body == vec) {
+      ctx->current_body_index = i;
+    }
+    ctx->tail_position = tail && i == vec->len - 1;
+    compile_expr(ctx, &vec->elements[i]);
+  }
+}
+
+// A body that makes up the rest of its scope, so that a nested define in it
+// can see every later use of its name (see compile_define_nested).
+static void compile_scope_body(struct CompilerContext *ctx,
+                               struct ExprVector *vec, size_t first,
+                               bool tail) {
+  struct ExprVector *outer_body = ctx->current_body;
+  size_t outer_index = ctx->current_body_index;
+  ctx->current_body = vec;
+  compile_body(ctx, vec, first, tail);
+  ctx->current_body = outer_body;
+  ctx->current_body_index = outer_index;
+}
+
+// (while test body...) -- evaluates body while test is not #f, result is #f.
+static void compile_while(struct CompilerContext *ctx, struct ExprVector *vec) {
+  if (vec->len < 2) {
+    fprintf(stderr, "Error: 'while' requires a test expression.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int label_id = new_label_id();
+  fprintf(ctx->gds->text_file, "\n  ; --- WHILE Loop ---\n");
+  fprintf(ctx->gds->text_file, "L_while_start_%d:\n", label_id);
+  char end_label[32];
+  snprintf(end_label, sizeof(end_label), "L_while_end_%d", label_id);
+  compile_branch(ctx, &vec->elements[1], false, end_label);
+
+  compile_body(ctx, vec, 2, false);
+  fprintf(ctx->gds->text_file, "  jmp L_while_start_%d\n", label_id);
+  fprintf(ctx->gds->text_file, "L_while_end_%d:\n", label_id);
+  fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+  fprintf(ctx->gds->text_file, "  ; --- End WHILE Loop ---\n");
+}
+
+// Compiles test and jumps to label if it is #f, or with jump_if_true if it
+// is not. A comparison builtin with two operands jumps on the flags of
+// ucomisd instead of producing a value.
+static void compile_branch(struct CompilerContext *ctx, struct Expr *test,
+                           bool jump_if_true, const char *label) {
+  FILE *out = ctx->gds->text_file;
+  struct ExprVector *vec = &test->val.list_val;
+  struct SymbolInfo *op_info =
+      test->type == S_TYPE_LIST && vec->len == 3 &&
+              vec->elements[0].type == S_TYPE_ATOM &&
+              vec->elements[0].val.atom_val.type == ATOM_TYPE_SYMBOL
+          ? symbol_table_lookup(ctx->sym_table,
+                                vec->elements[0].val.atom_val.value.symbol)
+          : NULL;
+  if (op_info && op_info->kind == SYM_BUILTIN_FUNC) {
+    const char *op_name = vec->elements[0].val.atom_val.value.symbol;
+    for (size_t i = 0;
+         i < sizeof(fused_comparisons) / sizeof(fused_comparisons[0]); ++i) {
+      if (strcmp(op_name, fused_comparisons[i].name) != 0) {
+        continue;
+      }
+      fprintf(out, "  ; --- Fused comparison '%s' ---\n", op_name);
+      struct DoubleOperand operands[2];
+      int saved_offset =
+          prepare_double_operands(ctx, &vec->elements[1], 2, operands);
+      bool swap = fused_comparisons[i].swap;
+      char location[64];
+      double_operand_location(ctx, &operands[swap], location,
+                              sizeof(location));
+      fprintf(out, "  movsd xmm0, %s\n", location);
+      double_operand_location(ctx, &operands[!swap], location,
+                              sizeof(location));
+      fprintf(out, "  ucomisd xmm0, %s\n", location);
+      ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+      if (jump_if_true && fused_comparisons[i].jump_if_unordered) {
+        int ordered_id = new_label_id();
+        fprintf(out, "  %s L_unordered_%d\n",
+                fused_comparisons[i].jump_if_unordered, ordered_id);
+        fprintf(out, "  %s %s\n", fused_comparisons[i].jump_if_true, label);
+        fprintf(out, "L_unordered_%d:\n", ordered_id);
+      } else if (jump_if_true) {
+        fprintf(out, "  %s %s\n", fused_comparisons[i].jump_if_true, label);
+      } else {
+        fprintf(out, "  %s %s\n", fused_comparisons[i].jump_if_false, label);
+        if (fused_comparisons[i].jump_if_unordered) {
+          fprintf(out, "  %s %s\n", fused_comparisons[i].jump_if_unordered,
+                  label);
+        }
+      }
+      return;
+    }
+  }
+
+  // The value is only compared, so it may be made in the frame
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  compile_temporary(ctx, test);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  fprintf(out, "  ; Check if condition is %s\n",
+          jump_if_true ? "true" : "false (#f)");
+  fprintf(out, "  cmp rax, G_LISP_NIL\n");
+  fprintf(out, "  %s %s\n", jump_if_true ? "jne" : "je", label);
+}
+
+// (if test then [else]). The then branch falls through from the test and
+// the else branch is jumped to, unless the profile says the else branch is
+// taken more often; then it is the one that falls through.
+static void compile_if(struct CompilerContext *ctx, struct Expr *if_expr,
+                       bool tail) {
+  struct ExprVector *vec = &if_expr->val.list_val;
+  if (vec->len < 3 || vec->len > 4) {
+    fprintf(stderr,
+            "Error: 'if' special form requires 2 or 3 arguments, but got "
+            "%zu.\n",
+            vec->len - 1);
+    exit(EXIT_FAILURE);
+  }
+
+  int counter = -1;
+  if (ctx->options.profile_generate) {
+    char key[64];
+    profile_branch_key(key, sizeof(key), if_expr);
+    counter = emit_pgo_counter(ctx, key, 2);
+  }
+  unsigned long then_count;
+  unsigned long else_count;
+  bool else_first = ctx->options.profile &&
+                    profile_branch_counts(ctx->options.profile, if_expr,
+                                          &then_count, &else_count) &&
+                    else_count > then_count;
+
+  int else_label_id = new_label_id();
+  int end_if_label_id = new_label_id();
+  FILE *out = ctx->gds->text_file;
+
+  fprintf(out, "\n  ; --- IF Statement ---\n");
+  fprintf(out, "  ; Compile condition\n");
+  char label[32];
+  snprintf(label, sizeof(label), else_first ? "L_if_then_%d" : "L_if_else_%d",
+           else_label_id);
+  compile_branch(ctx, &vec->elements[1], else_first, label);
+
+  for (int i = 0; i < 2; ++i) {
+    bool then_branch = (i == 0) != else_first;
+    if (i == 1) {
+      fprintf(out, "  jmp L_if_end_%d\n", end_if_label_id);
+      fprintf(out, "\n%s:\n", label);
+    }
+    if (counter >= 0) {
+      emit_pgo_increment(out, counter, then_branch ? 0 : 1);
+    }
+    if (then_branch) {
+      fprintf(out, "\n  ; Then branch\n");
+      ctx->tail_position = tail;
+      compile_expr(ctx, &vec->elements[2]);
+    } else if (vec->len == 4) {
+      fprintf(out, "  ; Else branch\n");
+      ctx->tail_position = tail;
+      compile_expr(ctx, &vec->elements[3]);
+    } else {
+      fprintf(out, "  ; No else branch, result is #f\n");
+      fprintf(out, "  mov rax, G_LISP_NIL\n");
+    }
+  }
+
+  fprintf(out, "\nL_if_end_%d:\n", end_if_label_id);
+  fprintf(out, "  ; --- End IF Statement ---\n");
+}
+
+// Checks a list of (name init ...) bindings and returns the number of them.
+static size_t check_bindings(struct Expr *bindings_expr, const char *form,
+                             size_t max_len) {
+  if (bindings_expr->type != S_TYPE_LIST) {
+    fprintf(stderr, "Error: '%s' expects a list of bindings.\n", form);
+    exit(EXIT_FAILURE);
+  }
+  struct ExprVector *bindings = &bindings_expr->val.list_val;
+  for (size_t i = 0; i < bindings->len; ++i) {
+    struct Expr *binding = &bindings->elements[i];
+    if (binding->type != S_TYPE_LIST || binding->val.list_val.len < 2 ||
+        binding->val.list_val.len > max_len ||
+        binding->val.list_val.elements[0].type != S_TYPE_ATOM ||
+        binding->val.list_val.elements[0].val.atom_val.type !=
+            ATOM_TYPE_SYMBOL) {
+      fprintf(stderr, "Error: Invalid binding in '%s'.\n", form);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return bindings->len;
+}
+
+// Evaluates every init in the enclosing scope, then enters a new scope and
+// stores the values into consecutive stack slots for the bound names.
+// Returns the offset of the first slot. If body is not NULL it is the whole
+// scope of the names, and lambdas bound to names that do not escape it are
+// built on the stack.
+static int compile_bindings(struct CompilerContext *ctx,
+                            struct ExprVector *bindings,
+                            struct ExprVector *body, size_t body_first) {
+  // The names get the slots that follow when they are defined right after
+  // entering the new scope, so the values are stored there directly. Stack
+  // closure records built by the inits lie past them and stay reserved for
+  // the whole new scope.
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  reserve_frame_slots(ctx, bindings->len);
+  for (size_t i = 0; i < bindings->len; ++i) {
+    struct ExprVector *binding = &bindings->elements[i].val.list_val;
+    if (body && closure_is_lambda(&binding->elements[1])) {
+      unsigned int uses = closure_classify_uses(
+          binding->elements[0].val.atom_val.value.symbol, NULL, 0, body,
+          body_first, ctx->sym_table);
+      ctx->noescape =
+          !(uses & ~(CLOSURE_USE_CALL | CLOSURE_USE_NOESCAPE_ARG));
+    }
+    compile_expr(ctx, &binding->elements[1]);
+    fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n",
+            saved_offset + (int)(i + 1) * 8);
+  }
+  int inits_offset = ctx->sym_table->current_scope->current_stack_offset;
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+
+  symbol_table_enter_scope(ctx->sym_table);
+  for (size_t i = 0; i < bindings->len; ++i) {
+    struct Expr *name_expr = &bindings->elements[i].val.list_val.elements[0];
+    define_local_var(ctx, name_expr->val.atom_val.value.symbol, name_expr);
+  }
+  ctx->sym_table->current_scope->current_stack_offset = inits_offset;
+  return saved_offset + 8;
+}
+
+// Assigns the values of exprs to the variables at [rbp - first_slot - 8 * i]
+// as if all at once: every value but the last is kept in a frame slot until
+// they are all evaluated. NULL entries leave their variable alone.
+static void compile_parallel_assign(struct CompilerContext *ctx,
+                                    struct Expr **exprs, size_t count,
+                                    int first_slot) {
+  FILE *out = ctx->gds->text_file;
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  size_t last = count;
+  for (size_t i = 0; i < count; ++i) {
+    if (exprs[i]) {
+      last = i;
+    }
+  }
+  int *temps = malloc((count + 1) * sizeof(int));
+  if (!temps) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (!exprs[i]) {
+      continue;
+    }
+    compile_expr(ctx, exprs[i]);
+    if (i != last) {
+      temps[i] = reserve_frame_slots(ctx, 1);
+      fprintf(out, "  mov [rbp - %d], rax\n", temps[i]);
+    }
+  }
+  if (last < count) {
+    fprintf(out, "  mov [rbp - %d], rax\n", first_slot + (int)last * 8);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (exprs[i] && i != last) {
+      fprintf(out, "  mov rax, [rbp - %d]\n", temps[i]);
+      fprintf(out, "  mov [rbp - %d], rax\n", first_slot + (int)i * 8);
+    }
+  }
+  free(temps);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+}
+
+// (do ((var init step)...) (test result...) body...)
+static void compile_do(struct CompilerContext *ctx, struct ExprVector *vec) {
+  if (vec->len < 3 || vec->elements[2].type != S_TYPE_LIST ||
+      vec->elements[2].val.list_val.len < 1) {
+    fprintf(stderr, "Error: Invalid 'do' syntax.\n");
+    exit(EXIT_FAILURE);
+  }
+  check_bindings(&vec->elements[1], "do", 3);
+  struct ExprVector *bindings = &vec->elements[1].val.list_val;
+  struct ExprVector *test_clause = &vec->elements[2].val.list_val;
+
+  int label_id = new_label_id();
+  fprintf(ctx->gds->text_file, "\n  ; --- DO Loop ---\n");
+  int first_slot = compile_bindings(ctx, bindings, NULL, 0);
+
+  fprintf(ctx->gds->text_file, "L_do_start_%d:\n", label_id);
+  compile_expr(ctx, &test_clause->elements[0]);
+  fprintf(ctx->gds->text_file, "  cmp rax, G_LISP_NIL\n");
+  fprintf(ctx->gds->text_file, "  jne L_do_end_%d\n", label_id);
+
+  compile_body(ctx, vec, 3, false);
+
+  // Steps see the old values of every variable, so assign them in parallel
+  struct Expr **steps = malloc((bindings->len + 1) * sizeof(struct Expr *));
+  if (!steps) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < bindings->len; ++i) {
+    struct ExprVector *binding = &bindings->elements[i].val.list_val;
+    steps[i] = binding->len == 3 ? &binding->elements[2] : NULL;
+  }
+  compile_parallel_assign(ctx, steps, bindings->len, first_slot);
+  free(steps);
+  fprintf(ctx->gds->text_file, "  jmp L_do_start_%d\n", label_id);
+
+  fprintf(ctx->gds->text_file, "L_do_end_%d:\n", label_id);
+  compile_body(ctx, test_clause, 1, false);
+  symbol_table_exit_scope(ctx->sym_table);
+  fprintf(ctx->gds->text_file, "  ; --- End DO Loop ---\n");
+}
+
+// (let ((var init)...) body...) and the named form
+// (let name ((var init)...) body...), where calling name in tail position
+// rebinds the variables and jumps back to the top of the body.
+static void compile_let(struct CompilerContext *ctx, struct Expr *let_expr) {
+  struct ExprVector *vec = &let_expr->val.list_val;
+  bool tail = ctx->tail_position;
+  const char *loop_name = NULL;
+  size_t bindings_index = 1;
+
+  if (vec->len > 1 && vec->elements[1].type == S_TYPE_ATOM &&
+      vec->elements[1].val.atom_val.type == ATOM_TYPE_SYMBOL) {
+    loop_name = vec->elements[1].val.atom_val.value.symbol;
+    bindings_index = 2;
+  }
+  if (vec->len < bindings_index + 2) {
+    fprintf(stderr, "Error: 'let' requires bindings and a body.\n");
+    exit(EXIT_FAILURE);
+  }
+  check_bindings(&vec->elements[bindings_index], "let", 2);
+  struct ExprVector *bindings = &vec->elements[bindings_index].val.list_val;
+
+  fprintf(ctx->gds->text_file, "\n  ; --- LET%s%s ---\n",
+          loop_name ? " " : "", loop_name ? loop_name : "");
+  // The variables of a named let are rebound by every iteration
+  int first_slot = compile_bindings(ctx, bindings, loop_name ? NULL : vec,
+                                    bindings_index + 1);
+
+  int saved_tail_loop_id = ctx->tail_loop_id;
+  if (loop_name) {
+    int label_id = new_label_id();
+    struct SymbolInfo *info = symbol_make_loop(
+        loop_name, label_id, first_slot, bindings->len, let_expr);
+    symbol_table_define(ctx->sym_table, info);
+    fprintf(ctx->gds->text_file, "L_loop_%d:\n", label_id);
+    // Outside tail position the body cannot jump to the loops around it
+    if (!tail) {
+      ctx->tail_loop_id = label_id;
+    }
+    tail = true;
+  }
+
+  compile_scope_body(ctx, vec, bindings_index + 1, tail);
+  ctx->tail_loop_id = saved_tail_loop_id;
+  symbol_table_exit_scope(ctx->sym_table);
+  fprintf(ctx->gds->text_file, "  ; --- End LET ---\n");
+}
+
+static void compile_loop_jump(struct CompilerContext *ctx,
+                              struct SymbolInfo *loop_info,
+                              struct ExprVector *vec) {
+  if (!ctx->tail_position ||
+      loop_info->location.loop.label_id < ctx->tail_loop_id) {
+    fprintf(stderr,
+            "Error: Loop '%s' can only be called in tail position.\n",
+            loop_info->name);
+    exit(EXIT_FAILURE);
+  }
+  ctx->tail_position = false;
+
+  size_t num_args = vec->len - 1;
+  if (num_args != loop_info->location.loop.num_vars) {
+    fprintf(stderr, "Error: Loop '%s' expects %zu arguments, got %zu.\n",
+            loop_info->name, loop_info->location.loop.num_vars, num_args);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(ctx->gds->text_file, "\n  ; --- Next iteration of '%s' ---\n",
+          loop_info->name);
+  struct Expr **args = malloc((num_args + 1) * sizeof(struct Expr *));
+  if (!args) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < num_args; ++i) {
+    args[i] = &vec->elements[i + 1];
+  }
+  compile_parallel_assign(ctx, args, num_args,
+                          loop_info->location.loop.first_slot_offset);
+  free(args);
+  fprintf(ctx->gds->text_file, "  jmp L_loop_%d\n",
+          loop_info->location.loop.label_id);
+}
+
+// Quoted numbers evaluate to themselves and quoted lists are built with
+// lisp_list at run time; symbols have no runtime representation yet.
+static void compile_quote(struct CompilerContext *ctx, struct Expr *datum) {
+  if (datum->type == S_TYPE_ATOM) {
+    if (datum->val.atom_val.type != ATOM_TYPE_NUMBER) {
+      fprintf(stderr, "Error: Only numbers and lists can be quoted.\n");
+      exit(EXIT_FAILURE);
+    }
+    compile_atom(ctx, &datum->val.atom_val);
+    return;
+  }
+  if (datum->type != S_TYPE_LIST) {
+    fprintf(stderr, "Compilation error: Invalid quoted expression.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct ExprVector *elements = &datum->val.list_val;
+  if (elements->len == 0) {
+    fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+    return;
+  }
+  int saved_offset = compile_value_array(ctx, elements->elements,
+                                         elements->len, compile_quote);
+  fprintf(ctx->gds->text_file, "  call lisp_list\n");
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+}
+
+// (vector-map op a b): op must name one of the arithmetic builtins, and is
+// resolved at compile time to the runtime's element-wise SIMD kernel.
+static void compile_vector_map(struct CompilerContext *ctx,
+                               struct ExprVector *vec) {
+  if (vec->len != 4 || vec->elements[1].type != S_TYPE_ATOM ||
+      vec->elements[1].val.atom_val.type != ATOM_TYPE_SYMBOL) {
+    fprintf(stderr, "Error: 'vector-map' expects an operator and two "
+                    "arguments.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const char *op_name = vec->elements[1].val.atom_val.value.symbol;
+  size_t num_ops = sizeof(vector_map_ops) / sizeof(vector_map_ops[0]);
+  size_t i = 0;
+  while (i < num_ops && strcmp(op_name, vector_map_ops[i].name) != 0) {
+    ++i;
+  }
+  if (i == num_ops) {
+    fprintf(stderr, "Error: 'vector-map' does not support operator '%s'.\n",
+            op_name);
+    exit(EXIT_FAILURE);
+  }
+
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  int slot = reserve_frame_slots(ctx, 1);
+  // The runtime only reads the number of a scalar operand
+  compile_temporary(ctx, &vec->elements[3]);
+  fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n", slot);
+  compile_expr(ctx, &vec->elements[2]);
+  fprintf(ctx->gds->text_file, "  mov rsi, rax\n");
+  fprintf(ctx->gds->text_file, "  mov rdx, [rbp - %d]\n", slot);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  fprintf(ctx->gds->text_file, "  mov rdi, %d\n", vector_map_ops[i].op);
+  fprintf(ctx->gds->text_file, "  call lisp_vector_map\n");
+}
+
+// --- Closures ---
+// A lambda's free variables are the names it refers to that resolve to
+// locals of the enclosing frames; globals are referred to directly. The code
+// of every lambda is compiled on its own, in a scope whose parent is the
+// global scope and where its free variables are either slots of its closure
+// record or, for lifted functions, extra parameters. Captured variables are
+// copied, so they cannot be assigned with set!.
+
+enum ClosureStrategy {
+  CLOSURE_HEAP,   // record allocated by lisp_make_closure
+  CLOSURE_STACK,  // record in the creating frame, which it never outlives
+  CLOSURE_LIFTED, // no record, only ever called directly
+};
+
+struct LambdaInfo {
+  const char *name; // NULL for anonymous lambdas
+  struct ExprVector *params;
+  size_t params_first;
+  struct ExprVector *body;
+  size_t body_first;
+  struct Expr *definition_node;
+
+  // Filled in by collect_captures, as resolved where the lambda is
+  struct NameList captures;
+  struct SymbolInfo **capture_infos;
+  struct NameList lifted_refs; // lifted functions called by the body
+  struct SymbolInfo **lifted_infos;
+};
+
+static void lambda_info_cleanup(struct LambdaInfo *lambda) {
+  name_list_cleanup(&lambda->captures);
+  name_list_cleanup(&lambda->lifted_refs);
+  free(lambda->capture_infos);
+  free(lambda->lifted_infos);
+}
+
+// Appends name to list and info to the array kept alongside it
+static void push_name_info(struct NameList *list, struct SymbolInfo ***infos,
+                           const char *name, struct SymbolInfo *info) {
+  name_list_push(list, name);
+  struct SymbolInfo **grown =
+      realloc(*infos, list->capacity * sizeof(struct SymbolInfo *));
+  if (!grown) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  grown[list->len - 1] = info;
+  *infos = grown;
+}
+
+static bool lambda_binds(struct LambdaInfo *lambda, const char *name) {
+  if (lambda->name && strcmp(lambda->name, name) == 0) {
+    return true;
+  }
+  for (size_t i = lambda->params_first; i < lambda->params->len; ++i) {
+    if (strcmp(lambda->params->elements[i].val.atom_val.value.symbol, name) ==
+        0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void add_capture(struct CompilerContext *ctx, struct LambdaInfo *lambda,
+                        struct SymbolInfo *info) {
+  if (name_list_contains(&lambda->captures, info->name)) {
+    return;
+  }
+  if (closure_is_assigned(info->name, ctx->toplevel_form)) {
+    fprintf(stderr,
+            "Error: Cannot capture '%s' in a closure, it is assigned with "
+            "'set!'.\n",
+            info->name);
+    exit(EXIT_FAILURE);
+  }
+  push_name_info(&lambda->captures, &lambda->capture_infos, info->name, info);
+}
+
+static void collect_captures(struct CompilerContext *ctx,
+                             struct LambdaInfo *lambda) {
+  for (size_t i = lambda->params_first; i < lambda->params->len; ++i) {
+    struct Expr *param = &lambda->params->elements[i];
+    if (param->type != S_TYPE_ATOM ||
+        param->val.atom_val.type != ATOM_TYPE_SYMBOL) {
+      fprintf(stderr, "Error: Parameter names must be symbols.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct NameList free_names = {0};
+  closure_free_names(lambda->params, lambda->params_first, lambda->name,
+                     lambda->body, lambda->body_first, &free_names);
+  for (size_t i = 0; i < free_names.len; ++i) {
+    struct SymbolInfo *info =
+        symbol_table_lookup(ctx->sym_table, free_names.names[i]);
+    if (!info) {
+      continue;
+    }
+    switch (info->kind) {
+    case SYM_LOCAL_VAR:
+    case SYM_FREE_VAR:
+      add_capture(ctx, lambda, info);
+      break;
+    case SYM_LIFTED_FUNC:
+      // Calling it takes its free variables, so capture those too
+      push_name_info(&lambda->lifted_refs, &lambda->lifted_infos, info->name,
+                     info);
+      for (size_t j = 0; j < info->location.lifted.num_vars; ++j) {
+        const char *var_name = info->location.lifted.var_names[j];
+        struct SymbolInfo *var_info =
+            symbol_table_lookup(ctx->sym_table, var_name);
+        if (!var_info ||
+            var_info->definition_node != info->location.lifted.var_nodes[j] ||
+            lambda_binds(lambda, var_name)) {
+          fprintf(stderr,
+                  "Error: '%s' uses '%s', which is shadowed where '%s' is "
+                  "called.\n",
+                  info->name, var_name, info->name);
+          exit(EXIT_FAILURE);
+        }
+        add_capture(ctx, lambda, var_info);
+      }
+      break;
+    case SYM_LOOP:
+      fprintf(stderr, "Error: Loop '%s' cannot be used inside a lambda.\n",
+              info->name);
+      exit(EXIT_FAILURE);
+    default:
+      break;
+    }
+  }
+  name_list_cleanup(&free_names);
+}
+
+static char *make_lambda_label(struct LambdaInfo *lambda) {
+  char prefix[48];
+  char label_buf[256];
+  snprintf(prefix, sizeof(prefix), "user_lambda_%d%s", new_label_id(),
+           lambda->name ? "_" : "");
+  sanitize_label(label_buf, sizeof(label_buf), prefix,
+                 lambda->name ? lambda->name : "");
+  return strdup(label_buf);
+}
+
+// Compiles the code of a lambda into the lambda section. Closure code gets
+// its record in rdi and the arguments after it; lifted code gets the
+// arguments followed by the free variables, and lifted_info is its symbol.
+static void compile_lambda_code(struct CompilerContext *ctx,
+                                struct LambdaInfo *lambda,
+                                enum ClosureStrategy strategy,
+                                const char *label,
+                                struct SymbolInfo *lifted_info) {
+  FILE *code = tmpfile();
+  if (!code) {
+    perror("tmpfile");
+    exit(EXIT_FAILURE);
+  }
+
+  FILE *outer_text_file = ctx->gds->text_file;
+  FILE *outer_func_file = ctx->gds->func_file;
+  int outer_high_water = ctx->frame_high_water;
+  struct Scope *outer_scope = ctx->sym_table->current_scope;
+  struct ExprVector *outer_body = ctx->current_body;
+  size_t outer_index = ctx->current_body_index;
+
+  ctx->gds->text_file = code;
+  ctx->gds->func_file = NULL;
+  ctx->frame_high_water = 0;
+  ctx->current_line = 0;
+  ctx->sym_table->current_scope = ctx->sym_table->global_scope;
+  symbol_table_enter_scope(ctx->sym_table);
+  ctx->sym_table->current_scope->current_stack_offset = 0;
+
+  fprintf(code, "\n; ---- Lambda: %s ----\n", label);
+  fprintf(code, "global %s:function (%s.end - %s)\n", label, label, label);
+  fprintf(code, "%s:\n", label);
+  emit_line_directive(ctx, code, lambda->definition_node->start_line);
+  fprintf(code, "  push rbp\n");
+  fprintf(code, "  mov rbp, rsp\n");
+  fprintf(code, "  sub rsp, %s.frame_size\n", label);
+
+  size_t next_register = 0;
+  int env_offset = 0;
+  if (strategy != CLOSURE_LIFTED) {
+    // The name cannot clash with a symbol, it contains a space
+    env_offset = define_local_var(ctx, " closure", NULL);
+    fprintf(code, "  mov [rbp - %d], rdi\n", env_offset);
+    next_register = 1;
+    if (lambda->name) {
+      int self_offset =
+          define_local_var(ctx, lambda->name, lambda->definition_node);
+      fprintf(code, "  mov [rbp - %d], rdi\n", self_offset);
+    }
+  } else {
+    symbol_table_define(ctx->sym_table, symbol_info_copy(lifted_info));
+  }
+
+  for (size_t i = lambda->params_first; i < lambda->params->len; ++i) {
+    struct Expr *param = &lambda->params->elements[i];
+    int stack_offset =
+        define_local_var(ctx, param->val.atom_val.value.symbol, param);
+    emit_store_param(code, next_register++, stack_offset);
+  }
+  for (size_t i = 0; i < lambda->captures.len; ++i) {
+    const char *name = lambda->captures.names[i];
+    struct Expr *node = lambda->capture_infos[i]->definition_node;
+    if (strategy == CLOSURE_LIFTED) {
+      int stack_offset = define_local_var(ctx, name, node);
+      emit_store_param(code, next_register++, stack_offset);
+    } else {
+      symbol_table_define(ctx->sym_table,
+                          symbol_make_free_var(name, env_offset, i, node));
+    }
+  }
+  for (size_t i = 0; i < lambda->lifted_refs.len; ++i) {
+    symbol_table_define(ctx->sym_table,
+                        symbol_info_copy(lambda->lifted_infos[i]));
+  }
+
+  compile_scope_body(ctx, lambda->body, lambda->body_first, false);
+
+  fprintf(code, "  mov rsp, rbp\n");
+  fprintf(code, "  pop rbp\n");
+  fprintf(code, "  ret\n");
+  fprintf(code, "%s.end:\n", label);
+  emit_frame_size(code, label, ctx->frame_high_water);
+
+  symbol_table_exit_scope(ctx->sym_table);
+  ctx->sym_table->current_scope = outer_scope;
+  ctx->gds->text_file = outer_text_file;
+  ctx->gds->func_file = outer_func_file;
+  ctx->frame_high_water = outer_high_water;
+  ctx->current_body = outer_body;
+  ctx->current_body_index = outer_index;
+  // The next line directive lands in the other section file
+  ctx->current_line = 0;
+
+  append_file(ctx->lambda_file, code);
+  fclose(code);
+}
+
+// Leaves a pointer to a new closure record for the compiled code in RAX
+static void emit_closure_record(struct CompilerContext *ctx,
+                                struct LambdaInfo *lambda, const char *label,
+                                enum ClosureStrategy strategy) {
+  FILE *out = ctx->gds->text_file;
+  size_t num_vars = lambda->captures.len;
+  fprintf(out, "\n  ; Closure %s over %zu variables\n", label, num_vars);
+
+  if (num_vars == 0) {
+    int label_id = new_label_id();
+    fprintf(ctx->gds->rodata_file, "align 8\n");
+    fprintf(ctx->gds->rodata_file, "L_closure_%d: dq %d, %s\n", label_id,
+            LVAL_FUNC, label);
+    fprintf(out, "  mov rax, L_closure_%d\n", label_id);
+    return;
+  }
+
+  if (strategy == CLOSURE_HEAP) {
+    fprintf(out, "  mov rdi, %s\n", label);
+    fprintf(out, "  mov rsi, %zu\n", num_vars);
+    fprintf(out, "  call lisp_make_closure\n");
+    for (size_t i = 0; i < num_vars; ++i) {
+      emit_load_var(ctx, lambda->capture_infos[i], "rcx");
+      fprintf(out, "  mov [rax + %zu], rcx\n",
+              LISPCLOSURE_VARS_OFFSET + i * 8);
+    }
+    return;
+  }
+
+  int base = reserve_frame_slots(ctx, 2 + num_vars);
+  fprintf(out, "  mov qword [rbp - %d], %d\n", base, LVAL_FUNC);
+  fprintf(out, "  mov rcx, %s\n", label);
+  fprintf(out, "  mov [rbp - %d], rcx\n", base - LISPCLOSURE_CODE_OFFSET);
+  for (size_t i = 0; i < num_vars; ++i) {
+    emit_load_var(ctx, lambda->capture_infos[i], "rcx");
+    fprintf(out, "  mov [rbp - %d], rcx\n",
+            base - LISPCLOSURE_VARS_OFFSET - (int)i * 8);
+  }
+  fprintf(out, "  lea rax, [rbp - %d]\n", base);
+}
+
+// (lambda (params...) body...)
+static void compile_lambda(struct CompilerContext *ctx, struct Expr *expr,
+                           bool noescape) {
+  if (!closure_is_lambda(expr)) {
+    fprintf(stderr, "Error: 'lambda' requires a parameter list and a body.\n");
+    exit(EXIT_FAILURE);
+  }
+  struct ExprVector *vec = &expr->val.list_val;
+  struct LambdaInfo lambda = {.params = &vec->elements[1].val.list_val,
+                              .body = vec,
+                              .body_first = 2,
+                              .definition_node = &vec->elements[0]};
+  collect_captures(ctx, &lambda);
+
+  enum ClosureStrategy strategy = noescape ? CLOSURE_STACK : CLOSURE_HEAP;
+  char *label = make_lambda_label(&lambda);
+  compile_lambda_code(ctx, &lambda, strategy, label, NULL);
+  emit_closure_record(ctx, &lambda, label, strategy);
+  free(label);
+  lambda_info_cleanup(&lambda);
+}
+
+// (future body...) runs body as a task of the runtime's scheduler, like
+// (spawn (lambda () body...)). The closure is always on the heap, since the
+// task may run on another thread after this frame is gone.
+static void compile_future(struct CompilerContext *ctx,
+                           struct ExprVector *vec) {
+  if (vec->len < 2) {
+    fprintf(stderr, "Error: 'future' requires a body.\n");
+    exit(EXIT_FAILURE);
+  }
+  struct ExprVector no_params = {0};
+  struct LambdaInfo lambda = {.params = &no_params,
+                              .body = vec,
+                              .body_first = 1,
+                              .definition_node = &vec->elements[0]};
+  collect_captures(ctx, &lambda);
+
+  char *label = make_lambda_label(&lambda);
+  compile_lambda_code(ctx, &lambda, CLOSURE_HEAP, label, NULL);
+  emit_closure_record(ctx, &lambda, label, CLOSURE_HEAP);
+  free(label);
+  lambda_info_cleanup(&lambda);
+  fprintf(ctx->gds->text_file, "  mov rdi, rax\n");
+  fprintf(ctx->gds->text_file, "  call lisp_spawn\n");
+}
+
+// (define (name params...) body...) inside a body. A function that is only
+// ever called directly needs no record and is lifted to a global function
+// that takes its free variables as extra arguments; otherwise it is a
+// closure bound to a local, built on the stack if it never escapes.
+static void compile_define_nested(struct CompilerContext *ctx,
+                                  struct Expr *define_expr) {
+  struct ExprVector *vec = &define_expr->val.list_val;
+  struct ExprVector *sig_vec = &vec->elements[1].val.list_val;
+  struct Expr *name_expr = &sig_vec->elements[0];
+  if (sig_vec->len == 0 || name_expr->type != S_TYPE_ATOM ||
+      name_expr->val.atom_val.type != ATOM_TYPE_SYMBOL) {
+    fprintf(stderr, "Error: Function name must be a symbol.\n");
+    exit(EXIT_FAILURE);
+  }
+  const char *name = name_expr->val.atom_val.value.symbol;
+  struct LambdaInfo lambda = {.name = name,
+                              .params = sig_vec,
+                              .params_first = 1,
+                              .body = vec,
+                              .body_first = 2,
+                              .definition_node = name_expr};
+  collect_captures(ctx, &lambda);
+
+  // Uses in its own body, then in the rest of the enclosing scope, which is
+  // only known when the define is a form of the body being compiled
+  unsigned int uses = closure_classify_uses(name, sig_vec, 1, vec, 2,
+                                            ctx->sym_table);
+  struct ExprVector *body = ctx->current_body;
+  if (body && ctx->current_body_index < body->len &&
+      &body->elements[ctx->current_body_index] == define_expr) {
+    uses |= closure_classify_uses(name, NULL, 0, body,
+                                  ctx->current_body_index + 1, ctx->sym_table);
+  } else {
+    uses |= CLOSURE_USE_ESCAPE;
+  }
+
+  size_t num_params = sig_vec->len - 1;
+  enum ClosureStrategy strategy = CLOSURE_HEAP;
+  if (!(uses & ~(CLOSURE_USE_CALL | CLOSURE_USE_CALL_IN_LAMBDA))) {
+    strategy = CLOSURE_LIFTED;
+  } else if (!(uses & ~(CLOSURE_USE_CALL | CLOSURE_USE_NOESCAPE_ARG))) {
+    strategy = CLOSURE_STACK;
+  }
+
+  fprintf(ctx->gds->text_file, "\n  ; Nested function '%s' (%s)\n", name,
+          strategy == CLOSURE_LIFTED  ? "lifted"
+          : strategy == CLOSURE_STACK ? "stack closure"
+                                      : "heap closure");
+  char *label = make_lambda_label(&lambda);
+  if (strategy == CLOSURE_LIFTED) {
+    size_t num_vars = lambda.captures.len;
+    struct Expr **var_nodes = malloc((num_vars + 1) * sizeof(struct Expr *));
+    if (!var_nodes) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_vars; ++i) {
+      var_nodes[i] = lambda.capture_infos[i]->definition_node;
+    }
+    struct SymbolInfo *info = symbol_make_lifted_func(
+        name, label, num_params, num_vars, (char *const *)lambda.captures.names,
+        var_nodes, name_expr);
+    free(var_nodes);
+    symbol_table_define(ctx->sym_table, info);
+    compile_lambda_code(ctx, &lambda, strategy, label, info);
+  } else {
+    compile_lambda_code(ctx, &lambda, strategy, label, NULL);
+    emit_closure_record(ctx, &lambda, label, strategy);
+    int stack_offset = define_local_var(ctx, name, name_expr);
+    fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n", stack_offset);
+  }
+  fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+  free(label);
+  lambda_info_cleanup(&lambda);
+}
+
+// ((lambda (params...) body...) args...) binds the arguments like a let
+static void compile_lambda_application(struct CompilerContext *ctx,
+                                       struct ExprVector *vec, bool tail) {
+  struct ExprVector *lambda = &vec->elements[0].val.list_val;
+  struct ExprVector *params = &lambda->elements[1].val.list_val;
+  size_t num_args = vec->len - 1;
+  if (num_args != params->len) {
+    fprintf(stderr, "Error: Lambda expects %zu arguments, got %zu.\n",
+            params->len, num_args);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(ctx->gds->text_file, "\n  ; --- Immediate lambda application ---\n");
+  // Stored straight into the slots the parameters get, as in compile_bindings
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  reserve_frame_slots(ctx, num_args);
+  for (size_t i = 0; i < num_args; ++i) {
+    compile_expr(ctx, &vec->elements[i + 1]);
+    fprintf(ctx->gds->text_file, "  mov [rbp - %d], rax\n",
+            saved_offset + (int)(i + 1) * 8);
+  }
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  symbol_table_enter_scope(ctx->sym_table);
+  for (size_t i = 0; i < num_args; ++i) {
+    struct Expr *param = &params->elements[i];
+    if (param->type != S_TYPE_ATOM ||
+        param->val.atom_val.type != ATOM_TYPE_SYMBOL) {
+      fprintf(stderr, "Error: Parameter names must be symbols.\n");
+      exit(EXIT_FAILURE);
+    }
+    define_local_var(ctx, param->val.atom_val.value.symbol, param);
+  }
+  compile_scope_body(ctx, lambda, 2, tail);
+  symbol_table_exit_scope(ctx->sym_table);
+}
+
+// Calls a lifted function with its free variables, which are looked up by
+// name and must still be the variables it was defined with
+static void compile_lifted_call(struct CompilerContext *ctx,
+                                struct SymbolInfo *info,
+                                struct ExprVector *vec) {
+  size_t num_args = vec->len - 1;
+  size_t num_vars = info->location.lifted.num_vars;
+  if (num_args != info->location.lifted.num_params) {
+    fprintf(stderr, "Error: '%s' expects %zu arguments, got %zu.\n",
+            info->name, info->location.lifted.num_params, num_args);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(ctx->gds->text_file, "\n  ; --- Call to lifted '%s' ---\n",
+          info->name);
+  struct CallArg *args =
+      malloc((num_args + num_vars + 1) * sizeof(struct CallArg));
+  if (!args) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  evaluate_call_args(ctx, &vec->elements[1], num_args, 0, true, true, args);
+  for (size_t i = 0; i < num_vars; ++i) {
+    const char *var_name = info->location.lifted.var_names[i];
+    struct SymbolInfo *var_info = symbol_table_lookup(ctx->sym_table, var_name);
+    if (!var_info ||
+        var_info->definition_node != info->location.lifted.var_nodes[i] ||
+        (var_info->kind != SYM_LOCAL_VAR && var_info->kind != SYM_FREE_VAR)) {
+      fprintf(stderr,
+              "Error: '%s' uses '%s', which is shadowed where '%s' is "
+              "called.\n",
+              info->name, var_name, info->name);
+      exit(EXIT_FAILURE);
+    }
+    args[num_args + i].kind = ARG_VAR;
+    args[num_args + i].var = var_info;
+  }
+  size_t stack_bytes = place_call_args(ctx, args, num_args + num_vars, 0);
+  emit_call(ctx, info->location.lifted.asm_label, stack_bytes);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  free(args);
+}
+
+// Calls whatever the head evaluates to, which must be a closure record
+static void compile_closure_call(struct CompilerContext *ctx,
+                                 struct ExprVector *vec) {
+  size_t num_args = vec->len - 1;
+  struct CallArg *args = malloc((num_args + 1) * sizeof(struct CallArg));
+  if (!args) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(ctx->gds->text_file, "\n  ; --- Closure call ---\n");
+  // The arguments are evaluated before the head, so none can be deferred
+  int saved_offset = ctx->sym_table->current_scope->current_stack_offset;
+  evaluate_call_args(ctx, &vec->elements[1], num_args, 0, false, false, args);
+  compile_expr(ctx, &vec->elements[0]);
+
+  int label_id = new_label_id();
+  fprintf(ctx->gds->text_file, "  cmp dword [rax], %d\n", LVAL_FUNC);
+  fprintf(ctx->gds->text_file, "  je L_call_%d\n", label_id);
+  fprintf(ctx->gds->text_file, "  mov rdi, rax\n");
+  fprintf(ctx->gds->text_file, "  call lisp_error_not_procedure\n");
+  fprintf(ctx->gds->text_file, "L_call_%d:\n", label_id);
+  fprintf(ctx->gds->text_file, "  mov rdi, rax\n");
+  size_t stack_bytes = place_call_args(ctx, args, num_args, 1);
+  char target[32];
+  snprintf(target, sizeof(target), "qword [rdi + %d]",
+           LISPCLOSURE_CODE_OFFSET);
+  emit_call(ctx, target, stack_bytes);
+  ctx->sym_table->current_scope->current_stack_offset = saved_offset;
+  free(args);
+}
+
+static void compile_list(struct CompilerContext *ctx, struct Expr *list_expr) {
+  struct ExprVector *vec = &list_expr->val.list_val;
+  bool tail = ctx->tail_position;
+  bool noescape = ctx->noescape;
+  ctx->tail_position = false;
+  ctx->noescape = false;
+
+  if (vec->len == 0) {
+    fprintf(ctx->gds->text_file, "\n  ; Load '() -> nil value\n");
+    fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+    return;
+  }
+
+  struct Expr *first = &vec->elements[0];
+  if (first->type == S_TYPE_LIST) {
+    if (closure_is_lambda(first)) {
+      compile_lambda_application(ctx, vec, tail);
+    } else {
+      compile_closure_call(ctx, vec);
+    }
+    return;
+  }
+  if (first->type != S_TYPE_ATOM ||
+      first->val.atom_val.type != ATOM_TYPE_SYMBOL) {
+    fprintf(stderr, "Error: Expression starting with a non-symbol.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const char *op_name = first->val.atom_val.value.symbol;
+  struct SymbolInfo *op_info = symbol_table_lookup(ctx->sym_table, op_name);
+
+  if (!op_info) {
+    fprintf(stderr, "Error: Undefined operator '%s'\n", op_name);
+    exit(EXIT_FAILURE);
+  }
+
+  if (op_info->kind == SYM_SPECIAL_FORM) {
+    if (strcmp(op_name, "define") == 0) {
+      if (vec->len < 3) {
+        fprintf(stderr, "Error: Invalid 'define' syntax. Too few parts.\n");
+        exit(EXIT_FAILURE);
       }
 
       struct Expr *name_part = &vec->elements[1];
@@ -420,32 +2470,37 @@ static void compile_list(struct CompilerContext *ctx, struct Expr *list_expr) {
         char *symbol_name = name_part->val.atom_val.value.symbol;
 
         if (ctx->sym_table->current_scope == ctx->sym_table->global_scope) {
-          compile_expr(ctx, &vec->elements[2]);
-          fprintf(ctx->gds->text_file, "  push rax\n");
+          // A constant initializer is laid out by the assembler, so the
+          // define costs nothing at startup
+          char initial[256];
+          bool is_static = static_initializer(ctx, &vec->elements[2], initial,
+                                              sizeof(initial));
+          if (!is_static) {
+            compile_expr(ctx, &vec->elements[2]);
+            snprintf(initial, sizeof(initial), "0");
+          }
 
           FILE *data = ctx->gds->data_file;
           char label_buf[256];
           sanitize_label(label_buf, sizeof(label_buf), "G_", symbol_name);
           char *label_name = strdup(label_buf);
-          fprintf(data, "%s: dq 0\n", label_name);
+          fprintf(data, "%s: dq %s\n", label_name, initial);
 
           struct SymbolInfo *info =
               symbol_make_global_var(symbol_name, label_name, name_part);
           symbol_table_define(ctx->sym_table, info);
           free(label_name);
 
-          fprintf(ctx->gds->text_file, "  pop rbx\n");
-          fprintf(ctx->gds->text_file, "  mov [%s], rbx\n",
-                  info->location.global_asm_label);
-          fprintf(ctx->gds->text_file, "  mov rax, rbx\n");
+          if (!is_static) {
+            fprintf(ctx->gds->text_file, "  mov [%s], rax\n",
+                    info->location.global_asm_label);
+          }
         } else {
           fprintf(ctx->gds->text_file, "\n  ; Local define for '%s'\n",
                   symbol_name);
           compile_expr(ctx, &vec->elements[2]);
 
-          struct SymbolInfo *info =
-              symbol_make_local_var(symbol_name, 0, name_part);
-          int stack_offset = symbol_table_define(ctx->sym_table, info);
+          int stack_offset = define_local_var(ctx, symbol_name, name_part);
 
           fprintf(ctx->gds->text_file,
                   "  mov [rbp - %d], rax ; move result from rax into "
@@ -455,8 +2510,12 @@ static void compile_list(struct CompilerContext *ctx, struct Expr *list_expr) {
           fprintf(ctx->gds->text_file, "  mov rax, 0 ; Result of "
                                        "define is undefined\n");
         }
+      } else if (name_part->type == S_TYPE_LIST &&
+                 ctx->sym_table->current_scope !=
+                     ctx->sym_table->global_scope) {
+        compile_define_nested(ctx, list_expr);
       } else if (name_part->type == S_TYPE_LIST) {
-        compile_define_function(ctx, vec);
+        compile_define_function(ctx, vec, false);
         fprintf(ctx->gds->text_file,
                 "  ; Set RAX to a placeholder for function definition\n");
         fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
@@ -465,47 +2524,54 @@ static void compile_list(struct CompilerContext *ctx, struct Expr *list_expr) {
                         "element must be a symbol or a list.\n");
         exit(EXIT_FAILURE);
       }
-    } else if (strcmp(op_name, "if") == 0) {
-      if (vec->len < 3 || vec->len > 4) {
-        fprintf(stderr,
-                "Error: 'if' special form requires 2 or 3 arguments, but got "
-                "%zu.\n",
-                vec->len - 1);
+    } else if (strcmp(op_name, "define-memo") == 0) {
+      if (vec->len < 3 || vec->elements[1].type != S_TYPE_LIST ||
+          vec->elements[1].val.list_val.len == 0) {
+        fprintf(stderr, "Error: 'define-memo' requires a signature and a "
+                        "body.\n");
         exit(EXIT_FAILURE);
       }
-
-      int else_label_id = new_label_id();
-      int end_if_label_id = new_label_id();
-
-      fprintf(ctx->gds->text_file, "\n  ; --- IF Statement ---\n");
-      fprintf(ctx->gds->text_file, "  ; Compile condition\n");
-      compile_expr(ctx, &vec->elements[1]);
-
-      fprintf(ctx->gds->text_file, "  ; Check if condition is false (#f)\n");
-      fprintf(ctx->gds->text_file, "  cmp rax, G_LISP_NIL\n");
-      fprintf(ctx->gds->text_file, "  je L_if_else_%d\n", else_label_id);
-
-      // --- Then branch ---
-      fprintf(ctx->gds->text_file, "\n  ; Then branch\n");
-      compile_expr(ctx, &vec->elements[2]);
-      fprintf(ctx->gds->text_file, "  jmp L_if_end_%d\n", end_if_label_id);
-
-      // --- Else branch ---
-      fprintf(ctx->gds->text_file, "\nL_if_else_%d:\n", else_label_id);
-      if (vec->len == 4) {
-        fprintf(ctx->gds->text_file, "  ; Else branch\n");
-        compile_expr(ctx, &vec->elements[3]);
-      } else {
-        fprintf(ctx->gds->text_file, "  ; No else branch, result is #f\n");
-        fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+      if (ctx->sym_table->current_scope != ctx->sym_table->global_scope) {
+        fprintf(stderr, "Error: 'define-memo' is only allowed at top level.\n");
+        exit(EXIT_FAILURE);
       }
-
-      fprintf(ctx->gds->text_file, "\nL_if_end_%d:\n", end_if_label_id);
-      fprintf(ctx->gds->text_file, "  ; --- End IF Statement ---\n");
+      compile_define_function(ctx, vec, true);
+      fprintf(ctx->gds->text_file, "  mov rax, G_LISP_NIL\n");
+    } else if (strcmp(op_name, "if") == 0) {
+      compile_if(ctx, list_expr, tail);
+    } else if (strcmp(op_name, "set!") == 0) {
+      compile_set(ctx, vec);
+    } else if (strcmp(op_name, "while") == 0) {
+      compile_while(ctx, vec);
+    } else if (strcmp(op_name, "do") == 0) {
+      compile_do(ctx, vec);
+    } else if (strcmp(op_name, "let") == 0) {
+      ctx->tail_position = tail;
+      compile_let(ctx, list_expr);
+    } else if (strcmp(op_name, "quote") == 0) {
+      if (vec->len != 2) {
+        fprintf(stderr, "Error: 'quote' requires exactly 1 argument.\n");
+        exit(EXIT_FAILURE);
+      }
+      compile_quote(ctx, &vec->elements[1]);
+    } else if (strcmp(op_name, "vector-map") == 0) {
+      compile_vector_map(ctx, vec);
+    } else if (strcmp(op_name, "lambda") == 0) {
+      compile_lambda(ctx, list_expr, noescape);
+    } else if (strcmp(op_name, "future") == 0) {
+      compile_future(ctx, vec);
     }
+  } else if (op_info->kind == SYM_LOOP) {
+    ctx->tail_position = tail;
+    compile_loop_jump(ctx, op_info, vec);
   } else if (op_info->kind == SYM_BUILTIN_FUNC ||
              op_info->kind == SYM_USER_FUNC) {
     compile_function_call(ctx, op_info, vec);
+  } else if (op_info->kind == SYM_LIFTED_FUNC) {
+    compile_lifted_call(ctx, op_info, vec);
+  } else if (op_info->kind == SYM_LOCAL_VAR || op_info->kind == SYM_FREE_VAR ||
+             op_info->kind == SYM_GLOBAL_VAR) {
+    compile_closure_call(ctx, vec);
   } else {
     fprintf(stderr, "Error: Cannot call non-function '%s'.\n", op_name);
     exit(EXIT_FAILURE);
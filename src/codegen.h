@@ -2,13 +2,65 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 #include "expr.h"
+#include <stdbool.h>
 #include <stdio.h>
 
+struct CompileOptions
+{
+  // Emit NASM %line directives mapping the generated code back to
+  // source_filename, so `nasm -g -F dwarf` produces .debug_line for it.
+  bool debug_lines;
+  const char *source_filename;
+  // Count function entries and if branches, and write the counts at exit
+  // to profile_output (see LispPgoCounter).
+  bool profile_generate;
+  const char *profile_output;
+  // Counts from a --profile-generate run, or NULL: the more often taken
+  // branch of each if falls through, the call graph is weighed by how often
+  // functions are entered, and functions never entered go to .text.unlikely.
+  const struct Profile *profile;
+  // Keep global functions in source order instead of laying them out along
+  // the call graph (see callgraph_layout).
+  bool source_order_functions;
+};
+
+struct CompiledFunction;
+
 struct CompilerContext
 {
   struct SymbolTable *sym_table;
   struct GlobalDataSections *gds;
+  struct CompileOptions options;
+  size_t current_line; // last line emitted with %line, 0 if none
+  int frame_high_water; // deepest [rbp - N] slot used by the current frame
+  bool tail_position;   // next list compiled is in tail position of a loop
+  // Label id of the outermost loop whose tail position extends to the
+  // current one: loops entered in tail position of it, and only those, get
+  // higher ids
+  int tail_loop_id;
+  struct SymbolMap *string_literals; // literal text -> its .rodata label
+  struct SymbolMap *static_numbers;  // bits of a double -> its .rodata label
+  bool noescape; // next lambda compiled never outlives the current frame
+  FILE *lambda_file; // code of every lambda, appended to the func section
+  struct Expr *toplevel_form;       // form of the program being compiled
+  struct ExprVector *current_body;  // body making up the rest of the scope
+  size_t current_body_index;        // form of current_body being compiled
+  int last_pgo_counter; // label id of the newest LispPgoCounter, -1 if none
+  // Global functions in source order, written to the func section once all
+  // are compiled
+  struct CompiledFunction *functions;
+  size_t num_functions;
+  size_t functions_capacity;
 };
 
-void compile_program (struct ExprVector *program, const char *output_filename);
+struct GlobalDataSections;
+
+// Compiles the program into already opened section files; the caller owns
+// gds and is responsible for gds_close_and_finalize.
+// options may be NULL for the defaults.
+void compile_to_sections (struct ExprVector *program,
+                          struct GlobalDataSections *gds,
+                          const struct CompileOptions *options);
+void compile_program (struct ExprVector *program, const char *output_filename,
+                      const struct CompileOptions *options);
 #endif
\ No newline at end of file
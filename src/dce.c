@@ -0,0 +1,225 @@
+#include "dce.h"
+#include "closure.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Builtins whose calls have an effect besides their result
+static const char *impure_builtins[] = {"display", "print", "newline",
+                                        "vector-set!"};
+
+#define NUM_IMPURE_BUILTINS                                                    \
+  (sizeof(impure_builtins) / sizeof(impure_builtins[0]))
+
+struct Definition {
+  const char *name;
+  size_t index; // in the program
+  bool function;
+  bool impure;
+  bool live;
+  struct NameList refs; // free names of the function body or initializer
+};
+
+struct Dce {
+  struct ExprVector *program;
+  struct Definition *defs; // sorted by name, then index
+  size_t num_defs;
+  struct NameList pending; // names reached but not marked yet
+};
+
+static bool is_symbol(const struct Expr *expr) {
+  return expr->type == S_TYPE_ATOM &&
+         expr->val.atom_val.type == ATOM_TYPE_SYMBOL;
+}
+
+// The name defined by a well-formed top-level define or define-memo, or NULL
+static const char *defined_name(const struct Expr *form, bool *function) {
+  if (form->type != S_TYPE_LIST || form->val.list_val.len < 3 ||
+      !is_symbol(&form->val.list_val.elements[0])) {
+    return NULL;
+  }
+  const char *op = form->val.list_val.elements[0].val.atom_val.value.symbol;
+  if (strcmp(op, "define") != 0 && strcmp(op, "define-memo") != 0) {
+    return NULL;
+  }
+  const struct Expr *target = &form->val.list_val.elements[1];
+  *function = target->type == S_TYPE_LIST;
+  if (*function) {
+    if (target->val.list_val.len == 0 ||
+        !is_symbol(&target->val.list_val.elements[0])) {
+      return NULL;
+    }
+    target = &target->val.list_val.elements[0];
+  } else if (!is_symbol(target)) {
+    return NULL;
+  }
+  return target->val.atom_val.value.symbol;
+}
+
+static int compare_definitions(const void *a, const void *b) {
+  const struct Definition *da = a;
+  const struct Definition *db = b;
+  int c = strcmp(da->name, db->name);
+  if (c != 0) {
+    return c;
+  }
+  return da->index < db->index ? -1 : da->index > db->index;
+}
+
+static int compare_name(const void *key, const void *def) {
+  return strcmp(key, ((const struct Definition *)def)->name);
+}
+
+// The defines of name are adjacent in defs; sets *count to how many there are
+static struct Definition *find_definitions(struct Dce *dce, const char *name,
+                                           size_t *count) {
+  struct Definition *def = bsearch(name, dce->defs, dce->num_defs,
+                                   sizeof(struct Definition), compare_name);
+  *count = 0;
+  if (!def) {
+    return NULL;
+  }
+  while (def > dce->defs && strcmp(def[-1].name, name) == 0) {
+    def--;
+  }
+  while (def + *count < dce->defs + dce->num_defs &&
+         strcmp(def[*count].name, name) == 0) {
+    (*count)++;
+  }
+  return def;
+}
+
+static bool references_impure(struct Dce *dce, const struct Definition *def) {
+  const struct Expr *form = &dce->program->elements[def->index];
+  for (size_t i = 0; i < def->refs.len; ++i) {
+    const char *name = def->refs.names[i];
+    for (size_t b = 0; b < NUM_IMPURE_BUILTINS; ++b) {
+      if (strcmp(name, impure_builtins[b]) == 0) {
+        return true;
+      }
+    }
+    // A free name that is assigned is a global
+    if (closure_is_assigned(name, form)) {
+      return true;
+    }
+    size_t count;
+    struct Definition *defs = find_definitions(dce, name, &count);
+    for (size_t d = 0; d < count; ++d) {
+      if (defs[d].impure) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void push_refs(struct Dce *dce, const struct NameList *refs) {
+  for (size_t i = 0; i < refs->len; ++i) {
+    name_list_push(&dce->pending, refs->names[i]);
+  }
+}
+
+static void mark_live(struct Dce *dce, struct Definition *def) {
+  if (!def->live) {
+    def->live = true;
+    push_refs(dce, &def->refs);
+  }
+}
+
+void dce_program(struct ExprVector *program, struct DceStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  struct Dce dce = {.program = program};
+  dce.defs = calloc(program->len ? program->len : 1, sizeof(*dce.defs));
+  bool *keep = calloc(program->len ? program->len : 1, sizeof(bool));
+  if (!dce.defs || !keep) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < program->len; ++i) {
+    bool function;
+    const char *name = defined_name(&program->elements[i], &function);
+    if (!name) {
+      continue;
+    }
+    struct Definition *def = &dce.defs[dce.num_defs++];
+    def->name = name;
+    def->index = i;
+    def->function = function;
+    const struct ExprVector *vec = &program->elements[i].val.list_val;
+    bool memo = strcmp(vec->elements[0].val.atom_val.value.symbol,
+                       "define-memo") == 0;
+    closure_free_names(function ? &vec->elements[1].val.list_val : NULL, 1,
+                       NULL, vec, memo ? closure_memo_body_first(vec) : 2,
+                       &def->refs);
+  }
+  qsort(dce.defs, dce.num_defs, sizeof(struct Definition),
+        compare_definitions);
+
+  // Impurity spreads from the builtins to whatever refers to them, through
+  // any number of functions and globals
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < dce.num_defs; ++i) {
+      if (!dce.defs[i].impure && references_impure(&dce, &dce.defs[i])) {
+        dce.defs[i].impure = true;
+        changed = true;
+      }
+    }
+  }
+
+  // Roots: top-level expressions and globals with impure initializers
+  for (size_t i = 0; i < program->len; ++i) {
+    bool function;
+    if (!defined_name(&program->elements[i], &function)) {
+      struct ExprVector form = {.elements = &program->elements[i], .len = 1};
+      struct NameList refs = {0};
+      closure_free_names(NULL, 0, NULL, &form, 0, &refs);
+      push_refs(&dce, &refs);
+      name_list_cleanup(&refs);
+      keep[i] = true;
+    }
+  }
+  for (size_t i = 0; i < dce.num_defs; ++i) {
+    if (!dce.defs[i].function && dce.defs[i].impure) {
+      mark_live(&dce, &dce.defs[i]);
+    }
+  }
+  while (dce.pending.len > 0) {
+    const char *name = dce.pending.names[--dce.pending.len];
+    size_t count;
+    struct Definition *defs = find_definitions(&dce, name, &count);
+    for (size_t d = 0; d < count; ++d) {
+      mark_live(&dce, &defs[d]);
+    }
+  }
+
+  for (size_t i = 0; i < dce.num_defs; ++i) {
+    struct Definition *def = &dce.defs[i];
+    if (def->live) {
+      keep[def->index] = true;
+    } else if (def->function) {
+      stats->functions_removed++;
+    } else {
+      stats->globals_removed++;
+    }
+    name_list_cleanup(&def->refs);
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < program->len; ++i) {
+    if (keep[i]) {
+      program->elements[kept++] = program->elements[i];
+    } else {
+      expr_cleanup(&program->elements[i]);
+    }
+  }
+  program->len = kept;
+
+  free(keep);
+  free(dce.defs);
+  name_list_cleanup(&dce.pending);
+}
@@ -0,0 +1,23 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "expr.h"
+#include <stddef.h>
+
+// Counters for --stats.
+struct DceStats
+{
+  size_t functions_removed; // function defines that nothing reaches
+  size_t globals_removed;   // unreferenced globals with a pure initializer
+};
+
+// Removes the top-level defines that the program's side effects do not
+// reach. The roots are every top-level form that is not a define and every
+// global whose initializer may have a side effect (output, vector-set! or
+// set! on a global, directly or through the functions it refers to).
+// Everything they refer to is kept, transitively. The forms of the defines
+// that are removed are never compiled, so their functions, data slots and
+// literals are not emitted at all.
+void dce_program (struct ExprVector *program, struct DceStats *stats);
+
+#endif
@@ -0,0 +1,271 @@
+#include "document.h"
+#include "parser.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void reserve_source(struct SourceDocument *doc, size_t len) {
+  if (len + 1 <= doc->capacity) {
+    return;
+  }
+  size_t capacity = doc->capacity ? doc->capacity : 256;
+  while (capacity < len + 1) {
+    capacity *= 2;
+  }
+  char *source = realloc(doc->source, capacity);
+  if (!source) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  doc->source = source;
+  doc->capacity = capacity;
+}
+
+// Room for count forms in program and spans
+static void reserve_forms(struct SourceDocument *doc, size_t count) {
+  // exprvector_append wants a free element past the last
+  if (count + 1 > doc->program.capacity) {
+    size_t capacity = doc->program.capacity;
+    while (capacity < count + 1) {
+      capacity *= 2;
+    }
+    struct Expr *elements =
+        realloc(doc->program.elements, capacity * sizeof(struct Expr));
+    if (!elements) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    doc->program.elements = elements;
+    doc->program.capacity = capacity;
+  }
+  if (count > doc->spans_capacity) {
+    size_t capacity = doc->spans_capacity ? doc->spans_capacity : 8;
+    while (capacity < count) {
+      capacity *= 2;
+    }
+    struct FormSpan *spans =
+        realloc(doc->spans, capacity * sizeof(struct FormSpan));
+    if (!spans) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    doc->spans = spans;
+    doc->spans_capacity = capacity;
+  }
+}
+
+static void shift_position(size_t *line, size_t *col, size_t old_line,
+                           long line_delta, long col_delta) {
+  if (*line == old_line) {
+    *col = (size_t)((long)*col + col_delta);
+  }
+  *line = (size_t)((long)*line + line_delta);
+}
+
+static void shift_expr(struct Expr *expr, size_t old_line, long line_delta,
+                       long col_delta) {
+  shift_position(&expr->start_line, &expr->start_col, old_line, line_delta,
+                 col_delta);
+  shift_position(&expr->end_line, &expr->end_col, old_line, line_delta,
+                 col_delta);
+  if (expr->type == S_TYPE_LIST) {
+    for (size_t i = 0; i < expr->val.list_val.len; ++i) {
+      shift_expr(&expr->val.list_val.elements[i], old_line, line_delta,
+                 col_delta);
+    }
+  }
+}
+
+// Moves forms [from, len) along with their text, which moved by inserted -
+// removed bytes and, from what was old_line, by the given lines and columns
+static void shift_forms(struct SourceDocument *doc, size_t from,
+                        size_t removed, size_t inserted, size_t old_line,
+                        long line_delta, long col_delta) {
+  bool positions_moved = line_delta != 0 || col_delta != 0;
+  for (size_t i = from; i < doc->program.len; ++i) {
+    struct FormSpan *span = &doc->spans[i];
+    span->start = span->start - removed + inserted;
+    span->end = span->end - removed + inserted;
+    // Within a line, only the forms on old_line move
+    if (!positions_moved || (line_delta == 0 && span->start_line > old_line)) {
+      continue;
+    }
+    shift_position(&span->start_line, &span->start_col, old_line, line_delta,
+                   col_delta);
+    shift_position(&span->end_line, &span->end_col, old_line, line_delta,
+                   col_delta);
+    shift_expr(&doc->program.elements[i], old_line, line_delta, col_delta);
+  }
+}
+
+// Parses the text from the end of form first - 1 on, replacing the old
+// forms up to the first one whose start the parse reaches. The edit ended
+// at edit_end in the old text and replaced removed bytes with inserted ones;
+// old forms that start before edit_end are never reused.
+static struct DocumentChange reparse(struct SourceDocument *doc, size_t first,
+                                     size_t edit_end, size_t removed,
+                                     size_t inserted) {
+  size_t pos = 0;
+  size_t line = 1;
+  size_t col = 1;
+  if (first > 0) {
+    pos = doc->spans[first - 1].end;
+    line = doc->spans[first - 1].end_line;
+    col = doc->spans[first - 1].end_col;
+  }
+  struct ParserContext parser =
+      parser_make_at(doc->source, (int)pos, (int)line, (int)col);
+  parser.recover = true;
+  struct ExprVector forms = exprvector_create();
+  struct FormSpan *spans = NULL;
+  size_t spans_capacity = 0;
+  size_t next = first; // the old form that parsing may resume at
+  bool resumed = false;
+  while (true) {
+    parser_skip_whitespace_and_comments(&parser);
+    size_t start = (size_t)parser.token_pos;
+    while (next < doc->program.len &&
+           (doc->spans[next].start < edit_end ||
+            doc->spans[next].start - removed + inserted < start)) {
+      next++;
+    }
+    if (parser.current_token.type == TOKEN_EOF) {
+      break;
+    }
+    if (next < doc->program.len &&
+        doc->spans[next].start - removed + inserted == start) {
+      resumed = true;
+      break;
+    }
+
+    size_t start_line = parser.current_token.start_line;
+    size_t start_col = parser.current_token.start_col;
+    parser.error = NULL;
+    struct Expr e = parse_expr(&parser);
+    if (parser.error) {
+      expr_cleanup(&e);
+      e = (struct Expr){.type = S_TYPE_ERROR,
+                        .val.error_msg = parser.error,
+                        .start_line = start_line,
+                        .start_col = start_col,
+                        .end_line = parser.current_token.start_line,
+                        .end_col = parser.current_token.start_col};
+    }
+    if (forms.len == spans_capacity) {
+      spans_capacity = spans_capacity ? spans_capacity * 2 : 8;
+      spans = realloc(spans, spans_capacity * sizeof(struct FormSpan));
+      if (!spans) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    spans[forms.len] = (struct FormSpan){.start = start,
+                                         .end = (size_t)parser.token_pos,
+                                         .start_line = start_line,
+                                         .start_col = start_col,
+                                         .end_line =
+                                             parser.current_token.start_line,
+                                         .end_col =
+                                             parser.current_token.start_col};
+    exprvector_append(&forms, e);
+  }
+
+  size_t old_line = 0;
+  long line_delta = 0;
+  long col_delta = 0;
+  if (resumed) {
+    const struct FormSpan *old = &doc->spans[next];
+    old_line = old->start_line;
+    line_delta = (long)parser.current_token.start_line - (long)old->start_line;
+    col_delta = (long)parser.current_token.start_col - (long)old->start_col;
+  } else {
+    next = doc->program.len;
+  }
+  token_cleanup(&parser.current_token);
+  parser_cleanup(&parser);
+
+  struct DocumentChange change = {
+      .first = first, .old_count = next - first, .new_count = forms.len};
+  size_t tail = doc->program.len - next;
+  reserve_forms(doc, first + forms.len + tail);
+  for (size_t i = first; i < next; ++i) {
+    if (doc->program.elements[i].type == S_TYPE_ERROR) {
+      doc->num_errors--;
+    }
+    expr_cleanup(&doc->program.elements[i]);
+  }
+  for (size_t i = 0; i < forms.len; ++i) {
+    if (forms.elements[i].type == S_TYPE_ERROR) {
+      doc->num_errors++;
+    }
+  }
+  if (tail > 0) {
+    memmove(&doc->program.elements[first + forms.len],
+            &doc->program.elements[next], tail * sizeof(struct Expr));
+    memmove(&doc->spans[first + forms.len], &doc->spans[next],
+            tail * sizeof(struct FormSpan));
+  }
+  if (forms.len > 0) {
+    memcpy(&doc->program.elements[first], forms.elements,
+           forms.len * sizeof(struct Expr));
+    memcpy(&doc->spans[first], spans, forms.len * sizeof(struct FormSpan));
+  }
+  doc->program.len = first + forms.len + tail;
+  free(forms.elements);
+  free(spans);
+
+  shift_forms(doc, first + forms.len, removed, inserted, old_line, line_delta,
+              col_delta);
+  return change;
+}
+
+void document_init(struct SourceDocument *doc, const char *source) {
+  *doc = (struct SourceDocument){.program = exprvector_create()};
+  doc->len = strlen(source);
+  reserve_source(doc, doc->len);
+  memcpy(doc->source, source, doc->len + 1);
+  reparse(doc, 0, 0, 0, 0);
+}
+
+struct DocumentChange document_edit(struct SourceDocument *doc,
+                                    const struct TextEdit *edit) {
+  if (edit->offset > doc->len || edit->removed > doc->len - edit->offset) {
+    fprintf(stderr, "Edit of %zu bytes at %zu is outside the %zu bytes\n",
+            edit->removed, edit->offset, doc->len);
+    exit(EXIT_FAILURE);
+  }
+
+  // The first form that ends at or after the edit; a form that ends right
+  // at it can run into the inserted text
+  size_t lo = 0;
+  size_t hi = doc->program.len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (doc->spans[mid].end < edit->offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  size_t edit_end = edit->offset + edit->removed;
+  size_t len = doc->len - edit->removed + edit->inserted_len;
+  reserve_source(doc, len);
+  memmove(doc->source + edit->offset + edit->inserted_len,
+          doc->source + edit_end, doc->len - edit_end + 1);
+  if (edit->inserted_len > 0) {
+    memcpy(doc->source + edit->offset, edit->inserted, edit->inserted_len);
+  }
+  doc->len = len;
+
+  return reparse(doc, lo, edit_end, edit->removed, edit->inserted_len);
+}
+
+void document_cleanup(struct SourceDocument *doc) {
+  exprvector_cleanup(&doc->program);
+  free(doc->spans);
+  free(doc->source);
+  *doc = (struct SourceDocument){0};
+}
@@ -0,0 +1,71 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "expr.h"
+#include <stddef.h>
+
+// Where a top-level form lies in the text: bytes [start, end), and the line
+// and column of its first token and of end, where the lexer picks up after
+// the form.
+struct FormSpan
+{
+  size_t start;
+  size_t end;
+  size_t start_line;
+  size_t start_col;
+  size_t end_line;
+  size_t end_col;
+};
+
+// Source text kept together with its parse, for tools that reparse it on
+// every keystroke. program and spans always equal what parse_program makes
+// of source, except that half-typed text does not exit: a top-level form
+// with a syntax error is an S_TYPE_ERROR form carrying the first error's
+// message and ending where the parser stopped.
+struct SourceDocument
+{
+  char *source; // NUL-terminated
+  size_t len;
+  size_t capacity;
+  struct ExprVector program;
+  struct FormSpan *spans; // one per top-level form of program
+  size_t spans_capacity;
+  size_t num_errors; // S_TYPE_ERROR forms in program
+};
+
+// Replaces bytes [offset, offset + removed) of the text with inserted_len
+// bytes from inserted.
+struct TextEdit
+{
+  size_t offset;
+  size_t removed;
+  const char *inserted;
+  size_t inserted_len;
+};
+
+// Forms [first, first + old_count) of the program were replaced by the
+// new_count forms now at first. The forms after them are the ones that
+// were there before, moved along.
+struct DocumentChange
+{
+  size_t first;
+  size_t old_count;
+  size_t new_count;
+};
+
+// Parses source (copied) into doc.
+void document_init (struct SourceDocument *doc, const char *source);
+
+// Applies edit to the text and reparses it incrementally: lexing restarts
+// after the last form that ends before the edit and stops at the first old
+// form that starts after it on a token boundary, from where the old forms
+// are reused with their positions shifted. Columns only need shifting on the
+// line the reuse starts on, and lines only if the edit adds or removes
+// newlines, so an edit within a line costs about as much as parsing the
+// forms it touches.
+struct DocumentChange document_edit (struct SourceDocument *doc,
+                                     const struct TextEdit *edit);
+
+void document_cleanup (struct SourceDocument *doc);
+
+#endif
@@ -107,6 +107,29 @@ void expr_cleanup(struct Expr *e) {
   }
 }
 
+// Deep copy, sharing nothing with e
+struct Expr expr_copy(const struct Expr *e) {
+  struct Expr copy = *e;
+  switch (e->type) {
+  case S_TYPE_ATOM:
+    if (e->val.atom_val.type == ATOM_TYPE_SYMBOL) {
+      copy.val.atom_val.value.symbol = strdup(e->val.atom_val.value.symbol);
+    } else if (e->val.atom_val.type == ATOM_TYPE_STRING) {
+      copy.val.atom_val.value.string = strdup(e->val.atom_val.value.string);
+    }
+    return copy;
+  case S_TYPE_LIST:
+    copy.val.list_val = exprvector_create();
+    for (size_t i = 0; i < e->val.list_val.len; ++i) {
+      exprvector_append(&copy.val.list_val,
+                        expr_copy(&e->val.list_val.elements[i]));
+    }
+    return copy;
+  default:
+    return copy;
+  }
+}
+
 struct ExprVector exprvector_create(void) {
   const size_t LIST_INITIAL_CAPACITY = 8;
   struct ExprVector e;
@@ -124,7 +147,8 @@ void exprvector_append(struct ExprVector *list, struct Expr expr) {
   if (list->len + 1 >= list->capacity) {
     int new_capacity = list->capacity * 2;
     struct Expr *new_elements =
-        (struct Expr *)realloc(list->elements, new_capacity);
+        (struct Expr *)realloc(list->elements,
+                                new_capacity * sizeof(struct Expr));
     if (new_elements == NULL) {
       printf("Failed to reallocate expression list\n");
       exit(EXIT_FAILURE);
@@ -141,6 +165,17 @@ void exprvector_cleanup(struct ExprVector *list) {
   free(list->elements);
 }
 
+size_t exprvector_count_nodes(const struct ExprVector *list) {
+  size_t count = 0;
+  for (size_t i = 0; i < list->len; i++) {
+    count++;
+    if (list->elements[i].type == S_TYPE_LIST) {
+      count += exprvector_count_nodes(&list->elements[i].val.list_val);
+    }
+  }
+  return count;
+}
+
 void print_indent(int depth) {
   for (int i = 0; i < depth; i++) {
     printf(" ");
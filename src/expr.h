@@ -64,10 +64,12 @@ struct Expr expr_atom_make (struct Token *token);
 struct Expr expr_list_make (struct ExprVector content, size_t start_line,
                             size_t start_col, size_t end_line, size_t end_col);
 void expr_cleanup (struct Expr *e);
+struct Expr expr_copy (const struct Expr *e);
 
 struct ExprVector exprvector_create (void);
 void exprvector_append (struct ExprVector *list, struct Expr expr);
 void exprvector_cleanup (struct ExprVector *list);
+size_t exprvector_count_nodes (const struct ExprVector *list);
 
 void print_atom (const struct Atom *atom);
 void print_exprvector (const struct ExprVector *list, int depth);
@@ -31,9 +31,10 @@ static int copy_file_content(FILE *dest, FILE *src) {
 
 static void append_and_cleanup_section(FILE *final_asm_file,
                                        const char *base_filename,
+                                       const char *temp_section,
                                        const char *section_name,
                                        FILE *section_file,
-                                       bool write_section_header) {
+                                       struct PeepholeStats *peephole) {
   if (!section_file) {
     return;
   }
@@ -42,12 +43,15 @@ static void append_and_cleanup_section(FILE *final_asm_file,
   long file_size = ftell(section_file);
 
   if (file_size > 0) {
-    if (write_section_header) {
+    if (section_name) {
       fprintf(final_asm_file, "\nsection .%s\n", section_name);
     }
-    if (copy_file_content(final_asm_file, section_file) != 0) {
-      fprintf(stderr, "Warning: Failed to copy content for section .%s\n",
-              section_name);
+    int status = peephole
+                     ? peephole_copy(final_asm_file, section_file, peephole)
+                     : copy_file_content(final_asm_file, section_file);
+    if (status != 0) {
+      fprintf(stderr, "Warning: Failed to copy content for section %s\n",
+              temp_section);
     }
   } else if (file_size == -1L) {
     perror("Warning: ftell failed on temporary file");
@@ -56,7 +60,8 @@ static void append_and_cleanup_section(FILE *final_asm_file,
   fclose(section_file);
 
   char temp_name[256];
-  make_temp_filename(temp_name, sizeof(temp_name), base_filename, section_name);
+  make_temp_filename(temp_name, sizeof(temp_name), base_filename,
+                     temp_section);
   remove(temp_name);
 }
 
@@ -113,6 +118,23 @@ struct GlobalDataSections *gds_create(const char *base_filename) {
   return gds;
 }
 
+static long section_size(FILE *section_file) {
+  if (!section_file) {
+    return 0;
+  }
+  fflush(section_file);
+  return ftell(section_file);
+}
+
+void gds_get_section_sizes(struct GlobalDataSections *gds,
+                           struct GdsSectionSizes *sizes) {
+  sizes->func = section_size(gds->func_file);
+  sizes->text = section_size(gds->text_file);
+  sizes->data = section_size(gds->data_file);
+  sizes->rodata = section_size(gds->rodata_file);
+  sizes->bss = section_size(gds->bss_file);
+}
+
 void gds_close_and_finalize(struct GlobalDataSections *gds_ctx) {
   if (!gds_ctx) {
     return;
@@ -128,17 +150,16 @@ void gds_close_and_finalize(struct GlobalDataSections *gds_ctx) {
     gds_destroy(gds_ctx);
     return;
   }
+  append_and_cleanup_section(final_asm_file, gds_ctx->base_filename, "func",
+                             "text", gds_ctx->func_file, gds_ctx->peephole);
   append_and_cleanup_section(final_asm_file, gds_ctx->base_filename, "text",
-                             gds_ctx->func_file, true);
-
-  append_and_cleanup_section(final_asm_file, gds_ctx->base_filename, "",
-                             gds_ctx->text_file, false);
+                             NULL, gds_ctx->text_file, gds_ctx->peephole);
   append_and_cleanup_section(final_asm_file, gds_ctx->base_filename, "rodata",
-                             gds_ctx->rodata_file, true);
+                             "rodata", gds_ctx->rodata_file, NULL);
   append_and_cleanup_section(final_asm_file, gds_ctx->base_filename, "data",
-                             gds_ctx->data_file, true);
+                             "data", gds_ctx->data_file, NULL);
   append_and_cleanup_section(final_asm_file, gds_ctx->base_filename, "bss",
-                             gds_ctx->bss_file, true);
+                             "bss", gds_ctx->bss_file, NULL);
 
   fclose(final_asm_file);
   free(gds_ctx);
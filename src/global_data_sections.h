@@ -1,6 +1,7 @@
 #ifndef GLOBAL_DATA_SECTIONS_H
 #define GLOBAL_DATA_SECTIONS_H
 
+#include "peephole.h"
 #include <stdio.h>
 
 struct GlobalDataSections
@@ -11,10 +12,25 @@ struct GlobalDataSections
   FILE *rodata_file;
   FILE *bss_file;
   char base_filename[256];
+  // If set, func and text go through the peephole pass when finalized
+  struct PeepholeStats *peephole;
+};
+
+// Bytes written so far to each section, for --stats.
+struct GdsSectionSizes
+{
+  long func;
+  long text;
+  long data;
+  long rodata;
+  long bss;
 };
 
 struct GlobalDataSections *gds_create (const char *base_filename);
 
+void gds_get_section_sizes (struct GlobalDataSections *gds,
+                            struct GdsSectionSizes *sizes);
+
 void gds_close_and_finalize (struct GlobalDataSections *gds_ctx);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,564 @@
+#include "inline.h"
+#include "closure.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A top-level (define ...) seen so far. Variables are recorded too, as they
+// shadow any earlier function of the same name.
+struct InlineCandidate {
+  const char *name;
+  struct Expr *definition;
+  size_t size;      // AST nodes of the body
+  size_t threshold; // the inliner's, scaled by the function's profile
+  bool inlinable;
+  struct NameList free_names; // names the body refers to
+  struct NameList body_bound; // names bound within the body
+};
+
+struct Inliner {
+  size_t threshold;
+  const struct Profile *profile;
+  struct InlineStats *stats;
+  struct InlineCandidate *candidates;
+  size_t num_candidates;
+  size_t capacity;
+  struct NameList globals; // every name defined at the top level so far
+  struct NameList bound;   // every name bound anywhere in the current form
+};
+
+static bool is_symbol(const struct Expr *expr) {
+  return expr->type == S_TYPE_ATOM &&
+         expr->val.atom_val.type == ATOM_TYPE_SYMBOL;
+}
+
+static bool is_number(const struct Expr *expr) {
+  return expr->type == S_TYPE_ATOM &&
+         expr->val.atom_val.type == ATOM_TYPE_NUMBER;
+}
+
+static bool is_constant(const struct Expr *expr) {
+  return expr->type == S_TYPE_ATOM &&
+         expr->val.atom_val.type != ATOM_TYPE_SYMBOL;
+}
+
+static bool is_form(const struct Expr *expr, const char *name) {
+  return expr->type == S_TYPE_LIST && expr->val.list_val.len > 0 &&
+         is_symbol(&expr->val.list_val.elements[0]) &&
+         strcmp(expr->val.list_val.elements[0].val.atom_val.value.symbol,
+                name) == 0;
+}
+
+static struct Expr make_symbol(const char *name, const struct Expr *at) {
+  struct Expr expr = *at;
+  expr.type = S_TYPE_ATOM;
+  expr.val.atom_val = atom_symbol_make((char *)name);
+  return expr;
+}
+
+static struct Expr make_number(double value, const struct Expr *at) {
+  struct Expr expr = *at;
+  expr.type = S_TYPE_ATOM;
+  expr.val.atom_val = atom_number_make(value);
+  return expr;
+}
+
+static struct Expr make_list(const struct Expr *at) {
+  return expr_list_make(exprvector_create(), at->start_line, at->start_col,
+                        at->end_line, at->end_col);
+}
+
+// Replaces the list expr by its element at index
+static void replace_with_element(struct Expr *expr, size_t index) {
+  struct Expr element = expr->val.list_val.elements[index];
+  expr->val.list_val.elements[index].type = S_TYPE_ATOM;
+  expr->val.list_val.elements[index].val.atom_val = atom_number_make(0);
+  expr_cleanup(expr);
+  *expr = element;
+}
+
+static void replace(struct Expr *expr, struct Expr with) {
+  expr_cleanup(expr);
+  *expr = with;
+}
+
+// Every name that define, lambda, let or do binds anywhere within expr
+static void collect_bound_names(const struct Expr *expr,
+                                struct NameList *out) {
+  if (expr->type != S_TYPE_LIST || is_form(expr, "quote")) {
+    return;
+  }
+  const struct ExprVector *vec = &expr->val.list_val;
+  if ((is_form(expr, "define") || is_form(expr, "define-memo") ||
+       is_form(expr, "lambda")) &&
+      vec->len > 1) {
+    const struct Expr *target = &vec->elements[1];
+    if (is_symbol(target)) {
+      name_list_push(out, target->val.atom_val.value.symbol);
+    } else if (target->type == S_TYPE_LIST) {
+      for (size_t i = 0; i < target->val.list_val.len; ++i) {
+        if (is_symbol(&target->val.list_val.elements[i])) {
+          name_list_push(
+              out, target->val.list_val.elements[i].val.atom_val.value.symbol);
+        }
+      }
+    }
+  }
+  if ((is_form(expr, "let") || is_form(expr, "do")) && vec->len > 1) {
+    size_t bindings_index = 1;
+    if (is_form(expr, "let") && is_symbol(&vec->elements[1])) {
+      name_list_push(out, vec->elements[1].val.atom_val.value.symbol);
+      bindings_index = 2;
+    }
+    if (bindings_index < vec->len &&
+        vec->elements[bindings_index].type == S_TYPE_LIST) {
+      const struct ExprVector *bindings =
+          &vec->elements[bindings_index].val.list_val;
+      for (size_t i = 0; i < bindings->len; ++i) {
+        const struct Expr *binding = &bindings->elements[i];
+        if (binding->type == S_TYPE_LIST && binding->val.list_val.len > 0 &&
+            is_symbol(&binding->val.list_val.elements[0])) {
+          name_list_push(
+              out, binding->val.list_val.elements[0].val.atom_val.value.symbol);
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < vec->len; ++i) {
+    collect_bound_names(&vec->elements[i], out);
+  }
+}
+
+// Closures would need their own capture analysis at every call site
+static bool contains_closure(const struct Expr *expr) {
+  if (expr->type != S_TYPE_LIST || is_form(expr, "quote")) {
+    return false;
+  }
+  const struct ExprVector *vec = &expr->val.list_val;
+  if (is_form(expr, "lambda") || is_form(expr, "future") ||
+      (is_form(expr, "define") && vec->len > 1 &&
+       vec->elements[1].type == S_TYPE_LIST)) {
+    return true;
+  }
+  for (size_t i = 0; i < vec->len; ++i) {
+    if (contains_closure(&vec->elements[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static struct InlineCandidate *find_candidate(struct Inliner *inl,
+                                              const char *name) {
+  for (size_t i = inl->num_candidates; i-- > 0;) {
+    if (strcmp(inl->candidates[i].name, name) == 0) {
+      return &inl->candidates[i];
+    }
+  }
+  return NULL;
+}
+
+static void add_candidate(struct Inliner *inl, struct Expr *definition) {
+  if (inl->num_candidates == inl->capacity) {
+    size_t capacity = inl->capacity ? inl->capacity * 2 : 16;
+    struct InlineCandidate *candidates =
+        realloc(inl->candidates, capacity * sizeof(struct InlineCandidate));
+    if (!candidates) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    inl->candidates = candidates;
+    inl->capacity = capacity;
+  }
+  struct InlineCandidate *c = &inl->candidates[inl->num_candidates++];
+  memset(c, 0, sizeof(*c));
+  c->definition = definition;
+
+  struct ExprVector *vec = &definition->val.list_val;
+  struct Expr *target = &vec->elements[1];
+  if (is_symbol(target)) {
+    c->name = target->val.atom_val.value.symbol;
+    return;
+  }
+  struct ExprVector *sig = &target->val.list_val;
+  c->name = sig->elements[0].val.atom_val.value.symbol;
+
+  bool params_ok = true;
+  for (size_t i = 1; i < sig->len; ++i) {
+    if (!is_symbol(&sig->elements[i])) {
+      params_ok = false;
+    }
+  }
+  for (size_t i = 2; i < vec->len; ++i) {
+    struct Expr *form = &vec->elements[i];
+    c->size += 1;
+    if (form->type == S_TYPE_LIST) {
+      c->size += exprvector_count_nodes(&form->val.list_val);
+    }
+    if (contains_closure(form)) {
+      params_ok = false;
+    }
+    collect_bound_names(form, &c->body_bound);
+  }
+  closure_free_names(sig, 1, NULL, vec, 2, &c->free_names);
+
+  c->threshold = inl->threshold;
+  switch (profile_function_heat(inl->profile, c->name)) {
+  case PROFILE_COLD:
+    inl->stats->cold_functions += c->threshold > 0;
+    c->threshold = 0;
+    break;
+  case PROFILE_HOT:
+    c->threshold *= PROFILE_HOT_INLINE_FACTOR;
+    inl->stats->hot_functions += c->threshold > 0;
+    break;
+  default:
+    break;
+  }
+
+  // A function that refers to itself is recursive or passes itself on
+  c->inlinable = c->threshold > 0 && params_ok &&
+                 c->size <= 2 * c->threshold &&
+                 !name_list_contains(&c->free_names, c->name);
+  if (c->inlinable) {
+    inl->stats->candidates++;
+  }
+}
+
+static bool eval_arithmetic(const char *op, double a, double b,
+                            double *result) {
+  if (strcmp(op, "+") == 0) {
+    *result = a + b;
+  } else if (strcmp(op, "-") == 0) {
+    *result = a - b;
+  } else if (strcmp(op, "*") == 0) {
+    *result = a * b;
+  } else if (strcmp(op, "/") == 0) {
+    *result = a / b;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool eval_comparison(const char *op, double a, double b,
+                            bool *result) {
+  if (strcmp(op, "=") == 0) {
+    *result = a == b;
+  } else if (strcmp(op, "<") == 0) {
+    *result = a < b;
+  } else if (strcmp(op, ">") == 0) {
+    *result = a > b;
+  } else if (strcmp(op, "<=") == 0) {
+    *result = a <= b;
+  } else if (strcmp(op, ">=") == 0) {
+    *result = a >= b;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool is_unbound(struct Inliner *inl, const char *name) {
+  return !name_list_contains(&inl->bound, name) &&
+         !name_list_contains(&inl->globals, name);
+}
+
+// 1 if expr is a constant that counts as true, 0 for #f, -1 if not known
+static int constant_truth(struct Inliner *inl, const struct Expr *expr) {
+  if (is_constant(expr)) {
+    return 1;
+  }
+  if (is_symbol(expr) && is_unbound(inl, expr->val.atom_val.value.symbol)) {
+    if (strcmp(expr->val.atom_val.value.symbol, "#t") == 0) {
+      return 1;
+    }
+    if (strcmp(expr->val.atom_val.value.symbol, "#f") == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Folds arithmetic and comparisons on number literals and ifs with a
+// constant condition, bottom up
+static void fold(struct Inliner *inl, struct Expr *expr) {
+  if (expr->type != S_TYPE_LIST || is_form(expr, "quote")) {
+    return;
+  }
+  struct ExprVector *vec = &expr->val.list_val;
+  for (size_t i = 0; i < vec->len; ++i) {
+    fold(inl, &vec->elements[i]);
+  }
+  if (vec->len == 0 || !is_symbol(&vec->elements[0])) {
+    return;
+  }
+  const char *op = vec->elements[0].val.atom_val.value.symbol;
+  if (!is_unbound(inl, op)) {
+    return;
+  }
+
+  if (strcmp(op, "if") == 0 && (vec->len == 3 || vec->len == 4)) {
+    int truth = constant_truth(inl, &vec->elements[1]);
+    if (truth < 0) {
+      return;
+    }
+    inl->stats->branches_removed++;
+    if (truth) {
+      replace_with_element(expr, 2);
+    } else if (vec->len == 4) {
+      replace_with_element(expr, 3);
+    } else {
+      replace(expr, make_symbol("#f", expr));
+    }
+    return;
+  }
+
+  if (vec->len < 3) {
+    return;
+  }
+  for (size_t i = 1; i < vec->len; ++i) {
+    if (!is_number(&vec->elements[i])) {
+      return;
+    }
+  }
+  double a = vec->elements[1].val.atom_val.value.number;
+  double b = vec->elements[2].val.atom_val.value.number;
+  double number = a;
+  bool truth;
+  // Arithmetic takes any number of operands, comparisons two
+  if (eval_arithmetic(op, a, b, &number)) {
+    for (size_t i = 3; i < vec->len; ++i) {
+      eval_arithmetic(op, number, vec->elements[i].val.atom_val.value.number,
+                      &number);
+    }
+    inl->stats->constants_folded++;
+    replace(expr, make_number(number, expr));
+  } else if (vec->len == 3 && eval_comparison(op, a, b, &truth)) {
+    inl->stats->constants_folded++;
+    replace(expr, make_symbol(truth ? "#t" : "#f", expr));
+  }
+}
+
+static void substitute(struct Expr *expr, const char *name,
+                       const struct Expr *value) {
+  if (is_symbol(expr)) {
+    if (strcmp(expr->val.atom_val.value.symbol, name) == 0) {
+      replace(expr, expr_copy(value));
+    }
+    return;
+  }
+  if (expr->type != S_TYPE_LIST || is_form(expr, "quote")) {
+    return;
+  }
+  for (size_t i = 0; i < expr->val.list_val.len; ++i) {
+    substitute(&expr->val.list_val.elements[i], name, value);
+  }
+}
+
+static bool is_assigned_in(const struct ExprVector *forms, size_t first,
+                           const char *name) {
+  for (size_t i = first; i < forms->len; ++i) {
+    if (closure_is_assigned(name, &forms->elements[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replaces call by the body of the function it calls if that is inlinable
+// here. Constant arguments of parameters that the body neither assigns nor
+// rebinds are substituted, the others are bound by a let.
+static void try_inline_call(struct Inliner *inl, struct Expr *call) {
+  struct ExprVector *vec = &call->val.list_val;
+  const char *name = vec->elements[0].val.atom_val.value.symbol;
+  struct InlineCandidate *c = find_candidate(inl, name);
+  if (!c || !c->inlinable) {
+    return;
+  }
+  struct ExprVector *definition = &c->definition->val.list_val;
+  struct ExprVector *sig = &definition->elements[1].val.list_val;
+  size_t num_params = sig->len - 1;
+  if (vec->len - 1 != num_params) {
+    return;
+  }
+  // The body must see the same globals as where it was defined
+  for (size_t i = 0; i < c->free_names.len; ++i) {
+    if (name_list_contains(&inl->bound, c->free_names.names[i])) {
+      return;
+    }
+  }
+  size_t constant_args = 0;
+  for (size_t i = 1; i < vec->len; ++i) {
+    constant_args += is_constant(&vec->elements[i]);
+  }
+  if (c->size > c->threshold &&
+      (constant_args == 0 || c->size > 2 * c->threshold)) {
+    return;
+  }
+
+  struct Expr body = make_list(call);
+  exprvector_append(&body.val.list_val, make_symbol("let", call));
+  struct Expr bindings = make_list(call);
+  for (size_t i = 2; i < definition->len; ++i) {
+    exprvector_append(&body.val.list_val, expr_copy(&definition->elements[i]));
+  }
+
+  for (size_t i = 0; i < num_params; ++i) {
+    const char *param = sig->elements[i + 1].val.atom_val.value.symbol;
+    struct Expr *arg = &vec->elements[i + 1];
+    if (is_constant(arg) && !is_assigned_in(definition, 2, param) &&
+        !name_list_contains(&c->body_bound, param)) {
+      for (size_t j = 1; j < body.val.list_val.len; ++j) {
+        substitute(&body.val.list_val.elements[j], param, arg);
+      }
+      inl->stats->args_substituted++;
+      continue;
+    }
+    struct Expr binding = make_list(call);
+    exprvector_append(&binding.val.list_val, make_symbol(param, call));
+    exprvector_append(&binding.val.list_val, expr_copy(arg));
+    exprvector_append(&bindings.val.list_val, binding);
+  }
+
+  // (let () form) is just form, unless form is a define
+  struct ExprVector *forms = &body.val.list_val;
+  if (bindings.val.list_val.len == 0 && forms->len == 2 &&
+      !is_form(&forms->elements[1], "define")) {
+    expr_cleanup(&bindings);
+    replace_with_element(&body, 1);
+  } else {
+    // Insert the bindings after the let keyword
+    exprvector_append(forms, bindings);
+    memmove(&forms->elements[2], &forms->elements[1],
+            (forms->len - 2) * sizeof(struct Expr));
+    forms->elements[1] = bindings;
+  }
+
+  // The parameters and the body's own names must not be folded as builtins
+  size_t mark = inl->bound.len;
+  for (size_t i = 1; i < sig->len; ++i) {
+    name_list_push(&inl->bound, sig->elements[i].val.atom_val.value.symbol);
+  }
+  for (size_t i = 0; i < c->body_bound.len; ++i) {
+    name_list_push(&inl->bound, c->body_bound.names[i]);
+  }
+  fold(inl, &body);
+  inl->bound.len = mark;
+
+  replace(call, body);
+  inl->stats->calls_inlined++;
+}
+
+static void rewrite(struct Inliner *inl, struct Expr *expr);
+
+static void rewrite_range(struct Inliner *inl, struct ExprVector *vec,
+                          size_t first) {
+  for (size_t i = first; i < vec->len; ++i) {
+    rewrite(inl, &vec->elements[i]);
+  }
+}
+
+// Rewrites the bindings of a let or do: the init and, for do, the step
+static void rewrite_bindings(struct Inliner *inl, struct Expr *bindings) {
+  if (bindings->type != S_TYPE_LIST) {
+    return;
+  }
+  for (size_t i = 0; i < bindings->val.list_val.len; ++i) {
+    struct Expr *binding = &bindings->val.list_val.elements[i];
+    if (binding->type == S_TYPE_LIST) {
+      rewrite_range(inl, &binding->val.list_val, 1);
+    }
+  }
+}
+
+// Inlines calls bottom up, so that arguments are rewritten before the call
+// that takes them. Inlined bodies are not rewritten again: they already were
+// when their function was defined.
+static void rewrite(struct Inliner *inl, struct Expr *expr) {
+  if (expr->type != S_TYPE_LIST || expr->val.list_val.len == 0) {
+    return;
+  }
+  struct ExprVector *vec = &expr->val.list_val;
+  struct Expr *head = &vec->elements[0];
+  if (!is_symbol(head) ||
+      name_list_contains(&inl->bound, head->val.atom_val.value.symbol)) {
+    rewrite_range(inl, vec, 0);
+    return;
+  }
+
+  const char *op = head->val.atom_val.value.symbol;
+  if (strcmp(op, "quote") == 0) {
+    return;
+  }
+  if (strcmp(op, "define") == 0 || strcmp(op, "lambda") == 0 ||
+      strcmp(op, "set!") == 0 || strcmp(op, "vector-map") == 0) {
+    rewrite_range(inl, vec, 2);
+    return;
+  }
+  // Not a candidate itself: inlining it would bypass its cache
+  if (strcmp(op, "define-memo") == 0) {
+    rewrite_range(inl, vec, closure_memo_body_first(vec));
+    return;
+  }
+  if (strcmp(op, "let") == 0) {
+    size_t bindings_index =
+        vec->len > 1 && is_symbol(&vec->elements[1]) ? 2 : 1;
+    if (bindings_index < vec->len) {
+      rewrite_bindings(inl, &vec->elements[bindings_index]);
+    }
+    rewrite_range(inl, vec, bindings_index + 1);
+    return;
+  }
+  if (strcmp(op, "do") == 0) {
+    if (vec->len > 1) {
+      rewrite_bindings(inl, &vec->elements[1]);
+    }
+    if (vec->len > 2 && vec->elements[2].type == S_TYPE_LIST) {
+      rewrite_range(inl, &vec->elements[2].val.list_val, 0);
+    }
+    rewrite_range(inl, vec, 3);
+    return;
+  }
+
+  rewrite_range(inl, vec, 1);
+  try_inline_call(inl, expr);
+}
+
+void inline_program(struct ExprVector *program, size_t threshold,
+                    const struct Profile *profile,
+                    struct InlineStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  struct Inliner inl = {
+      .threshold = threshold, .profile = profile, .stats = stats};
+
+  for (size_t i = 0; i < program->len; ++i) {
+    struct Expr *form = &program->elements[i];
+    if (threshold > 0) {
+      inl.bound.len = 0;
+      collect_bound_names(form, &inl.bound);
+      rewrite(&inl, form);
+    }
+
+    if (is_form(form, "define") && form->val.list_val.len >= 3) {
+      struct Expr *target = &form->val.list_val.elements[1];
+      if (is_symbol(target) ||
+          (target->type == S_TYPE_LIST && target->val.list_val.len > 0 &&
+           is_symbol(&target->val.list_val.elements[0]))) {
+        add_candidate(&inl, form);
+        name_list_push(&inl.globals,
+                       inl.candidates[inl.num_candidates - 1].name);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < inl.num_candidates; ++i) {
+    name_list_cleanup(&inl.candidates[i].free_names);
+    name_list_cleanup(&inl.candidates[i].body_bound);
+  }
+  free(inl.candidates);
+  name_list_cleanup(&inl.globals);
+  name_list_cleanup(&inl.bound);
+}
@@ -0,0 +1,33 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "expr.h"
+#include "profile.h"
+#include <stddef.h>
+
+// Largest function body, in AST nodes, that is inlined at every call site.
+// Bodies up to twice this size are inlined where an argument is a constant.
+#define INLINE_DEFAULT_THRESHOLD 16
+
+// Counters for --stats.
+struct InlineStats
+{
+  size_t candidates;       // functions small enough to be inlined
+  size_t calls_inlined;    // call sites replaced by a body
+  size_t args_substituted; // constant arguments substituted into a body
+  size_t constants_folded; // arithmetic and comparisons on constants
+  size_t branches_removed; // ifs with a constant condition
+  size_t hot_functions;    // candidates with a raised threshold
+  size_t cold_functions;   // functions not inlined as never entered
+};
+
+// Replaces calls to small, non-recursive global functions with their bodies,
+// as (let ((param arg)...) body...), then folds constants in the inlined
+// code. A threshold of 0 disables inlining. With a profile, functions that
+// were never entered are not inlined, and hot ones are up to
+// PROFILE_HOT_INLINE_FACTOR times the threshold; profile may be NULL.
+void inline_program (struct ExprVector *program, size_t threshold,
+                     const struct Profile *profile,
+                     struct InlineStats *stats);
+
+#endif
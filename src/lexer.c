@@ -27,6 +27,7 @@ static void buffer_free(struct LexemeBuffer *buf) {
   buf->len = 0;
 }
 
+// May move buf->str, so take the lexeme only once it is complete
 static void buffer_append(struct LexemeBuffer *buf, char c) {
   if (buf->len + 1 >= buf->capacity) {
     int new_capacity = buf->capacity * 2;
@@ -86,7 +87,6 @@ static struct Token lexer_handle_single_char(struct LexerContext *ctx,
 }
 
 static struct Token lexer_handle_whitespace(struct LexerContext *ctx) {
-  char *lexeme = ctx->lexeme_buf.str;
   int start_line = ctx->line;
   int start_col = ctx->col;
   int end_line = ctx->line;
@@ -98,12 +98,12 @@ static struct Token lexer_handle_whitespace(struct LexerContext *ctx) {
     end_col = ctx->col;
     lexer_advance(ctx);
   }
+  char *lexeme = ctx->lexeme_buf.str;
   return make_token(TOKEN_WHITESPACE, lexeme, start_line, start_col, end_line,
                     end_col);
 }
 
 static struct Token lexer_handle_comment(struct LexerContext *ctx) {
-  char *lexeme = ctx->lexeme_buf.str;
   int start_line = ctx->line;
   int start_col = ctx->col;
   int end_line = ctx->line;
@@ -120,12 +120,12 @@ static struct Token lexer_handle_comment(struct LexerContext *ctx) {
     end_col = ctx->col;
     lexer_advance(ctx);
   }
+  char *lexeme = ctx->lexeme_buf.str;
   return make_token(TOKEN_COMMENT, lexeme, start_line, start_col, end_line,
                     end_col);
 }
 
 static struct Token lexer_handle_str(struct LexerContext *ctx) {
-  char *lexeme = ctx->lexeme_buf.str;
   int start_line = ctx->line;
   int start_col = ctx->col;
   int end_line = ctx->line;
@@ -148,6 +148,7 @@ static struct Token lexer_handle_str(struct LexerContext *ctx) {
   end_line = ctx->line;
   end_col = ctx->col;
   lexer_advance(ctx);
+  char *lexeme = ctx->lexeme_buf.str;
   return make_token(TOKEN_STRING, lexeme, start_line, start_col, end_line,
                     end_col);
 }
@@ -157,7 +158,6 @@ static int is_symbol_char(char c) {
 }
 
 static struct Token lexer_handle_symbol(struct LexerContext *ctx) {
-  char *lexeme = ctx->lexeme_buf.str;
   int start_line = ctx->line;
   int start_col = ctx->col;
   int end_line = ctx->line;
@@ -176,6 +176,7 @@ static struct Token lexer_handle_symbol(struct LexerContext *ctx) {
     lexer_advance(ctx);
   }
 
+  char *lexeme = ctx->lexeme_buf.str;
   char *endptr;
   strtod(lexeme, &endptr);
 
@@ -268,3 +269,19 @@ struct Token lexer_next(struct LexerContext *ctx) {
 
   return lexer_handle_error(ctx);
 }
+
+size_t lexer_count_tokens(const char *source_code) {
+  struct LexerContext lexer = lexer_init(source_code);
+  size_t tokens = 0;
+  while (1) {
+    struct Token t = lexer_next(&lexer);
+    enum TokenType type = t.type;
+    token_cleanup(&t);
+    if (type == TOKEN_EOF || type == TOKEN_ERROR) {
+      break;
+    }
+    tokens++;
+  }
+  lexer_cleanup(&lexer);
+  return tokens;
+}
@@ -25,4 +25,8 @@ struct Token lexer_next (struct LexerContext *ctx);
 
 void lexer_cleanup (struct LexerContext *ctx);
 
+// Lexes source_code to the end, or to the first TOKEN_ERROR, and returns the
+// number of tokens before it; the lexing pass of --stats and compiler_bench
+size_t lexer_count_tokens (const char *source_code);
+
 #endif
@@ -1,30 +1,31 @@
 #ifndef LISPVALUE_H
 #define LISPVALUE_H
 
+#include <stddef.h>
+
 struct LispValue
 {
   enum LispValueType
   {
     LVAL_NUM,  // A floating-point number (double)
     LVAL_SYM,  // A symbol (pointer to char* name)
-    LVAL_STR,  // A string literal (pointer to char* content)
-    LVAL_PAIR, // A cons cell: (car . cdr) - 2 pointers to other LispValue*
+    LVAL_STR,  // A string (pointer to LispString)
+    LVAL_PAIR, // A cons cell, see struct LispPair (never stored in .type)
     LVAL_FUNC, // A compiled Lisp function (pointer to assembly code block)
     LVAL_BUILTIN,  // pointer to C function in runtime
     LVAL_NIL,      // empty list '()', also represents #f (false)
     LVAL_TRUE,     // The boolean #t (true)
-    LVAL_UNDEFINED // For uninitialized variables, etc.
+    LVAL_UNDEFINED, // For uninitialized variables, etc.
+    LVAL_VEC,       // A flat vector of doubles (pointer to LispVector)
+    LVAL_FUTURE     // A task made by future or spawn, see runtime.c
   } type;
 
   union LispValueData
   {
     double num_val;
     char *str_val;
-    struct
-    {
-      struct LispValue *car;
-      struct LispValue *cdr;
-    } pair_val;
+    struct LispString *string_val;
+    struct LispVector *vec_val;
     void *func_ptr;
   } value;
 
@@ -33,7 +34,94 @@ struct LispValue
 
 #define LISPVALUE_TYPE_OFFSET 0
 #define LISPVALUE_VALUE_OFFSET 8
-#define LISPVALUE_PAIR_CAR_OFFSET (LISPVALUE_VALUE_OFFSET + 0)
-#define LISPVALUE_PAIR_CDR_OFFSET (LISPVALUE_VALUE_OFFSET + 8)
+
+// Cons cells are untagged: a pair is a bare (car, cdr) cell in the runtime's
+// pair space, and a LispValue pointer is a pair iff it points into that space
+// (see lisp_is_pair in runtime.c).
+struct LispPair
+{
+  struct LispValue *car;
+  struct LispValue *cdr;
+};
+
+// Strings are length-prefixed and not NUL-terminated, so that substrings can
+// point into the characters of the string they were taken from. Literals are
+// emitted as static LispValue/LispString pairs in .rodata.
+struct LispString
+{
+  size_t len;
+  const char *chars;
+};
+
+struct LispVector
+{
+  size_t len;
+  double *data; // 32-byte aligned so that SIMD kernels can use full loads
+};
+
+// Element-wise operations of vector-map; the compiler passes these as
+// immediates to lisp_vector_map.
+enum LispVectorOp
+{
+  LISP_VECTOR_ADD,
+  LISP_VECTOR_SUB,
+  LISP_VECTOR_MUL,
+  LISP_VECTOR_DIV,
+};
+
+#define LISPPAIR_CAR_OFFSET 0
+#define LISPPAIR_CDR_OFFSET 8
+
+// A closure is an LVAL_FUNC value whose func_ptr is the code, followed in the
+// same record by the values of its free variables (flat closure conversion).
+// The code is called with the record in rdi and the arguments from rsi on.
+// Records that never leave their frame are built on the stack, and ones
+// without free variables are static.
+struct LispClosure
+{
+  struct LispValue header;
+  struct LispValue *vars[];
+};
+
+#define LISPCLOSURE_CODE_OFFSET LISPVALUE_VALUE_OFFSET
+#define LISPCLOSURE_VARS_OFFSET 16
+
+// Result cache of a function defined with define-memo, keyed on the numbers
+// its arguments hold. The compiler emits one record per function in .data
+// with the first three fields set and the rest zero; the runtime allocates
+// the table on first use. Open addressing with linear probing: a slot is
+// empty when its value is NULL, and keys are compared bit for bit.
+struct LispMemo
+{
+  const char *name;
+  size_t num_args;
+  size_t limit; // most entries kept, 0 for no bound
+
+  size_t capacity; // a power of two, at least twice count
+  size_t count;
+  double *keys; // num_args doubles per slot
+  struct LispValue **values;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  struct LispMemo *next; // tables in use, for the profile
+  int lock;              // held while the table is read or changed
+};
+
+#define LISPMEMO_RUNTIME_OFFSET 24 // offsetof (struct LispMemo, capacity)
+
+// Counters of a program compiled with --profile-generate. The compiler emits
+// one record in .data per function and per if, each pointing to the one
+// emitted before it; main passes the last to lisp_pgo_start, which writes
+// them all to the profile file when the program exits.
+struct LispPgoCounter
+{
+  const char *key; // "function <name>" or "if <line>:<col>"
+  const struct LispPgoCounter *prev;
+  size_t num_counts;
+  unsigned long counts[2]; // entries, or then and else branches taken
+};
+
+#define LISPPGOCOUNTER_COUNTS_OFFSET 24
 
 #endif
\ No newline at end of file
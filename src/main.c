@@ -1,5 +1,12 @@
 #include "codegen.h"
+#include "dce.h"
+#include "global_data_sections.h"
+#include "inline.h"
 #include "parser.h"
+#include "profile.h"
+#include "stats.h"
+#include "symbol.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -42,14 +49,139 @@ static char *read_file_to_string(const char *filename) {
   return buffer;
 }
 
+struct DriverOptions {
+  const char *input_filename;
+  bool debug_lines;
+  bool time_passes;
+  bool stats;
+  const char *stats_filename;
+  size_t inline_threshold;
+  bool no_dce;
+  bool no_peephole;
+  bool no_function_layout;
+  bool profile_generate;
+  const char *profile_use;
+};
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-g] [--time-passes] [--stats] [--stats-file <file>] "
+          "[--inline-threshold <nodes>] [--no-dce] [--no-peephole] "
+          "[--no-function-layout] "
+          "[--profile-generate | --profile-use <file>] <input.lisp>\n",
+          program);
+}
+
+static bool parse_options(int argc, char **argv, struct DriverOptions *opts) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--debug-lines") == 0) {
+      opts->debug_lines = true;
+    } else if (strcmp(argv[i], "--time-passes") == 0) {
+      opts->time_passes = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      opts->stats = true;
+    } else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+      opts->stats_filename = argv[++i];
+    } else if (strcmp(argv[i], "--inline-threshold") == 0 && i + 1 < argc) {
+      char *end;
+      opts->inline_threshold = strtoul(argv[++i], &end, 10);
+      if (*end != '\0') {
+        fprintf(stderr, "Invalid inline threshold '%s'\n", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--no-dce") == 0) {
+      opts->no_dce = true;
+    } else if (strcmp(argv[i], "--no-peephole") == 0) {
+      opts->no_peephole = true;
+    } else if (strcmp(argv[i], "--no-function-layout") == 0) {
+      opts->no_function_layout = true;
+    } else if (strcmp(argv[i], "--profile-generate") == 0) {
+      opts->profile_generate = true;
+    } else if (strcmp(argv[i], "--profile-use") == 0 && i + 1 < argc) {
+      opts->profile_use = argv[++i];
+    } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+      fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+      return false;
+    } else if (!opts->input_filename) {
+      opts->input_filename = argv[i];
+    } else {
+      fprintf(stderr, "Only one input file is supported\n");
+      return false;
+    }
+  }
+  if (opts->profile_generate && opts->profile_use) {
+    fprintf(stderr,
+            "--profile-generate and --profile-use cannot be combined\n");
+    return false;
+  }
+  return opts->input_filename != NULL;
+}
+
+static void collect_counters(struct CompilerStats *stats,
+                             const struct ExprVector *ast, size_t tokens,
+                             const struct InlineStats *inl,
+                             const struct DceStats *dce,
+                             const struct PeepholeStats *peephole,
+                             const struct GdsSectionSizes *sizes) {
+  stats_add_counter(stats, "frontend", "tokens", tokens);
+  stats_add_counter(stats, "frontend", "top_level_forms", ast->len);
+  stats_add_counter(stats, "frontend", "ast_nodes",
+                    exprvector_count_nodes(ast));
+
+  stats_add_counter(stats, "inline", "candidates", inl->candidates);
+  stats_add_counter(stats, "inline", "calls_inlined", inl->calls_inlined);
+  stats_add_counter(stats, "inline", "args_substituted",
+                    inl->args_substituted);
+  stats_add_counter(stats, "inline", "constants_folded",
+                    inl->constants_folded);
+  stats_add_counter(stats, "inline", "branches_removed",
+                    inl->branches_removed);
+  stats_add_counter(stats, "inline", "hot_functions", inl->hot_functions);
+  stats_add_counter(stats, "inline", "cold_functions", inl->cold_functions);
+
+  stats_add_counter(stats, "dce", "functions_removed",
+                    dce->functions_removed);
+  stats_add_counter(stats, "dce", "globals_removed", dce->globals_removed);
+
+  stats_add_counter(stats, "peephole", "instructions", peephole->instructions);
+  stats_add_counter(stats, "peephole", "push_pop_folded",
+                    peephole->push_pop_folded);
+  stats_add_counter(stats, "peephole", "moves_removed",
+                    peephole->moves_removed);
+  stats_add_counter(stats, "peephole", "copies_propagated",
+                    peephole->copies_propagated);
+  stats_add_counter(stats, "peephole", "dead_stores_removed",
+                    peephole->dead_stores_removed);
+
+  const struct SymbolMapStats *sm = symbol_map_get_stats();
+  stats_add_counter(stats, "symbol_map", "lookups", sm->lookups);
+  stats_add_counter(stats, "symbol_map", "lookup_probes", sm->lookup_probes);
+  stats_add_counter(stats, "symbol_map", "emplaces", sm->emplaces);
+  stats_add_counter(stats, "symbol_map", "emplace_probes", sm->emplace_probes);
+  stats_add_counter(stats, "symbol_map", "max_probe_length",
+                    sm->max_probe_length);
+  stats_add_counter(stats, "symbol_map", "resizes", sm->resizes);
+
+  stats_add_counter(stats, "section_bytes", "func", sizes->func);
+  stats_add_counter(stats, "section_bytes", "text", sizes->text);
+  stats_add_counter(stats, "section_bytes", "rodata", sizes->rodata);
+  stats_add_counter(stats, "section_bytes", "data", sizes->data);
+  stats_add_counter(stats, "section_bytes", "bss", sizes->bss);
+}
+
 int main(int argc, char **argv) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <input.lisp>\n", argv[0]);
+  struct DriverOptions opts = {.inline_threshold = INLINE_DEFAULT_THRESHOLD};
+  if (!parse_options(argc, argv, &opts)) {
+    print_usage(argv[0]);
     return EXIT_FAILURE;
   }
+  bool want_stats = opts.time_passes || opts.stats;
+  struct CompilerStats stats = {0};
 
-  const char *input_filename = argv[1];
+  const char *input_filename = opts.input_filename;
+  stats_pass_begin(&stats, "read_file");
   char *source_code = read_file_to_string(input_filename);
+  stats_pass_end(&stats);
   if (!source_code) {
     return EXIT_FAILURE;
   }
@@ -62,20 +194,106 @@ int main(int argc, char **argv) {
     *dot = '\0'; // Truncate at the last dot to get the base name
   }
 
+  // The parser pulls tokens on demand, so lexing is only timed on its own by
+  // a separate pass when statistics are requested
+  size_t tokens = 0;
+  if (want_stats) {
+    stats_pass_begin(&stats, "lex");
+    tokens = lexer_count_tokens(source_code);
+    stats_pass_end(&stats);
+  }
+
+  stats_pass_begin(&stats, "parse");
   struct ParserContext parser = parser_make(source_code);
   struct ExprVector ast = parse_program(&parser);
+  stats_pass_end(&stats);
 
+  stats_pass_begin(&stats, "pretty_print_ast");
   pretty_print_ast(&ast);
+  stats_pass_end(&stats);
+
+  struct Profile *profile = NULL;
+  if (opts.profile_use) {
+    profile = profile_read(opts.profile_use);
+    if (!profile) {
+      return EXIT_FAILURE;
+    }
+  }
+  // Calls are counted where the source makes them, so that the entry
+  // counts are those of the functions as written
+  if (opts.profile_generate) {
+    opts.inline_threshold = 0;
+  }
 
-  compile_program(&ast, output_basename);
+  struct InlineStats inline_stats;
+  stats_pass_begin(&stats, "inline");
+  inline_program(&ast, opts.inline_threshold, profile, &inline_stats);
+  stats_pass_end(&stats);
+
+  struct DceStats dce_stats = {0};
+  if (!opts.no_dce) {
+    stats_pass_begin(&stats, "dce");
+    dce_program(&ast, &dce_stats);
+    stats_pass_end(&stats);
+  }
+
+  struct GlobalDataSections *gds = gds_create(output_basename);
+  if (!gds) {
+    return EXIT_FAILURE;
+  }
+  struct PeepholeStats peephole_stats = {0};
+  if (!opts.no_peephole) {
+    gds->peephole = &peephole_stats;
+  }
+  stats_pass_begin(&stats, "compile_program");
+  char profile_output[256 + 9];
+  snprintf(profile_output, sizeof(profile_output), "%s.profdata",
+           output_basename);
+  struct CompileOptions compile_options = {
+      .debug_lines = opts.debug_lines,
+      .source_filename = input_filename,
+      .profile_generate = opts.profile_generate,
+      .profile_output = profile_output,
+      .profile = profile,
+      .source_order_functions = opts.no_function_layout};
+  compile_to_sections(&ast, gds, &compile_options);
+  stats_pass_end(&stats);
+  profile_free(profile);
+
+  struct GdsSectionSizes section_sizes;
+  gds_get_section_sizes(gds, &section_sizes);
+
+  stats_pass_begin(&stats, "gds_close_and_finalize");
+  gds_close_and_finalize(gds);
+  stats_pass_end(&stats);
+
+  if (want_stats) {
+    collect_counters(&stats, &ast, tokens, &inline_stats, &dce_stats,
+                     &peephole_stats, &section_sizes);
+    FILE *stats_out = stderr;
+    if (opts.stats_filename) {
+      stats_out = fopen(opts.stats_filename, "w");
+      if (!stats_out) {
+        perror("Failed to open stats file");
+        return EXIT_FAILURE;
+      }
+    }
+    stats_write_json(&stats, stats_out, opts.time_passes, opts.stats);
+    if (stats_out != stderr) {
+      fclose(stats_out);
+    }
+  }
 
   exprvector_cleanup(&ast);
   free(source_code);
 
   printf("\nCompilation successful. To run:\n");
-  printf("  nasm -f elf64 %s.s\n", output_basename);
-  printf("  gcc %s.o runtime.o -o %s.out\n", output_basename, output_basename);
-  printf("  ./%s\n", output_basename);
+  printf("  nasm -f elf64%s %s.s\n", opts.debug_lines ? " -g -F dwarf" : "",
+         output_basename);
+  // LISP_LDFLAGS of the Makefile: the runtime's scheduler uses pthreads
+  printf("  gcc -no-pie -pthread %s.o obj/runtime.o -o %s.out\n",
+         output_basename, output_basename);
+  printf("  ./%s.out\n", output_basename);
 
   return 0;
-}
\ No newline at end of file
+}
@@ -4,8 +4,16 @@
 #include "parser.h"
 
 struct ParserContext parser_make(const char *source_code) {
+  return parser_make_at(source_code, 0, 1, 1);
+}
+
+struct ParserContext parser_make_at(const char *source_code, int pos, int line,
+                                    int col) {
 
   struct LexerContext lexer = lexer_init(source_code);
+  lexer.current_pos = pos;
+  lexer.line = line;
+  lexer.col = col;
   struct Token starting_token = make_token(TOKEN_WHITESPACE, "", 0, 0, 0, 0);
 
   struct ParserContext ctx = {.lexer = lexer, .current_token = starting_token};
@@ -14,6 +22,12 @@ struct ParserContext parser_make(const char *source_code) {
 }
 
 void parser_error(struct ParserContext *ctx, const char *message) {
+  if (ctx->recover) {
+    if (!ctx->error) {
+      ctx->error = message;
+    }
+    return;
+  }
   printf("Parsing Error at %d:%d - %s (Current Token: '%s', Type: %s)\n",
          ctx->current_token.start_line, ctx->current_token.start_col, message,
          ctx->current_token.lexeme,
@@ -23,12 +37,13 @@ void parser_error(struct ParserContext *ctx, const char *message) {
 
 void parser_advance(struct ParserContext *ctx) {
   token_cleanup(&ctx->current_token);
+  ctx->token_pos = ctx->lexer.current_pos;
   ctx->current_token = lexer_next(&ctx->lexer);
 }
 
 void parser_cleanup(struct ParserContext *ctx) { lexer_cleanup(&ctx->lexer); }
 
-static void skip_whitespace_and_comments(struct ParserContext *ctx) {
+void parser_skip_whitespace_and_comments(struct ParserContext *ctx) {
   while (ctx->current_token.type == TOKEN_WHITESPACE ||
          ctx->current_token.type == TOKEN_COMMENT) {
     parser_advance(ctx);
@@ -37,22 +52,38 @@ static void skip_whitespace_and_comments(struct ParserContext *ctx) {
 
 struct ExprVector parse_program(struct ParserContext *ctx) {
   struct ExprVector ast = exprvector_create();
-  skip_whitespace_and_comments(ctx);
+  parser_skip_whitespace_and_comments(ctx);
   while (ctx->current_token.type != TOKEN_EOF) {
     struct Expr e = parse_expr(ctx);
     exprvector_append(&ast, e);
-    skip_whitespace_and_comments(ctx);
+    parser_skip_whitespace_and_comments(ctx);
   }
   return ast;
 }
 
+// Reports message at the current token, which is skipped unless it is the
+// end of file, and returns the token as an S_TYPE_ERROR form
+static struct Expr parse_error_token(struct ParserContext *ctx,
+                                     const char *message) {
+  parser_error(ctx, message);
+  struct Expr error = {.type = S_TYPE_ERROR,
+                       .val.error_msg = message,
+                       .start_line = ctx->current_token.start_line,
+                       .start_col = ctx->current_token.start_col,
+                       .end_line = ctx->current_token.end_line,
+                       .end_col = ctx->current_token.end_col};
+  if (ctx->current_token.type != TOKEN_EOF) {
+    parser_advance(ctx);
+  }
+  return error;
+}
+
 struct Expr parse_expr(struct ParserContext *ctx) {
   switch (ctx->current_token.type) {
   case TOKEN_LPAREN:
     return parse_list(ctx);
   case TOKEN_RPAREN:
-    parser_error(ctx, "Closing an unopened list");
-    break;
+    return parse_error_token(ctx, "Closing an unopened list");
   case TOKEN_QUOTE:
     parser_advance(ctx);
     return parse_quoted_expression(ctx);
@@ -61,27 +92,13 @@ struct Expr parse_expr(struct ParserContext *ctx) {
   case TOKEN_STRING:
     return parse_atom(ctx);
   case TOKEN_EOF:
-    parser_error(ctx, "Unexpexted end of file (unterminated list?)");
-    break;
+    return parse_error_token(ctx,
+                             "Unexpexted end of file (unterminated list?)");
   case TOKEN_ERROR:
-    parser_error(ctx, "Token error");
-    break;
+    return parse_error_token(ctx, "Token error");
   default:
-    parser_error(ctx, "Illegal token");
-    break;
+    return parse_error_token(ctx, "Illegal token");
   }
-  int start_line = ctx->current_token.start_line;
-  int start_col = ctx->current_token.start_col;
-  int end_line = ctx->current_token.end_line;
-  int end_col = ctx->current_token.end_col;
-  const char *error_msg = "Unhandled token in parse_expr";
-
-  return (struct Expr){.type = S_TYPE_ERROR,
-                       .val.error_msg = error_msg,
-                       .start_line = start_line,
-                       .start_col = start_col,
-                       .end_line = end_line,
-                       .end_col = end_col};
 }
 
 struct Expr parse_atom(struct ParserContext *ctx) {
@@ -99,14 +116,19 @@ struct Expr parse_list(struct ParserContext *ctx) {
   struct ExprVector list = exprvector_create();
   parser_advance(ctx);
   while (1) {
-    skip_whitespace_and_comments(ctx);
+    parser_skip_whitespace_and_comments(ctx);
 
     if (ctx->current_token.type == TOKEN_RPAREN) {
       break;
     }
 
     if (ctx->current_token.type == TOKEN_EOF) {
-      parser_error(ctx, "Unterminated list, found EOF");
+      exprvector_cleanup(&list);
+      struct Expr error =
+          parse_error_token(ctx, "Unterminated list, found EOF");
+      error.start_line = start_line;
+      error.start_col = start_col;
+      return error;
     }
 
     struct Expr e = parse_expr(ctx);
@@ -131,12 +153,12 @@ struct Expr parse_quoted_expression(struct ParserContext *ctx) {
                     .end_col = start_col};
   struct Expr quote = expr_atom_make(&t);
   exprvector_append(&list, quote);
-  skip_whitespace_and_comments(ctx);
+  parser_skip_whitespace_and_comments(ctx);
 
   struct Expr e = parse_expr(ctx);
   exprvector_append(&list, e);
 
-  size_t end_line = ctx->current_token.end_line;
-  size_t end_col = ctx->current_token.end_col;
-  return expr_list_make(list, start_line, start_col, end_line, end_col);
+  // Ends where the quoted expression does, not at the token after it, so
+  // that the positions of a form depend on its own text only
+  return expr_list_make(list, start_line, start_col, e.end_line, e.end_col);
 }
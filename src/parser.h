@@ -3,17 +3,30 @@
 
 #include "expr.h"
 #include "lexer.h"
+#include <stdbool.h>
 
 struct ParserContext
 {
   struct LexerContext lexer;
   struct Token current_token;
+  int token_pos; // offset of current_token in the source
+  // With recover set, syntax errors do not exit: the first one is kept in
+  // error and parsing goes on past it, returning S_TYPE_ERROR forms
+  bool recover;
+  const char *error;
 };
 
 struct ParserContext parser_make (const char *source_code);
+// Starts at offset pos of source_code, which is at the given line and
+// column, instead of at its beginning. pos must be between two tokens.
+struct ParserContext parser_make_at (const char *source_code, int pos,
+                                     int line, int col);
+// Prints message with the current token and exits, unless ctx->recover is
+// set
 void parser_error (struct ParserContext *ctx, const char *message);
 void parser_advance (struct ParserContext *ctx);
 void parser_cleanup (struct ParserContext *ctx);
+void parser_skip_whitespace_and_comments (struct ParserContext *ctx);
 
 struct ExprVector parse_program (struct ParserContext *ctx);
 
@@ -0,0 +1,589 @@
+#include "peephole.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PEEPHOLE_MAX_OPERANDS 3
+#define PEEPHOLE_OPERAND_SIZE 96
+// How many instructions the rules look ahead
+#define PEEPHOLE_WINDOW 32
+
+enum LineKind {
+  LINE_TRANSPARENT, // blank line, comment or %line directive
+  LINE_BARRIER,     // label, directive or jump: ends a basic block
+  LINE_RET,
+  LINE_INSN,
+};
+
+struct Insn {
+  char *text; // the line without its newline, NULL once deleted
+  enum LineKind kind;
+  char mnemonic[16];
+  char operands[PEEPHOLE_MAX_OPERANDS][PEEPHOLE_OPERAND_SIZE];
+  int num_operands;
+};
+
+struct InsnList {
+  struct Insn *insns;
+  size_t len;
+  size_t capacity;
+};
+
+// --- Registers ---
+
+enum {
+  REG_RAX,
+  REG_RBX,
+  REG_RCX,
+  REG_RDX,
+  REG_RSI,
+  REG_RDI,
+  REG_RBP,
+  REG_RSP,
+  REG_R8,
+  REG_R9,
+  REG_R10,
+  REG_R11,
+  NUM_REGISTERS = 16
+};
+
+// Every name of each general purpose register, 64-bit name first
+static const char *const registers[NUM_REGISTERS][5] = {
+    {"rax", "eax", "ax", "al", "ah"},
+    {"rbx", "ebx", "bx", "bl", "bh"},
+    {"rcx", "ecx", "cx", "cl", "ch"},
+    {"rdx", "edx", "dx", "dl", "dh"},
+    {"rsi", "esi", "si", "sil", NULL},
+    {"rdi", "edi", "di", "dil", NULL},
+    {"rbp", "ebp", "bp", "bpl", NULL},
+    {"rsp", "esp", "sp", "spl", NULL},
+    {"r8", "r8d", "r8w", "r8b", NULL},
+    {"r9", "r9d", "r9w", "r9b", NULL},
+    {"r10", "r10d", "r10w", "r10b", NULL},
+    {"r11", "r11d", "r11w", "r11b", NULL},
+    {"r12", "r12d", "r12w", "r12b", NULL},
+    {"r13", "r13d", "r13w", "r13b", NULL},
+    {"r14", "r14d", "r14w", "r14b", NULL},
+    {"r15", "r15d", "r15w", "r15b", NULL},
+};
+
+static bool is_argument_register(int reg) {
+  return reg == REG_RDI || reg == REG_RSI || reg == REG_RDX ||
+         reg == REG_RCX || reg == REG_R8 || reg == REG_R9;
+}
+
+// The register an operand names by its 64-bit name, or -1
+static int register_index(const char *operand) {
+  for (int r = 0; r < NUM_REGISTERS; ++r) {
+    if (strcmp(operand, registers[r][0]) == 0) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+// Whether text names any part of reg
+static bool mentions(const char *text, int reg) {
+  const char *p = text;
+  while (*p) {
+    if (!isalnum((unsigned char)*p) && *p != '_') {
+      p++;
+      continue;
+    }
+    const char *start = p;
+    while (isalnum((unsigned char)*p) || *p == '_') {
+      p++;
+    }
+    size_t len = (size_t)(p - start);
+    for (int n = 0; n < 5 && registers[reg][n]; ++n) {
+      if (strlen(registers[reg][n]) == len &&
+          strncmp(start, registers[reg][n], len) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool is_memory(const char *operand) {
+  return strchr(operand, '[') != NULL;
+}
+
+// --- Instructions ---
+
+static void parse_line(struct Insn *insn, char *text) {
+  insn->text = text;
+  insn->mnemonic[0] = '\0';
+  insn->num_operands = 0;
+
+  const char *p = text;
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  if (*p == '\0' || *p == ';' || *p == '%') {
+    insn->kind = LINE_TRANSPARENT;
+    return;
+  }
+  insn->kind = LINE_BARRIER;
+  if (p == text) {
+    return; // labels and directives start in column 0
+  }
+
+  char body[256];
+  size_t len = strcspn(p, ";");
+  if (len >= sizeof(body)) {
+    return;
+  }
+  memcpy(body, p, len);
+  while (len > 0 && isspace((unsigned char)body[len - 1])) {
+    len--;
+  }
+  body[len] = '\0';
+  if (len == 0 || body[len - 1] == ':') {
+    return;
+  }
+
+  size_t mnemonic_len = strcspn(body, " \t");
+  if (mnemonic_len >= sizeof(insn->mnemonic)) {
+    return;
+  }
+  memcpy(insn->mnemonic, body, mnemonic_len);
+  insn->mnemonic[mnemonic_len] = '\0';
+  if (insn->mnemonic[0] == 'j') {
+    return;
+  }
+  if (strcmp(insn->mnemonic, "ret") == 0) {
+    insn->kind = LINE_RET;
+    return;
+  }
+
+  char *rest = body + mnemonic_len;
+  while (*rest) {
+    while (isspace((unsigned char)*rest)) {
+      rest++;
+    }
+    size_t op_len = strcspn(rest, ",");
+    size_t end = op_len;
+    while (end > 0 && isspace((unsigned char)rest[end - 1])) {
+      end--;
+    }
+    if (insn->num_operands == PEEPHOLE_MAX_OPERANDS ||
+        end >= PEEPHOLE_OPERAND_SIZE) {
+      insn->mnemonic[0] = '\0';
+      insn->num_operands = 0;
+      return;
+    }
+    memcpy(insn->operands[insn->num_operands], rest, end);
+    insn->operands[insn->num_operands++][end] = '\0';
+    rest += op_len;
+    if (*rest == ',') {
+      rest++;
+    }
+  }
+  insn->kind = LINE_INSN;
+}
+
+static bool is_mnemonic(const struct Insn *insn, const char *mnemonic,
+                        int num_operands) {
+  return insn->text && insn->kind == LINE_INSN &&
+         insn->num_operands == num_operands &&
+         strcmp(insn->mnemonic, mnemonic) == 0;
+}
+
+// Register and memory moves: write their first operand, read the second
+static bool is_simple_move(const struct Insn *insn) {
+  return is_mnemonic(insn, "mov", 2) || is_mnemonic(insn, "movsd", 2) ||
+         is_mnemonic(insn, "movq", 2) || is_mnemonic(insn, "lea", 2);
+}
+
+// Instructions that only read the registers they name, besides flags and
+// a register operand they may also write
+static bool only_reads_named(const struct Insn *insn) {
+  static const char *const mnemonics[] = {
+      "push",  "cmp",   "test",  "ucomisd", "comisd",   "add",
+      "sub",   "and",   "or",    "xor",     "inc",      "dec",
+      "neg",   "not",   "addsd", "subsd",   "mulsd",    "divsd",
+      "sqrtsd", "cvtsi2sd"};
+  if (insn->kind != LINE_INSN || insn->num_operands == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); ++i) {
+    if (strcmp(insn->mnemonic, mnemonics[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool insn_mentions(const struct Insn *insn, int reg) {
+  for (int i = 0; i < insn->num_operands; ++i) {
+    if (mentions(insn->operands[i], reg)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void delete_insn(struct Insn *insn) {
+  free(insn->text);
+  insn->text = NULL;
+}
+
+static void rewrite_mov(struct Insn *insn, const char *dst, const char *src) {
+  size_t size = strlen(dst) + strlen(src) + 16;
+  char *text = malloc(size);
+  if (!text) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(text, size, "  mov %s, %s", dst, src);
+  free(insn->text);
+  parse_line(insn, text);
+}
+
+// The next instruction, label or directive after i, or list->len
+static size_t next_insn(const struct InsnList *list, size_t i) {
+  for (++i; i < list->len; ++i) {
+    if (list->insns[i].text && list->insns[i].kind != LINE_TRANSPARENT) {
+      break;
+    }
+  }
+  return i;
+}
+
+// --- Rules ---
+
+enum Effect { EFFECT_NONE, EFFECT_READ, EFFECT_KILL, EFFECT_UNKNOWN };
+
+// What insn does to reg, as far as an earlier write to reg is concerned.
+// Calls are to functions without variadic arguments, so they do not read
+// rax.
+static enum Effect effect_on(const struct Insn *insn, int reg) {
+  if (insn->kind == LINE_RET) {
+    return reg == REG_RAX || reg == REG_RSP || reg == REG_RBP ? EFFECT_READ
+                                                              : EFFECT_KILL;
+  }
+  if (insn->kind != LINE_INSN) {
+    return EFFECT_UNKNOWN;
+  }
+  if (is_mnemonic(insn, "call", 1)) {
+    if (insn_mentions(insn, reg) || is_argument_register(reg) ||
+        reg == REG_RSP) {
+      return EFFECT_READ;
+    }
+    return reg == REG_RAX || reg == REG_R10 || reg == REG_R11 ? EFFECT_KILL
+                                                              : EFFECT_NONE;
+  }
+  if (is_simple_move(insn)) {
+    const char *dst = insn->operands[0];
+    if (mentions(insn->operands[1], reg) ||
+        (is_memory(dst) && mentions(dst, reg))) {
+      return EFFECT_READ;
+    }
+    if (register_index(dst) == reg) {
+      return EFFECT_KILL;
+    }
+    // A write to part of reg keeps the rest
+    return mentions(dst, reg) ? EFFECT_READ : EFFECT_NONE;
+  }
+  if (is_mnemonic(insn, "pop", 1)) {
+    if (reg == REG_RSP) {
+      return EFFECT_READ;
+    }
+    if (register_index(insn->operands[0]) == reg) {
+      return EFFECT_KILL;
+    }
+    return insn_mentions(insn, reg) ? EFFECT_READ : EFFECT_NONE;
+  }
+  if (only_reads_named(insn)) {
+    if (reg == REG_RSP && strcmp(insn->mnemonic, "push") == 0) {
+      return EFFECT_READ;
+    }
+    return insn_mentions(insn, reg) ? EFFECT_READ : EFFECT_NONE;
+  }
+  return EFFECT_UNKNOWN;
+}
+
+// mov reg, reg
+static bool remove_self_move(struct Insn *insn) {
+  if (is_mnemonic(insn, "mov", 2) && register_index(insn->operands[0]) >= 0 &&
+      strcmp(insn->operands[0], insn->operands[1]) == 0) {
+    delete_insn(insn);
+    return true;
+  }
+  return false;
+}
+
+// push x ... pop y, with only moves that touch neither y nor the stack in
+// between, becomes mov y, x in place of the push
+static bool fold_push_pop(struct InsnList *list, size_t i) {
+  struct Insn *push = &list->insns[i];
+  if (!is_mnemonic(push, "push", 1)) {
+    return false;
+  }
+  int src = register_index(push->operands[0]);
+  if (src < 0 || src == REG_RSP) {
+    return false;
+  }
+
+  size_t j = i;
+  for (int n = 0; n < PEEPHOLE_WINDOW; ++n) {
+    j = next_insn(list, j);
+    if (j == list->len) {
+      return false;
+    }
+    struct Insn *insn = &list->insns[j];
+    if (is_mnemonic(insn, "pop", 1)) {
+      break;
+    }
+    if (!is_simple_move(insn) || insn_mentions(insn, REG_RSP)) {
+      return false;
+    }
+  }
+  struct Insn *pop = &list->insns[j];
+  if (!is_mnemonic(pop, "pop", 1)) {
+    return false;
+  }
+
+  const char *dst = pop->operands[0];
+  int dst_reg = register_index(dst);
+  const char *slot = strstr(dst, "[rbp - ");
+  if (dst_reg < 0 && !slot) {
+    return false;
+  }
+  for (size_t k = next_insn(list, i); k < j; k = next_insn(list, k)) {
+    const struct Insn *insn = &list->insns[k];
+    if (dst_reg >= 0 ? insn_mentions(insn, dst_reg)
+                     : strstr(insn->operands[0], slot) ||
+                           strstr(insn->operands[1], slot)) {
+      return false;
+    }
+  }
+
+  if (dst_reg == src) {
+    delete_insn(push);
+  } else {
+    char src_name[PEEPHOLE_OPERAND_SIZE];
+    strcpy(src_name, push->operands[0]);
+    rewrite_mov(push, dst, src_name);
+  }
+  delete_insn(pop);
+  return true;
+}
+
+// mov [m], reg followed by mov reg, [m]
+static bool remove_reload(struct InsnList *list, size_t i) {
+  struct Insn *store = &list->insns[i];
+  if (!is_mnemonic(store, "mov", 2) || !is_memory(store->operands[0]) ||
+      register_index(store->operands[1]) < 0) {
+    return false;
+  }
+  size_t j = next_insn(list, i);
+  if (j == list->len) {
+    return false;
+  }
+  struct Insn *load = &list->insns[j];
+  if (!is_mnemonic(load, "mov", 2) ||
+      strcmp(load->operands[0], store->operands[1]) != 0 ||
+      strcmp(strchr(load->operands[1], '[') ? strchr(load->operands[1], '[')
+                                            : "",
+             strchr(store->operands[0], '[')) != 0) {
+    return false;
+  }
+  delete_insn(load);
+  return true;
+}
+
+// After mov a, b and until a or b change, stores of a store b instead, and
+// a mov b, a is redundant
+static bool forward_copy(struct InsnList *list, size_t i,
+                         struct PeepholeStats *stats) {
+  struct Insn *copy = &list->insns[i];
+  if (!is_mnemonic(copy, "mov", 2)) {
+    return false;
+  }
+  int a = register_index(copy->operands[0]);
+  int b = register_index(copy->operands[1]);
+  if (a < 0 || b < 0 || a == b || a == REG_RSP || b == REG_RSP) {
+    return false;
+  }
+
+  bool changed = false;
+  size_t j = i;
+  for (int n = 0; n < PEEPHOLE_WINDOW; ++n) {
+    j = next_insn(list, j);
+    if (j == list->len) {
+      break;
+    }
+    struct Insn *insn = &list->insns[j];
+    if (!is_mnemonic(insn, "mov", 2)) {
+      break;
+    }
+    if (register_index(insn->operands[0]) == b &&
+        register_index(insn->operands[1]) == a) {
+      delete_insn(insn);
+      stats->moves_removed++;
+      return true;
+    }
+    if (!is_memory(insn->operands[0])) {
+      break;
+    }
+    if (register_index(insn->operands[1]) == a) {
+      char dst[PEEPHOLE_OPERAND_SIZE];
+      strcpy(dst, insn->operands[0]);
+      rewrite_mov(insn, dst, registers[b][0]);
+      stats->copies_propagated++;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// mov a, x followed by mov b, a loads b from x directly, which often leaves
+// the first move dead
+static bool propagate_load(struct InsnList *list, size_t i) {
+  struct Insn *load = &list->insns[i];
+  if (!is_mnemonic(load, "mov", 2)) {
+    return false;
+  }
+  int a = register_index(load->operands[0]);
+  if (a < 0 || a == REG_RSP || register_index(load->operands[1]) >= 0 ||
+      mentions(load->operands[1], a)) {
+    return false;
+  }
+  size_t j = next_insn(list, i);
+  if (j == list->len) {
+    return false;
+  }
+  struct Insn *copy = &list->insns[j];
+  int b = is_mnemonic(copy, "mov", 2) ? register_index(copy->operands[0]) : -1;
+  if (b < 0 || b == a || register_index(copy->operands[1]) != a ||
+      mentions(load->operands[1], b)) {
+    return false;
+  }
+  char dst[PEEPHOLE_OPERAND_SIZE];
+  strcpy(dst, copy->operands[0]);
+  rewrite_mov(copy, dst, load->operands[1]);
+  return true;
+}
+
+// A register write that is overwritten before anything reads it
+static bool remove_dead_store(struct InsnList *list, size_t i) {
+  struct Insn *insn = &list->insns[i];
+  if (!is_mnemonic(insn, "mov", 2) && !is_mnemonic(insn, "movq", 2) &&
+      !is_mnemonic(insn, "lea", 2)) {
+    return false;
+  }
+  int reg = register_index(insn->operands[0]);
+  if (reg < 0 || reg == REG_RSP || reg == REG_RBP) {
+    return false;
+  }
+  size_t j = i;
+  for (int n = 0; n < PEEPHOLE_WINDOW; ++n) {
+    j = next_insn(list, j);
+    if (j == list->len) {
+      return false;
+    }
+    switch (effect_on(&list->insns[j], reg)) {
+    case EFFECT_NONE:
+      continue;
+    case EFFECT_KILL:
+      delete_insn(insn);
+      return true;
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+static bool optimize_pass(struct InsnList *list, struct PeepholeStats *stats) {
+  bool changed = false;
+  for (size_t i = 0; i < list->len; ++i) {
+    struct Insn *insn = &list->insns[i];
+    if (!insn->text || insn->kind != LINE_INSN) {
+      continue;
+    }
+    if (remove_self_move(insn)) {
+      stats->moves_removed++;
+      changed = true;
+    } else if (fold_push_pop(list, i)) {
+      stats->push_pop_folded++;
+      changed = true;
+    } else if (remove_reload(list, i)) {
+      stats->moves_removed++;
+      changed = true;
+    } else if (forward_copy(list, i, stats)) {
+      changed = true;
+    } else if (propagate_load(list, i)) {
+      stats->copies_propagated++;
+      changed = true;
+    } else if (remove_dead_store(list, i)) {
+      stats->dead_stores_removed++;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// --- Driver ---
+
+static void append_line(struct InsnList *list, char *text) {
+  if (list->len == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+    struct Insn *insns = realloc(list->insns, capacity * sizeof(struct Insn));
+    if (!insns) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    list->insns = insns;
+    list->capacity = capacity;
+  }
+  parse_line(&list->insns[list->len++], text);
+}
+
+int peephole_copy(FILE *out, FILE *in, struct PeepholeStats *stats) {
+  struct InsnList list = {0};
+  char *line = NULL;
+  size_t line_capacity = 0;
+  ssize_t len;
+  rewind(in);
+  while ((len = getline(&line, &line_capacity, in)) != -1) {
+    if (len > 0 && line[len - 1] == '\n') {
+      line[len - 1] = '\0';
+    }
+    char *text = strdup(line);
+    if (!text) {
+      perror("strdup");
+      exit(EXIT_FAILURE);
+    }
+    append_line(&list, text);
+    if (list.insns[list.len - 1].kind == LINE_INSN ||
+        list.insns[list.len - 1].kind == LINE_RET) {
+      stats->instructions++;
+    }
+  }
+  free(line);
+  int result = 0;
+  if (ferror(in)) {
+    perror("getline failed in peephole_copy");
+    result = -1;
+  }
+
+  while (optimize_pass(&list, stats)) {
+  }
+
+  for (size_t i = 0; i < list.len; ++i) {
+    if (list.insns[i].text) {
+      if (result == 0 && fprintf(out, "%s\n", list.insns[i].text) < 0) {
+        perror("fprintf failed in peephole_copy");
+        result = -1;
+      }
+      free(list.insns[i].text);
+    }
+  }
+  free(list.insns);
+  return result;
+}
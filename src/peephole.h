@@ -0,0 +1,20 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+
+// Counters for --stats.
+struct PeepholeStats
+{
+  size_t instructions;        // instructions read
+  size_t push_pop_folded;     // push/pop pairs turned into a mov or removed
+  size_t moves_removed;       // self moves, reloads and moves back
+  size_t copies_propagated;   // stores rewritten to use a move's source
+  size_t dead_stores_removed; // register writes overwritten before any read
+};
+
+// Copies the NASM instructions of a text section from in to out, rewriting
+// them within basic blocks. in is read from its start.
+int peephole_copy (FILE *out, FILE *in, struct PeepholeStats *stats);
+
+#endif
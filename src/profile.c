@@ -0,0 +1,193 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_MAX_COUNTS 2
+
+struct ProfileEntry {
+  char *key; // "<kind> <id>"
+  unsigned long counts[PROFILE_MAX_COUNTS];
+  size_t num_counts;
+};
+
+struct Profile {
+  struct ProfileEntry *entries; // sorted by key, one per key
+  size_t len;
+  unsigned long max_function_count;
+};
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const struct ProfileEntry *)a)->key,
+                ((const struct ProfileEntry *)b)->key);
+}
+
+static int compare_key(const void *key, const void *entry) {
+  return strcmp(key, ((const struct ProfileEntry *)entry)->key);
+}
+
+// Parses "<kind> <id> <count>..." into entry; false if line is malformed
+static bool parse_record(char *line, struct ProfileEntry *entry) {
+  char *kind = strtok(line, " \t\r\n");
+  char *id = strtok(NULL, " \t\r\n");
+  if (!kind || !id) {
+    return false;
+  }
+  entry->num_counts = 0;
+  char *field;
+  while ((field = strtok(NULL, " \t\r\n"))) {
+    char *end;
+    unsigned long count = strtoul(field, &end, 10);
+    if (*end != '\0' || entry->num_counts == PROFILE_MAX_COUNTS) {
+      return false;
+    }
+    entry->counts[entry->num_counts++] = count;
+  }
+  if (entry->num_counts == 0) {
+    return false;
+  }
+  size_t size = strlen(kind) + strlen(id) + 2;
+  entry->key = malloc(size);
+  if (!entry->key) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(entry->key, size, "%s %s", kind, id);
+  return true;
+}
+
+struct Profile *profile_read(const char *filename) {
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    perror("Error opening profile");
+    return NULL;
+  }
+  struct Profile *profile = calloc(1, sizeof(struct Profile));
+  if (!profile) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  size_t capacity = 0;
+  char line[1024];
+  size_t line_number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+      continue;
+    }
+    if (profile->len == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      struct ProfileEntry *entries =
+          realloc(profile->entries, capacity * sizeof(struct ProfileEntry));
+      if (!entries) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+      profile->entries = entries;
+    }
+    if (!parse_record(line, &profile->entries[profile->len])) {
+      fprintf(stderr, "%s:%zu: malformed profile record\n", filename,
+              line_number);
+      fclose(file);
+      profile_free(profile);
+      return NULL;
+    }
+    profile->len++;
+  }
+  fclose(file);
+
+  qsort(profile->entries, profile->len, sizeof(struct ProfileEntry),
+        compare_entries);
+  size_t kept = 0;
+  for (size_t i = 0; i < profile->len; ++i) {
+    struct ProfileEntry *entry = &profile->entries[i];
+    if (kept > 0 && strcmp(profile->entries[kept - 1].key, entry->key) == 0) {
+      struct ProfileEntry *first = &profile->entries[kept - 1];
+      for (size_t c = 0; c < entry->num_counts && c < first->num_counts; ++c) {
+        first->counts[c] += entry->counts[c];
+      }
+      free(entry->key);
+      continue;
+    }
+    profile->entries[kept++] = *entry;
+  }
+  profile->len = kept;
+
+  for (size_t i = 0; i < profile->len; ++i) {
+    struct ProfileEntry *entry = &profile->entries[i];
+    if (strncmp(entry->key, "function ", 9) == 0 &&
+        entry->counts[0] > profile->max_function_count) {
+      profile->max_function_count = entry->counts[0];
+    }
+  }
+  return profile;
+}
+
+void profile_free(struct Profile *profile) {
+  if (!profile) {
+    return;
+  }
+  for (size_t i = 0; i < profile->len; ++i) {
+    free(profile->entries[i].key);
+  }
+  free(profile->entries);
+  free(profile);
+}
+
+void profile_function_key(char *buffer, size_t size, const char *name) {
+  snprintf(buffer, size, "function %s", name);
+}
+
+void profile_branch_key(char *buffer, size_t size,
+                        const struct Expr *if_expr) {
+  snprintf(buffer, size, "if %zu:%zu", if_expr->start_line,
+           if_expr->start_col);
+}
+
+static const struct ProfileEntry *lookup(const struct Profile *profile,
+                                         const char *key) {
+  return bsearch(key, profile->entries, profile->len,
+                 sizeof(struct ProfileEntry), compare_key);
+}
+
+bool profile_function_count(const struct Profile *profile, const char *name,
+                            unsigned long *count) {
+  char key[256];
+  profile_function_key(key, sizeof(key), name);
+  const struct ProfileEntry *entry = lookup(profile, key);
+  if (!entry) {
+    return false;
+  }
+  *count = entry->counts[0];
+  return true;
+}
+
+enum ProfileHeat profile_function_heat(const struct Profile *profile,
+                                       const char *name) {
+  unsigned long count;
+  if (!profile || !profile_function_count(profile, name, &count)) {
+    return PROFILE_UNKNOWN;
+  }
+  if (count == 0) {
+    return PROFILE_COLD;
+  }
+  return count >= profile->max_function_count / PROFILE_HOT_FRACTION
+             ? PROFILE_HOT
+             : PROFILE_WARM;
+}
+
+bool profile_branch_counts(const struct Profile *profile,
+                           const struct Expr *if_expr,
+                           unsigned long *then_count,
+                           unsigned long *else_count) {
+  char key[64];
+  profile_branch_key(key, sizeof(key), if_expr);
+  const struct ProfileEntry *entry = lookup(profile, key);
+  if (!entry || entry->num_counts != 2) {
+    return false;
+  }
+  *then_count = entry->counts[0];
+  *else_count = entry->counts[1];
+  return true;
+}
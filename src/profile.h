@@ -0,0 +1,54 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "expr.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// A function whose entry count is at least 1/PROFILE_HOT_FRACTION of the
+// hottest one's is hot: it is inlined up to PROFILE_HOT_INLINE_FACTOR times
+// the usual size. One never entered is cold (see callgraph_layout).
+#define PROFILE_HOT_FRACTION 16
+#define PROFILE_HOT_INLINE_FACTOR 4
+
+// Profile file written at exit by a program compiled with
+// --profile-generate (see LispPgoCounter), one counter record per line:
+//
+//   function <name> <entries>
+//   if <line>:<col> <then taken> <else taken>
+//
+// Lines starting with '#' are comments. Records with the same key, such as
+// two copies of one if, are added together when the file is read.
+struct Profile;
+
+enum ProfileHeat
+{
+  PROFILE_UNKNOWN, // not in the profile
+  PROFILE_COLD,    // never entered while profiling
+  PROFILE_WARM,
+  PROFILE_HOT,
+};
+
+// Reads a profile file; prints why and returns NULL if it cannot.
+struct Profile *profile_read (const char *filename);
+void profile_free (struct Profile *profile);
+
+// Keys of the counters the compiler emits for a function and for an if.
+void profile_function_key (char *buffer, size_t size, const char *name);
+void profile_branch_key (char *buffer, size_t size,
+                         const struct Expr *if_expr);
+
+// Entry count of the global function name; false if it is not in profile.
+bool profile_function_count (const struct Profile *profile, const char *name,
+                             unsigned long *count);
+enum ProfileHeat profile_function_heat (const struct Profile *profile,
+                                        const char *name);
+
+// How often the then and else branches of if_expr were taken; false if it
+// is not in profile.
+bool profile_branch_counts (const struct Profile *profile,
+                            const struct Expr *if_expr,
+                            unsigned long *then_count,
+                            unsigned long *else_count);
+
+#endif
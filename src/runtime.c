@@ -1,26 +1,275 @@
+#ifdef LISP_PROFILE
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#endif
 #include "lispvalue.h"
+#include <errno.h>
+#include <float.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-struct LispValue *lisp_make_number(double num) {
-  struct LispValue *result =
-      (struct LispValue *)malloc(sizeof(struct LispValue));
+// Guards the little state that tasks on several threads may share: memo
+// tables, the output buffer, the profile and the pair space frontier. Held
+// for short stretches only, so waiters spin instead of sleeping.
+static void runtime_lock(int *lock) {
+  while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__)
+      __builtin_ia32_pause();
+#endif
+    }
+  }
+}
+
+static void runtime_unlock(int *lock) {
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#ifdef LISP_PROFILE
+// Profiling build (obj/runtime_prof.o): every entry point counts its calls
+// and the bytes it allocates, both globally and per calling site. Call sites
+// are resolved to the enclosing generated function with dladdr at exit, so
+// link with -rdynamic to get names instead of addresses. The summary goes
+// to stderr, or to the file named by LISP_PROFILE_OUT.
+
+enum ProfileEntry {
+  PROF_MAKE_NUMBER,
+  PROF_ADD,
+  PROF_SUBTRACT,
+  PROF_MULTIPLY,
+  PROF_DIVIDE,
+  PROF_NUM_EQ,
+  PROF_NUM_LT,
+  PROF_NUM_GT,
+  PROF_NUM_LE,
+  PROF_NUM_GE,
+  PROF_CONS,
+  PROF_LIST,
+  PROF_MAKE_VECTOR,
+  PROF_STRING,
+  PROF_CLOSURE,
+  PROF_SPAWN,
+  PROF_NUM_ENTRIES
+};
+
+static const char *profile_entry_names[PROF_NUM_ENTRIES] = {
+    "lisp_make_number", "lisp_add",    "lisp_subtract", "lisp_multiply",
+    "lisp_divide",      "lisp_num_eq", "lisp_num_lt",   "lisp_num_gt",
+    "lisp_num_le",      "lisp_num_ge", "lisp_cons",     "lisp_list",
+    "lisp_make_vector", "lisp_string", "lisp_make_closure", "lisp_spawn"};
+
+struct ProfileCounter {
+  unsigned long calls;
+  unsigned long bytes;
+};
+
+#define PROFILE_SITE_CAPACITY 4096
+
+struct ProfileSite {
+  void *caller;
+  enum ProfileEntry entry;
+  struct ProfileCounter counter;
+};
+
+static struct ProfileCounter profile_totals[PROF_NUM_ENTRIES];
+static struct ProfileSite profile_sites[PROFILE_SITE_CAPACITY];
+static unsigned long profile_dropped_sites;
+static int profile_lock;
+
+static void profile_count(enum ProfileEntry entry, size_t bytes,
+                          void *caller) {
+  profile_totals[entry].calls++;
+  profile_totals[entry].bytes += bytes;
+
+  size_t hash = ((size_t)caller >> 2) * 31 + entry;
+  for (size_t probe = 0; probe < PROFILE_SITE_CAPACITY; ++probe) {
+    struct ProfileSite *site =
+        &profile_sites[(hash + probe) % PROFILE_SITE_CAPACITY];
+    if (site->caller == NULL) {
+      site->caller = caller;
+      site->entry = entry;
+    }
+    if (site->caller == caller && site->entry == entry) {
+      site->counter.calls++;
+      site->counter.bytes += bytes;
+      return;
+    }
+  }
+  profile_dropped_sites++;
+}
+
+static void profile_record(enum ProfileEntry entry, size_t bytes,
+                           void *caller) {
+  runtime_lock(&profile_lock);
+  profile_count(entry, bytes, caller);
+  runtime_unlock(&profile_lock);
+}
+
+static const char *profile_caller_name(void *caller) {
+  Dl_info info;
+  if (dladdr(caller, &info) && info.dli_sname) {
+    return info.dli_sname;
+  }
+  return NULL;
+}
+
+// Tables of define-memo functions, listed once they are first used
+static struct LispMemo *profile_memos;
+
+static void profile_dump_memos(FILE *out) {
+  if (!profile_memos) {
+    return;
+  }
+  fprintf(out, "\n%-28s %10s %14s %14s %10s\n", "define-memo", "entries",
+          "hits", "misses", "evictions");
+  for (struct LispMemo *memo = profile_memos; memo; memo = memo->next) {
+    fprintf(out, "%-28s %10zu %14lu %14lu %10lu\n", memo->name, memo->count,
+            memo->hits, memo->misses, memo->evictions);
+  }
+}
+
+static void profile_dump(void) {
+  FILE *out = stderr;
+  const char *path = getenv("LISP_PROFILE_OUT");
+  if (path && (out = fopen(path, "w")) == NULL) {
+    perror("Could not open LISP_PROFILE_OUT");
+    out = stderr;
+  }
+
+  fprintf(out, "--- Lisp runtime profile ---\n");
+  fprintf(out, "%-20s %14s %14s\n", "entry point", "calls", "bytes");
+  for (int e = 0; e < PROF_NUM_ENTRIES; ++e) {
+    if (profile_totals[e].calls == 0) {
+      continue;
+    }
+    fprintf(out, "%-20s %14lu %14lu\n", profile_entry_names[e],
+            profile_totals[e].calls, profile_totals[e].bytes);
+  }
+
+  // Merge call sites by enclosing function before printing
+  static struct ProfileSite merged[PROFILE_SITE_CAPACITY];
+  static const char *merged_names[PROFILE_SITE_CAPACITY];
+  size_t num_merged = 0;
+  for (size_t i = 0; i < PROFILE_SITE_CAPACITY; ++i) {
+    struct ProfileSite *site = &profile_sites[i];
+    if (site->caller == NULL) {
+      continue;
+    }
+    const char *name = profile_caller_name(site->caller);
+    void *key = name ? NULL : site->caller;
+    size_t j = 0;
+    for (; j < num_merged; ++j) {
+      if (merged[j].entry == site->entry && merged[j].caller == key &&
+          (key != NULL || strcmp(merged_names[j], name) == 0)) {
+        break;
+      }
+    }
+    if (j == num_merged) {
+      merged[j] = (struct ProfileSite){.caller = key, .entry = site->entry};
+      merged_names[j] = name;
+      num_merged++;
+    }
+    merged[j].counter.calls += site->counter.calls;
+    merged[j].counter.bytes += site->counter.bytes;
+  }
+
+  fprintf(out, "\n%-28s %-20s %14s %14s\n", "caller", "entry point",
+          "calls", "bytes");
+  for (size_t i = 0; i < num_merged; ++i) {
+    char addr_buf[32];
+    const char *name = merged_names[i];
+    if (!name) {
+      snprintf(addr_buf, sizeof(addr_buf), "%p", merged[i].caller);
+      name = addr_buf;
+    }
+    fprintf(out, "%-28s %-20s %14lu %14lu\n", name,
+            profile_entry_names[merged[i].entry], merged[i].counter.calls,
+            merged[i].counter.bytes);
+  }
+  if (profile_dropped_sites) {
+    fprintf(out, "(%lu calls from untracked sites)\n", profile_dropped_sites);
+  }
+  profile_dump_memos(out);
+  fprintf(out, "----------------------------\n");
+
+  if (out != stderr) {
+    fclose(out);
+  }
+}
+
+__attribute__((constructor)) static void profile_init(void) {
+  atexit(profile_dump);
+}
+
+#define PROFILE_ENTRY(entry, bytes)                                            \
+  profile_record(entry, bytes, __builtin_return_address(0))
+#define PROFILE_MEMO(memo)                                                     \
+  (runtime_lock(&profile_lock), (memo)->next = profile_memos,                  \
+   profile_memos = (memo), runtime_unlock(&profile_lock))
+#else
+#define PROFILE_ENTRY(entry, bytes) ((void)0)
+#define PROFILE_MEMO(memo) ((void)0)
+#endif
+
+// --- Allocation ---
+// Nothing the program allocates is ever freed. Small objects are carved out
+// of a thread-local allocation buffer, so that tasks on different threads
+// allocate without synchronizing and most allocations are a pointer bump;
+// larger ones, and the buffers themselves, come from malloc.
+
+#define TLAB_BYTES ((size_t)1 << 16)
+#define TLAB_MAX_OBJECT_BYTES (TLAB_BYTES / 16)
+
+static _Thread_local char *tlab_next;
+static _Thread_local char *tlab_end;
+
+static void *checked_malloc(size_t bytes, const char *who) {
+  void *result = malloc(bytes);
   if (!result) {
-    perror("malloc failed in lisp_make_number");
+    char msg[64];
+    snprintf(msg, sizeof(msg), "malloc failed in %s", who);
+    perror(msg);
     exit(1);
   }
+  return result;
+}
+
+// 16-byte aligned, like malloc
+static void *alloc_object(size_t bytes, const char *who) {
+  bytes = (bytes + 15) & ~(size_t)15;
+  if (bytes > TLAB_MAX_OBJECT_BYTES) {
+    return checked_malloc(bytes, who);
+  }
+  if ((size_t)(tlab_end - tlab_next) < bytes) {
+    tlab_next = checked_malloc(TLAB_BYTES, who);
+    tlab_end = tlab_next + TLAB_BYTES;
+  }
+  void *object = tlab_next;
+  tlab_next += bytes;
+  return object;
+}
+
+static struct LispValue *alloc_value(const char *who) {
+  return alloc_object(sizeof(struct LispValue), who);
+}
+
+struct LispValue *lisp_make_number(double num) {
+  PROFILE_ENTRY(PROF_MAKE_NUMBER, sizeof(struct LispValue));
+  struct LispValue *result = alloc_value("lisp_make_number");
   result->type = LVAL_NUM;
   result->value.num_val = num;
   return result;
 }
 
 struct LispValue *lisp_add(struct LispValue *arg1, struct LispValue *arg2) {
-  struct LispValue *result =
-      (struct LispValue *)malloc(sizeof(struct LispValue));
-  if (!result) {
-    perror("malloc failed in lisp_add");
-    exit(1);
-  }
+  PROFILE_ENTRY(PROF_ADD, sizeof(struct LispValue));
+  struct LispValue *result = alloc_value("lisp_add");
 
   result->type = LVAL_NUM;
   result->value.num_val = arg1->value.num_val + arg2->value.num_val;
@@ -31,12 +280,8 @@ struct LispValue *lisp_add(struct LispValue *arg1, struct LispValue *arg2) {
 
 struct LispValue *lisp_subtract(struct LispValue *arg1,
                                 struct LispValue *arg2) {
-  struct LispValue *result =
-      (struct LispValue *)malloc(sizeof(struct LispValue));
-  if (!result) {
-    perror("malloc failed in lisp_subtract");
-    exit(1);
-  }
+  PROFILE_ENTRY(PROF_SUBTRACT, sizeof(struct LispValue));
+  struct LispValue *result = alloc_value("lisp_subtract");
 
   result->type = LVAL_NUM;
   result->value.num_val = arg1->value.num_val - arg2->value.num_val;
@@ -46,12 +291,8 @@ struct LispValue *lisp_subtract(struct LispValue *arg1,
 
 struct LispValue *lisp_multiply(struct LispValue *arg1,
                                 struct LispValue *arg2) {
-  struct LispValue *result =
-      (struct LispValue *)malloc(sizeof(struct LispValue));
-  if (!result) {
-    perror("malloc failed in lisp_multiply");
-    exit(1);
-  }
+  PROFILE_ENTRY(PROF_MULTIPLY, sizeof(struct LispValue));
+  struct LispValue *result = alloc_value("lisp_multiply");
 
   result->type = LVAL_NUM;
   result->value.num_val = arg1->value.num_val * arg2->value.num_val;
@@ -60,12 +301,8 @@ struct LispValue *lisp_multiply(struct LispValue *arg1,
 }
 
 struct LispValue *lisp_divide(struct LispValue *arg1, struct LispValue *arg2) {
-  struct LispValue *result =
-      (struct LispValue *)malloc(sizeof(struct LispValue));
-  if (!result) {
-    perror("malloc failed in lisp_divide");
-    exit(1);
-  }
+  PROFILE_ENTRY(PROF_DIVIDE, sizeof(struct LispValue));
+  struct LispValue *result = alloc_value("lisp_divide");
 
   result->type = LVAL_NUM;
   result->value.num_val = arg1->value.num_val / arg2->value.num_val;
@@ -73,7 +310,1556 @@ struct LispValue *lisp_divide(struct LispValue *arg1, struct LispValue *arg2) {
   return result;
 }
 
+// Comparisons return the #t and #f constants emitted into the data section of
+// every compiled program, so they never allocate.
+extern struct LispValue G_LISP_TRUE;
+extern struct LispValue G_LISP_NIL;
+
+static struct LispValue *lisp_bool(int condition) {
+  return condition ? &G_LISP_TRUE : &G_LISP_NIL;
+}
+
+struct LispValue *lisp_num_eq(struct LispValue *arg1, struct LispValue *arg2) {
+  PROFILE_ENTRY(PROF_NUM_EQ, 0);
+  return lisp_bool(arg1->value.num_val == arg2->value.num_val);
+}
+
+struct LispValue *lisp_num_lt(struct LispValue *arg1, struct LispValue *arg2) {
+  PROFILE_ENTRY(PROF_NUM_LT, 0);
+  return lisp_bool(arg1->value.num_val < arg2->value.num_val);
+}
+
+struct LispValue *lisp_num_gt(struct LispValue *arg1, struct LispValue *arg2) {
+  PROFILE_ENTRY(PROF_NUM_GT, 0);
+  return lisp_bool(arg1->value.num_val > arg2->value.num_val);
+}
+
+struct LispValue *lisp_num_le(struct LispValue *arg1, struct LispValue *arg2) {
+  PROFILE_ENTRY(PROF_NUM_LE, 0);
+  return lisp_bool(arg1->value.num_val <= arg2->value.num_val);
+}
+
+struct LispValue *lisp_num_ge(struct LispValue *arg1, struct LispValue *arg2) {
+  PROFILE_ENTRY(PROF_NUM_GE, 0);
+  return lisp_bool(arg1->value.num_val >= arg2->value.num_val);
+}
+
+// --- Pair space ---
+// Cons cells are bump-allocated from a single reserved region, so cells that
+// are allocated one after another (and every list built by lisp_list) sit
+// next to each other in memory. The region is mapped with MAP_NORESERVE, so
+// only the pages actually touched are committed. Each thread reserves runs
+// of PAIR_TLAB_PAIRS cells from the shared frontier and allocates from its
+// run; lists of more than a quarter of that get a run of their own.
+
+#define PAIR_SPACE_MAX_BYTES ((size_t)1 << 35)
+#define PAIR_SPACE_MIN_BYTES ((size_t)1 << 26)
+#define PAIR_TLAB_PAIRS 4096
+
+static struct LispPair *pair_space_start;
+static struct LispPair *pair_space_next; // end of the runs reserved so far
+static struct LispPair *pair_space_end;
+static int pair_space_lock;
+
+static _Thread_local struct LispPair *pair_tlab_next;
+static _Thread_local struct LispPair *pair_tlab_end;
+
+static void pair_space_init(void) {
+  for (size_t bytes = PAIR_SPACE_MAX_BYTES; bytes >= PAIR_SPACE_MIN_BYTES;
+       bytes /= 2) {
+    void *region = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region != MAP_FAILED) {
+      madvise(region, bytes, MADV_HUGEPAGE);
+      pair_space_start = region;
+      pair_space_next = region;
+      pair_space_end = (struct LispPair *)((char *)region + bytes);
+      return;
+    }
+  }
+  perror("mmap failed for the pair space");
+  exit(1);
+}
+
+static struct LispPair *reserve_pairs(size_t count) {
+  runtime_lock(&pair_space_lock);
+  if (pair_space_start == NULL) {
+    pair_space_init();
+  }
+  if ((size_t)(pair_space_end - pair_space_next) < count) {
+    fprintf(stderr, "Runtime error: pair space exhausted (%zu pairs).\n",
+            (size_t)(pair_space_next - pair_space_start));
+    exit(1);
+  }
+  struct LispPair *cells = pair_space_next;
+  __atomic_store_n(&pair_space_next, cells + count, __ATOMIC_RELEASE);
+  runtime_unlock(&pair_space_lock);
+  return cells;
+}
+
+static struct LispPair *alloc_pairs(size_t count) {
+  if (count > PAIR_TLAB_PAIRS / 4) {
+    return reserve_pairs(count);
+  }
+  if ((size_t)(pair_tlab_end - pair_tlab_next) < count) {
+    pair_tlab_next = reserve_pairs(PAIR_TLAB_PAIRS);
+    pair_tlab_end = pair_tlab_next + PAIR_TLAB_PAIRS;
+  }
+  struct LispPair *cells = pair_tlab_next;
+  pair_tlab_next += count;
+  return cells;
+}
+
+// Cells reserved by another thread but not handed out yet hold no values, so
+// testing against the shared frontier is exact
+static int lisp_is_pair(const struct LispValue *value) {
+  const struct LispPair *p = (const struct LispPair *)value;
+  return p >= pair_space_start &&
+         p < __atomic_load_n(&pair_space_next, __ATOMIC_RELAXED);
+}
+
+static struct LispPair *checked_pair(struct LispValue *value, const char *who) {
+  if (!lisp_is_pair(value)) {
+    fprintf(stderr, "Runtime error: %s: argument is not a pair.\n", who);
+    exit(1);
+  }
+  return (struct LispPair *)value;
+}
+
+struct LispValue *lisp_cons(struct LispValue *car, struct LispValue *cdr) {
+  PROFILE_ENTRY(PROF_CONS, sizeof(struct LispPair));
+  struct LispPair *cell = alloc_pairs(1);
+  cell->car = car;
+  cell->cdr = cdr;
+  return (struct LispValue *)cell;
+}
+
+// Builds (args[0] ... args[count - 1]) in one contiguous block, so that
+// walking the list reads the cells sequentially.
+struct LispValue *lisp_list(size_t count, struct LispValue **args) {
+  PROFILE_ENTRY(PROF_LIST, count * sizeof(struct LispPair));
+  if (count == 0) {
+    return &G_LISP_NIL;
+  }
+  struct LispPair *cells = alloc_pairs(count);
+  for (size_t i = 0; i < count; ++i) {
+    cells[i].car = args[i];
+    cells[i].cdr = (struct LispValue *)&cells[i + 1];
+  }
+  cells[count - 1].cdr = &G_LISP_NIL;
+  return (struct LispValue *)cells;
+}
+
+struct LispValue *lisp_car(struct LispValue *pair) {
+  return checked_pair(pair, "car")->car;
+}
+
+struct LispValue *lisp_cdr(struct LispValue *pair) {
+  return checked_pair(pair, "cdr")->cdr;
+}
+
+struct LispValue *lisp_null_p(struct LispValue *value) {
+  return lisp_bool(value == &G_LISP_NIL);
+}
+
+struct LispValue *lisp_pair_p(struct LispValue *value) {
+  return lisp_bool(lisp_is_pair(value));
+}
+
+// --- Vectors ---
+// LVAL_VEC values own a contiguous, 32-byte aligned double[], so vector-ref
+// and vector-set! are O(1). The bulk operations run on SIMD kernels picked
+// once at startup from what the CPU supports (AVX2, SSE2, or plain scalar
+// loops elsewhere); LISP_SIMD=scalar|sse2|avx2 overrides the choice. The
+// kernels are written once with GCC vector extensions and stamped out per
+// instruction set with target attributes.
+
+struct VectorKernels {
+  const char *name;
+  double (*sum)(const double *a, size_t n);
+  double (*dot)(const double *a, const double *b, size_t n);
+  // b == NULL broadcasts scalar over every element
+  void (*map)(enum LispVectorOp op, double *out, const double *a,
+              const double *b, double scalar, size_t n);
+};
+
+#define VECTOR_MAP_LOOP(vec_t, lanes, OP)                                      \
+  do {                                                                         \
+    size_t i = 0;                                                              \
+    if (b) {                                                                   \
+      for (; i + (lanes) <= n; i += (lanes)) {                                 \
+        *(vec_t *)(out + i) =                                                  \
+            *(const vec_t *)(a + i) OP * (const vec_t *)(b + i);               \
+      }                                                                        \
+      for (; i < n; ++i) {                                                     \
+        out[i] = a[i] OP b[i];                                                 \
+      }                                                                        \
+    } else {                                                                   \
+      vec_t s = (vec_t){0} + scalar;                                           \
+      for (; i + (lanes) <= n; i += (lanes)) {                                 \
+        *(vec_t *)(out + i) = *(const vec_t *)(a + i) OP s;                    \
+      }                                                                        \
+      for (; i < n; ++i) {                                                     \
+        out[i] = a[i] OP scalar;                                               \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+// Sums use two accumulators to hide the latency of the vector add
+#define DEFINE_VECTOR_KERNELS(isa, target_attr, lanes)                         \
+  typedef double isa##_vec                                                     \
+      __attribute__((vector_size((lanes) * sizeof(double)), aligned(8)));      \
+                                                                               \
+  target_attr static double isa##_sum(const double *a, size_t n) {             \
+    isa##_vec acc0 = {0}, acc1 = {0};                                          \
+    size_t i = 0;                                                              \
+    for (; i + 2 * (lanes) <= n; i += 2 * (lanes)) {                           \
+      acc0 += *(const isa##_vec *)(a + i);                                     \
+      acc1 += *(const isa##_vec *)(a + i + (lanes));                           \
+    }                                                                          \
+    acc0 += acc1;                                                              \
+    double sum = 0;                                                            \
+    for (int l = 0; l < (lanes); ++l) {                                        \
+      sum += acc0[l];                                                          \
+    }                                                                          \
+    for (; i < n; ++i) {                                                       \
+      sum += a[i];                                                             \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+                                                                               \
+  target_attr static double isa##_dot(const double *a, const double *b,        \
+                                      size_t n) {                              \
+    isa##_vec acc0 = {0}, acc1 = {0};                                          \
+    size_t i = 0;                                                              \
+    for (; i + 2 * (lanes) <= n; i += 2 * (lanes)) {                           \
+      acc0 += *(const isa##_vec *)(a + i) * *(const isa##_vec *)(b + i);       \
+      acc1 += *(const isa##_vec *)(a + i + (lanes)) *                          \
+              *(const isa##_vec *)(b + i + (lanes));                           \
+    }                                                                          \
+    acc0 += acc1;                                                              \
+    double sum = 0;                                                            \
+    for (int l = 0; l < (lanes); ++l) {                                        \
+      sum += acc0[l];                                                          \
+    }                                                                          \
+    for (; i < n; ++i) {                                                       \
+      sum += a[i] * b[i];                                                      \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+                                                                               \
+  target_attr static void isa##_map(enum LispVectorOp op, double *out,         \
+                                    const double *a, const double *b,          \
+                                    double scalar, size_t n) {                 \
+    switch (op) {                                                              \
+    case LISP_VECTOR_ADD:                                                      \
+      VECTOR_MAP_LOOP(isa##_vec, lanes, +);                                    \
+      break;                                                                   \
+    case LISP_VECTOR_SUB:                                                      \
+      VECTOR_MAP_LOOP(isa##_vec, lanes, -);                                    \
+      break;                                                                   \
+    case LISP_VECTOR_MUL:                                                      \
+      VECTOR_MAP_LOOP(isa##_vec, lanes, *);                                    \
+      break;                                                                   \
+    case LISP_VECTOR_DIV:                                                      \
+      VECTOR_MAP_LOOP(isa##_vec, lanes, /);                                    \
+      break;                                                                   \
+    }                                                                          \
+  }
+
+DEFINE_VECTOR_KERNELS(scalar, , 1)
+#if defined(__x86_64__)
+DEFINE_VECTOR_KERNELS(sse2, __attribute__((target("sse2"))), 2)
+DEFINE_VECTOR_KERNELS(avx2, __attribute__((target("avx2"))), 4)
+#endif
+
+static const struct VectorKernels vector_kernel_table[] = {
+    {"scalar", scalar_sum, scalar_dot, scalar_map},
+#if defined(__x86_64__)
+    {"sse2", sse2_sum, sse2_dot, sse2_map},
+    {"avx2", avx2_sum, avx2_dot, avx2_map},
+#endif
+};
+#define NUM_VECTOR_KERNELS                                                     \
+  (sizeof(vector_kernel_table) / sizeof(vector_kernel_table[0]))
+
+static const struct VectorKernels *vector_kernels = &vector_kernel_table[0];
+
+static int cpu_supports_kernels(const char *name) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+__attribute__((constructor)) static void vector_kernels_init(void) {
+  const char *forced = getenv("LISP_SIMD");
+  for (size_t i = NUM_VECTOR_KERNELS; i-- > 0;) {
+    const char *name = vector_kernel_table[i].name;
+    if (forced && strcmp(forced, name) != 0) {
+      continue;
+    }
+    if (cpu_supports_kernels(name)) {
+      vector_kernels = &vector_kernel_table[i];
+      return;
+    }
+  }
+  if (forced) {
+    fprintf(stderr, "Warning: LISP_SIMD=%s is not available, using %s.\n",
+            forced, vector_kernels->name);
+  }
+}
+
+const char *lisp_vector_kernels_name(void) { return vector_kernels->name; }
+
+static struct LispVector *checked_vector(struct LispValue *value,
+                                         const char *who) {
+  if (lisp_is_pair(value) || value->type != LVAL_VEC) {
+    fprintf(stderr, "Runtime error: %s: argument is not a vector.\n", who);
+    exit(1);
+  }
+  return value->value.vec_val;
+}
+
+static double checked_number(struct LispValue *value, const char *who) {
+  if (lisp_is_pair(value) || value->type != LVAL_NUM) {
+    fprintf(stderr, "Runtime error: %s: argument is not a number.\n", who);
+    exit(1);
+  }
+  return value->value.num_val;
+}
+
+static size_t checked_index(struct LispVector *vec, struct LispValue *index,
+                            const char *who) {
+  double i = checked_number(index, who);
+  if (!(i >= 0 && i < (double)vec->len) || i != (double)(size_t)i) {
+    fprintf(stderr, "Runtime error: %s: index %g out of range [0, %zu).\n",
+            who, i, vec->len);
+    exit(1);
+  }
+  return (size_t)i;
+}
+
+static struct LispValue *alloc_vector(size_t len, const char *who) {
+  struct LispVector *vec = alloc_object(sizeof(struct LispVector), who);
+  // aligned_alloc wants a size that is a multiple of the alignment
+  size_t bytes = (len * sizeof(double) + 31) & ~(size_t)31;
+  double *data = aligned_alloc(32, bytes ? bytes : 32);
+  if (!data) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "allocation failed in %s", who);
+    perror(msg);
+    exit(1);
+  }
+  vec->len = len;
+  vec->data = data;
+
+  struct LispValue *result = alloc_value(who);
+  result->type = LVAL_VEC;
+  result->value.vec_val = vec;
+  return result;
+}
+
+struct LispValue *lisp_make_vector(struct LispValue *length,
+                                   struct LispValue *fill) {
+  double n = checked_number(length, "make-vector");
+  if (!(n >= 0) || n != (double)(size_t)n) {
+    fprintf(stderr, "Runtime error: make-vector: invalid length %g.\n", n);
+    exit(1);
+  }
+  double value = checked_number(fill, "make-vector");
+  PROFILE_ENTRY(PROF_MAKE_VECTOR, (size_t)n * sizeof(double));
+  struct LispValue *result = alloc_vector((size_t)n, "make-vector");
+  double *data = result->value.vec_val->data;
+  for (size_t i = 0; i < (size_t)n; ++i) {
+    data[i] = value;
+  }
+  return result;
+}
+
+struct LispValue *lisp_vector(size_t count, struct LispValue **args) {
+  PROFILE_ENTRY(PROF_MAKE_VECTOR, count * sizeof(double));
+  struct LispValue *result = alloc_vector(count, "vector");
+  for (size_t i = 0; i < count; ++i) {
+    result->value.vec_val->data[i] = checked_number(args[i], "vector");
+  }
+  return result;
+}
+
+// The *_into variants write their number into dest, a LispValue the
+// compiled code keeps in its frame when the result does not outlive it, and
+// return dest. The plain ones put it in a new LispValue.
+static struct LispValue *store_number(struct LispValue *dest, double num) {
+  dest->type = LVAL_NUM;
+  dest->value.num_val = num;
+  return dest;
+}
+
+struct LispValue *lisp_vector_length_into(struct LispValue *dest,
+                                          struct LispValue *vec) {
+  return store_number(dest,
+                      (double)checked_vector(vec, "vector-length")->len);
+}
+
+struct LispValue *lisp_vector_length(struct LispValue *vec) {
+  return lisp_vector_length_into(lisp_make_number(0), vec);
+}
+
+struct LispValue *lisp_vector_ref_into(struct LispValue *dest,
+                                       struct LispValue *vec,
+                                       struct LispValue *index) {
+  struct LispVector *v = checked_vector(vec, "vector-ref");
+  return store_number(dest, v->data[checked_index(v, index, "vector-ref")]);
+}
+
+struct LispValue *lisp_vector_ref(struct LispValue *vec,
+                                  struct LispValue *index) {
+  return lisp_vector_ref_into(lisp_make_number(0), vec, index);
+}
+
+struct LispValue *lisp_vector_set(struct LispValue *vec,
+                                  struct LispValue *index,
+                                  struct LispValue *value) {
+  struct LispVector *v = checked_vector(vec, "vector-set!");
+  v->data[checked_index(v, index, "vector-set!")] =
+      checked_number(value, "vector-set!");
+  return value;
+}
+
+struct LispValue *lisp_vector_sum_into(struct LispValue *dest,
+                                       struct LispValue *vec) {
+  struct LispVector *v = checked_vector(vec, "vector-sum");
+  return store_number(dest, vector_kernels->sum(v->data, v->len));
+}
+
+struct LispValue *lisp_vector_sum(struct LispValue *vec) {
+  return lisp_vector_sum_into(lisp_make_number(0), vec);
+}
+
+struct LispValue *lisp_vector_dot_into(struct LispValue *dest,
+                                       struct LispValue *a,
+                                       struct LispValue *b) {
+  struct LispVector *va = checked_vector(a, "vector-dot");
+  struct LispVector *vb = checked_vector(b, "vector-dot");
+  if (va->len != vb->len) {
+    fprintf(stderr, "Runtime error: vector-dot: lengths %zu and %zu differ.\n",
+            va->len, vb->len);
+    exit(1);
+  }
+  return store_number(dest, vector_kernels->dot(va->data, vb->data, va->len));
+}
+
+struct LispValue *lisp_vector_dot(struct LispValue *a, struct LispValue *b) {
+  return lisp_vector_dot_into(lisp_make_number(0), a, b);
+}
+
+// (vector-map op a b) with op one of + - * /; b is a vector of the same
+// length as a, or a number that is applied to every element.
+struct LispValue *lisp_vector_map(long op, struct LispValue *a,
+                                  struct LispValue *b) {
+  struct LispVector *va = checked_vector(a, "vector-map");
+  const double *b_data = NULL;
+  double scalar = 0;
+  if (!lisp_is_pair(b) && b->type == LVAL_NUM) {
+    scalar = b->value.num_val;
+  } else {
+    struct LispVector *vb = checked_vector(b, "vector-map");
+    if (vb->len != va->len) {
+      fprintf(stderr,
+              "Runtime error: vector-map: lengths %zu and %zu differ.\n",
+              va->len, vb->len);
+      exit(1);
+    }
+    b_data = vb->data;
+  }
+
+  PROFILE_ENTRY(PROF_MAKE_VECTOR, va->len * sizeof(double));
+  struct LispValue *result = alloc_vector(va->len, "vector-map");
+  vector_kernels->map((enum LispVectorOp)op, result->value.vec_val->data,
+                      va->data, b_data, scalar, va->len);
+  return result;
+}
+
+struct LispValue *lisp_vector_add(struct LispValue *a, struct LispValue *b) {
+  return lisp_vector_map(LISP_VECTOR_ADD, a, b);
+}
+
+struct LispValue *lisp_vector_mul(struct LispValue *a, struct LispValue *b) {
+  return lisp_vector_map(LISP_VECTOR_MUL, a, b);
+}
+
+// --- Strings ---
+// Literals are static objects in the program's .rodata. Strings made at run
+// time keep the LispValue and its LispString header in one allocation;
+// substring only allocates a new header pointing into the characters of its
+// argument, and string-append copies its arguments into one fresh buffer.
+
+struct StringObject {
+  struct LispValue value;
+  struct LispString string;
+};
+
+static struct LispValue *make_string_value(const char *chars, size_t len,
+                                           const char *who) {
+  struct StringObject *object = alloc_object(sizeof(struct StringObject), who);
+  object->string.len = len;
+  object->string.chars = chars;
+  object->value.type = LVAL_STR;
+  object->value.value.string_val = &object->string;
+  return &object->value;
+}
+
+static struct LispString *checked_string(struct LispValue *value,
+                                         const char *who) {
+  if (lisp_is_pair(value) || value->type != LVAL_STR) {
+    fprintf(stderr, "Runtime error: %s: argument is not a string.\n", who);
+    exit(1);
+  }
+  return value->value.string_val;
+}
+
+struct LispValue *lisp_string_length_into(struct LispValue *dest,
+                                          struct LispValue *str) {
+  return store_number(dest,
+                      (double)checked_string(str, "string-length")->len);
+}
+
+struct LispValue *lisp_string_length(struct LispValue *str) {
+  return lisp_string_length_into(lisp_make_number(0), str);
+}
+
+struct LispValue *lisp_string_append(size_t count, struct LispValue **args) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    total += checked_string(args[i], "string-append")->len;
+  }
+  PROFILE_ENTRY(PROF_STRING, sizeof(struct StringObject) + total);
+
+  char *chars = malloc(total ? total : 1);
+  if (!chars) {
+    perror("malloc failed in string-append");
+    exit(1);
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < count; ++i) {
+    struct LispString *s = args[i]->value.string_val;
+    memcpy(chars + offset, s->chars, s->len);
+    offset += s->len;
+  }
+  return make_string_value(chars, total, "string-append");
+}
+
+// (substring s start end) shares the characters of s
+struct LispValue *lisp_substring(struct LispValue *str, struct LispValue *start,
+                                 struct LispValue *end) {
+  struct LispString *s = checked_string(str, "substring");
+  double from = checked_number(start, "substring");
+  double to = checked_number(end, "substring");
+  if (!(from >= 0 && from <= to && to <= (double)s->len) ||
+      from != (double)(size_t)from || to != (double)(size_t)to) {
+    fprintf(stderr,
+            "Runtime error: substring: range [%g, %g) is not within [0, "
+            "%zu].\n",
+            from, to, s->len);
+    exit(1);
+  }
+  PROFILE_ENTRY(PROF_STRING, sizeof(struct StringObject));
+  return make_string_value(s->chars + (size_t)from, (size_t)(to - from),
+                           "substring");
+}
+
+// --- Closures ---
+// Only closures that may outlive the frame that creates them come here; the
+// compiler fills in the free variables after the call.
+
+struct LispValue *lisp_make_closure(void *code, size_t num_vars) {
+  PROFILE_ENTRY(PROF_CLOSURE, sizeof(struct LispClosure) +
+                                  num_vars * sizeof(struct LispValue *));
+  struct LispClosure *closure =
+      alloc_object(sizeof(struct LispClosure) +
+                       num_vars * sizeof(struct LispValue *),
+                   "lisp_make_closure");
+  closure->header.type = LVAL_FUNC;
+  closure->header.value.func_ptr = code;
+  return &closure->header;
+}
+
+void lisp_error_not_procedure(struct LispValue *value) {
+  fprintf(stderr, "Runtime error: attempt to call a non-procedure (type %d).\n",
+          lisp_is_pair(value) ? LVAL_PAIR : (int)value->type);
+  exit(1);
+}
+
+// --- Tasks ---
+// (future body...) and (spawn thunk) push a task onto the deque of the worker
+// that runs them and return a future at once; touch waits for its result.
+// There is one worker per core (LISP_WORKERS overrides the count), started
+// by the first spawn, and the main thread is worker 0. A worker takes the
+// task it pushed last from the bottom of its own Chase-Lev deque, and one
+// that runs out steals the oldest task from the top of another's, so the
+// large subproblems of a divide-and-conquer recursion spread first. While a
+// future it touches is not done, a worker runs other tasks, most often the
+// very one it waits for. Workers that find nothing to steal sleep until a
+// task is pushed.
+
+#define TASK_DEQUE_CAPACITY 4096 // tasks spawned beyond this run at once
+#define WORKER_STACK_BYTES ((size_t)64 << 20)
+#define WORKER_IDLE_SPINS 64
+
+// A unit of work for the scheduler; done is set once run has returned
+struct Task {
+  void (*run)(struct Task *task);
+  int done;
+};
+
+struct LispFuture {
+  struct LispValue header; // LVAL_FUTURE
+  struct Task task;
+  struct LispValue *thunk;
+  struct LispValue *result; // valid once task.done is set
+};
+
+// The owner pushes and takes at bottom, thieves take at top. Indices only
+// grow; tasks[i % TASK_DEQUE_CAPACITY] holds task i.
+struct TaskDeque {
+  _Alignas(64) long top;
+  _Alignas(64) long bottom;
+  struct Task *tasks[TASK_DEQUE_CAPACITY];
+};
+
+struct Worker {
+  struct TaskDeque deque;
+  unsigned int seed; // for picking whom to steal from
+};
+
+static struct Worker *workers;
+static size_t num_workers;
+static _Thread_local struct Worker *current_worker;
+static pthread_once_t scheduler_once = PTHREAD_ONCE_INIT;
+static long queued_tasks; // pushed and not taken yet
+static long idle_workers;
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+static int deque_push(struct TaskDeque *deque, struct Task *task) {
+  long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  if (bottom - top >= TASK_DEQUE_CAPACITY) {
+    return 0;
+  }
+  __atomic_store_n(&deque->tasks[bottom % TASK_DEQUE_CAPACITY], task,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static struct Task *deque_take(struct TaskDeque *deque) {
+  long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+  if (top > bottom) {
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  struct Task *task = __atomic_load_n(
+      &deque->tasks[bottom % TASK_DEQUE_CAPACITY], __ATOMIC_RELAXED);
+  if (top == bottom) {
+    // The last task: race thieves for it
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      task = NULL;
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return task;
+}
+
+static struct Task *deque_steal(struct TaskDeque *deque) {
+  long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+  if (top >= bottom) {
+    return NULL;
+  }
+  struct Task *task = __atomic_load_n(
+      &deque->tasks[top % TASK_DEQUE_CAPACITY], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return task;
+}
+
+static void run_task(struct Task *task) {
+  task->run(task);
+  __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+// The worker's own newest task, or else the oldest of another worker
+static struct Task *find_task(struct Worker *self) {
+  struct Task *task = deque_take(&self->deque);
+  for (size_t i = 0; !task && i < num_workers; ++i) {
+    self->seed = self->seed * 1103515245u + 12345u;
+    struct Worker *victim = &workers[(self->seed >> 16) % num_workers];
+    if (victim != self) {
+      task = deque_steal(&victim->deque);
+    }
+  }
+  if (task) {
+    __atomic_sub_fetch(&queued_tasks, 1, __ATOMIC_SEQ_CST);
+  }
+  return task;
+}
+
+static void worker_idle(void) {
+  for (int i = 0; i < WORKER_IDLE_SPINS; ++i) {
+    if (__atomic_load_n(&queued_tasks, __ATOMIC_SEQ_CST) > 0) {
+      return;
+    }
+    sched_yield();
+  }
+  // Pairs with the check of idle_workers in lisp_spawn
+  pthread_mutex_lock(&idle_mutex);
+  __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&queued_tasks, __ATOMIC_SEQ_CST) <= 0) {
+    pthread_cond_wait(&idle_cond, &idle_mutex);
+  }
+  __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&idle_mutex);
+}
+
+static void *worker_main(void *arg) {
+  current_worker = arg;
+  for (;;) {
+    struct Task *task = find_task(current_worker);
+    if (task) {
+      run_task(task);
+    } else {
+      worker_idle();
+    }
+  }
+  return NULL;
+}
+
+static void scheduler_start(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *forced = getenv("LISP_WORKERS");
+  if (forced) {
+    count = strtol(forced, NULL, 10);
+  }
+  num_workers = count > 0 ? (size_t)count : 1;
+  workers = aligned_alloc(64, num_workers * sizeof(struct Worker));
+  if (!workers) {
+    perror("allocation failed for the task scheduler");
+    exit(1);
+  }
+  memset(workers, 0, num_workers * sizeof(struct Worker));
+  current_worker = &workers[0];
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, WORKER_STACK_BYTES);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (size_t i = 0; i < num_workers; ++i) {
+    workers[i].seed = (unsigned int)i * 2654435761u + 1;
+    pthread_t thread;
+    if (i > 0 && pthread_create(&thread, &attr, worker_main, &workers[i])) {
+      perror("pthread_create failed for a task worker");
+      exit(1);
+    }
+  }
+  pthread_attr_destroy(&attr);
+}
+
+// Queues task on the current worker, which must wait for it before the
+// task's memory goes away
+static void spawn_task(struct Task *task) {
+  pthread_once(&scheduler_once, scheduler_start);
+  task->done = 0;
+  __atomic_add_fetch(&queued_tasks, 1, __ATOMIC_SEQ_CST);
+  if (!deque_push(&current_worker->deque, task)) {
+    __atomic_sub_fetch(&queued_tasks, 1, __ATOMIC_SEQ_CST);
+    run_task(task);
+  } else if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&idle_mutex);
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_mutex);
+  }
+}
+
+static void wait_task(struct Task *task) {
+  while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+    struct Task *other = find_task(current_worker);
+    if (other) {
+      run_task(other);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+static struct LispValue *checked_procedure(struct LispValue *value) {
+  if (lisp_is_pair(value) || value->type != LVAL_FUNC) {
+    lisp_error_not_procedure(value);
+  }
+  return value;
+}
+
+// Calls a closure the way compiled code does, with its record first
+static struct LispValue *call_procedure0(struct LispValue *f) {
+  return ((struct LispValue * (*)(struct LispValue *)) f->value.func_ptr)(f);
+}
+
+static struct LispValue *call_procedure1(struct LispValue *f,
+                                         struct LispValue *a) {
+  return ((struct LispValue * (*)(struct LispValue *, struct LispValue *))
+              f->value.func_ptr)(f, a);
+}
+
+static struct LispValue *call_procedure2(struct LispValue *f,
+                                         struct LispValue *a,
+                                         struct LispValue *b) {
+  return ((struct LispValue * (*)(struct LispValue *, struct LispValue *,
+                                  struct LispValue *)) f->value.func_ptr)(f, a,
+                                                                          b);
+}
+
+static void run_future(struct Task *task) {
+  struct LispFuture *future =
+      (struct LispFuture *)((char *)task - offsetof(struct LispFuture, task));
+  future->result = call_procedure0(future->thunk);
+}
+
+// (spawn thunk) runs the procedure thunk with no arguments as a task
+struct LispValue *lisp_spawn(struct LispValue *thunk) {
+  checked_procedure(thunk);
+  PROFILE_ENTRY(PROF_SPAWN, sizeof(struct LispFuture));
+  struct LispFuture *future = alloc_object(sizeof(struct LispFuture), "spawn");
+  future->header.type = LVAL_FUTURE;
+  future->task.run = run_future;
+  future->thunk = thunk;
+  future->result = NULL;
+  spawn_task(&future->task);
+  return &future->header;
+}
+
+// The result of a future, once its task has run; any other value is its
+// own result
+struct LispValue *lisp_touch(struct LispValue *value) {
+  if (lisp_is_pair(value) || value->type != LVAL_FUTURE) {
+    return value;
+  }
+  struct LispFuture *future = (struct LispFuture *)value;
+  wait_task(&future->task);
+  return future->result;
+}
+
+// --- Parallel collections ---
+// pmap, preduce and psort cut their list or vector into ranges that run as
+// tasks on the workers above. A range is halved, and one half spawned,
+// until it is no longer than the grain: few enough elements that what the
+// range reads and writes fits in half the L2 cache, and no more than one
+// PARALLEL_CHUNKS_PER_WORKER-th of a worker's share, so that uneven
+// per-element costs still balance. Collections shorter than
+// PARALLEL_MIN_ELEMENTS, or a single worker, run serially in the caller.
+// The procedure given to pmap and preduce is called like compiled code
+// calls a closure, so lambdas and global functions both work.
+
+#define PARALLEL_MIN_ELEMENTS 1024
+#define PARALLEL_CHUNKS_PER_WORKER 4
+#define DEFAULT_L2_CACHE_BYTES ((size_t)256 << 10)
+
+struct ParallelJob;
+
+struct ParallelRange {
+  struct Task task; // first, so that a Task * is the range
+  const struct ParallelJob *job;
+  size_t begin;
+  size_t end;
+  struct LispValue *result; // of preduce
+};
+
+struct ParallelJob {
+  const char *who;
+  size_t grain;
+  // Processes [range->begin, range->end) serially
+  void (*chunk)(const struct ParallelJob *job, struct ParallelRange *range);
+  // Joins two adjacent ranges into lower once both are done, or NULL
+  void (*combine)(const struct ParallelJob *job, struct ParallelRange *lower,
+                  const struct ParallelRange *upper);
+  struct LispValue *proc;
+  struct LispValue **items;  // the elements of a list, or NULL
+  const double *numbers;     // the elements of a vector
+  struct LispValue **values; // pmap results for a list
+  double *data;              // pmap results for a vector; psort's numbers
+  double *scratch;           // psort's merge buffer
+};
+
+static void run_range(struct Task *task) {
+  struct ParallelRange *range = (struct ParallelRange *)task;
+  const struct ParallelJob *job = range->job;
+  if (range->end - range->begin <= job->grain) {
+    job->chunk(job, range);
+    return;
+  }
+  size_t mid = range->begin + (range->end - range->begin) / 2;
+  struct ParallelRange upper = {
+      .task.run = run_range, .job = job, .begin = mid, .end = range->end};
+  struct ParallelRange lower = {
+      .task.run = run_range, .job = job, .begin = range->begin, .end = mid};
+  spawn_task(&upper.task);
+  run_range(&lower.task);
+  wait_task(&upper.task);
+  if (job->combine) {
+    job->combine(job, &lower, &upper);
+  }
+  range->result = lower.result;
+}
+
+static size_t l2_cache_bytes(void) {
+  static size_t bytes;
+  if (!bytes) {
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    bytes = size > 0 ? (size_t)size : DEFAULT_L2_CACHE_BYTES;
+  }
+  return bytes;
+}
+
+// Runs job over [0, count), where each element touches element_bytes of
+// memory; returns the result of the whole range
+static struct LispValue *run_parallel(struct ParallelJob *job, size_t count,
+                                      size_t element_bytes) {
+  job->grain = count;
+  if (count >= PARALLEL_MIN_ELEMENTS) {
+    pthread_once(&scheduler_once, scheduler_start);
+  }
+  if (count >= PARALLEL_MIN_ELEMENTS && num_workers > 1) {
+    size_t cache_grain = l2_cache_bytes() / 2 / element_bytes;
+    size_t chunks = num_workers * PARALLEL_CHUNKS_PER_WORKER;
+    size_t balance_grain = (count + chunks - 1) / chunks;
+    job->grain = cache_grain < balance_grain ? cache_grain : balance_grain;
+    if (job->grain == 0) {
+      job->grain = 1;
+    }
+  }
+  struct ParallelRange range = {
+      .task.run = run_range, .job = job, .begin = 0, .end = count};
+  run_range(&range.task);
+  return range.result;
+}
+
+// The elements of the proper list or the vector coll; a list's are copied
+// to a malloc'd array in job->items, a vector's are read in place
+static size_t collection_elements(struct ParallelJob *job,
+                                  struct LispValue *coll) {
+  if (!lisp_is_pair(coll) && coll->type == LVAL_VEC) {
+    job->numbers = coll->value.vec_val->data;
+    return coll->value.vec_val->len;
+  }
+  size_t count = 0;
+  struct LispValue *rest = coll;
+  for (; lisp_is_pair(rest); rest = ((struct LispPair *)rest)->cdr) {
+    count++;
+  }
+  if (rest != &G_LISP_NIL) {
+    fprintf(stderr, "Runtime error: %s: argument is not a list or vector.\n",
+            job->who);
+    exit(1);
+  }
+  job->items = checked_malloc((count ? count : 1) * sizeof(*job->items),
+                              job->who);
+  rest = coll;
+  for (size_t i = 0; i < count; ++i) {
+    job->items[i] = ((struct LispPair *)rest)->car;
+    rest = ((struct LispPair *)rest)->cdr;
+  }
+  return count;
+}
+
+static struct LispValue *job_element(const struct ParallelJob *job,
+                                     size_t i) {
+  return job->items ? job->items[i] : lisp_make_number(job->numbers[i]);
+}
+
+static void map_chunk(const struct ParallelJob *job,
+                      struct ParallelRange *range) {
+  for (size_t i = range->begin; i < range->end; ++i) {
+    struct LispValue *result = call_procedure1(job->proc, job_element(job, i));
+    if (job->values) {
+      job->values[i] = result;
+    } else {
+      job->data[i] = checked_number(result, job->who);
+    }
+  }
+}
+
+// (pmap proc coll) is a list or vector of (proc element) for each element
+// of coll; for a vector, proc must return numbers
+struct LispValue *lisp_pmap(struct LispValue *proc, struct LispValue *coll) {
+  struct ParallelJob job = {
+      .who = "pmap", .chunk = map_chunk, .proc = checked_procedure(proc)};
+  size_t count = collection_elements(&job, coll);
+  if (!job.items) {
+    PROFILE_ENTRY(PROF_MAKE_VECTOR, count * sizeof(double));
+    struct LispValue *result = alloc_vector(count, "pmap");
+    job.data = result->value.vec_val->data;
+    run_parallel(&job, count, 2 * sizeof(double));
+    return result;
+  }
+  job.values = checked_malloc((count ? count : 1) * sizeof(*job.values),
+                              "pmap");
+  run_parallel(&job, count, 2 * sizeof(struct LispValue *));
+  struct LispValue *result = lisp_list(count, job.values);
+  free(job.values);
+  free(job.items);
+  return result;
+}
+
+static void reduce_chunk(const struct ParallelJob *job,
+                         struct ParallelRange *range) {
+  struct LispValue *acc = job_element(job, range->begin);
+  for (size_t i = range->begin + 1; i < range->end; ++i) {
+    acc = call_procedure2(job->proc, acc, job_element(job, i));
+  }
+  range->result = acc;
+}
+
+static void reduce_combine(const struct ParallelJob *job,
+                           struct ParallelRange *lower,
+                           const struct ParallelRange *upper) {
+  lower->result = call_procedure2(job->proc, lower->result, upper->result);
+}
+
+// (preduce proc init coll) folds coll from the left starting with init,
+// like (proc (proc init e0) e1)...; proc must be associative, since ranges
+// are folded separately and their results joined with proc
+struct LispValue *lisp_preduce(struct LispValue *proc, struct LispValue *init,
+                               struct LispValue *coll) {
+  struct ParallelJob job = {.who = "preduce",
+                            .chunk = reduce_chunk,
+                            .combine = reduce_combine,
+                            .proc = checked_procedure(proc)};
+  size_t count = collection_elements(&job, coll);
+  struct LispValue *result = init;
+  if (count > 0) {
+    size_t bytes = job.items ? sizeof(struct LispValue *) : sizeof(double);
+    result = call_procedure2(job.proc, init, run_parallel(&job, count, bytes));
+  }
+  free(job.items);
+  return result;
+}
+
+// NaNs sort after every number
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  if (x != x || y != y) {
+    return (x != x) - (y != y);
+  }
+  return (x > y) - (x < y);
+}
+
+static void sort_chunk(const struct ParallelJob *job,
+                       struct ParallelRange *range) {
+  qsort(job->data + range->begin, range->end - range->begin, sizeof(double),
+        compare_doubles);
+}
+
+static void merge_ranges(const struct ParallelJob *job,
+                         struct ParallelRange *lower,
+                         const struct ParallelRange *upper) {
+  const double *data = job->data;
+  double *out = job->scratch + lower->begin;
+  size_t i = lower->begin;
+  size_t j = upper->begin;
+  while (i < lower->end && j < upper->end) {
+    *out++ = compare_doubles(&data[j], &data[i]) < 0 ? data[j++] : data[i++];
+  }
+  while (i < lower->end) {
+    *out++ = data[i++];
+  }
+  while (j < upper->end) {
+    *out++ = data[j++];
+  }
+  memcpy(job->data + lower->begin, job->scratch + lower->begin,
+         (upper->end - lower->begin) * sizeof(double));
+}
+
+// (psort coll) is a new list or vector of the numbers in coll in ascending
+// order; ranges are sorted in parallel and then merged pairwise
+struct LispValue *lisp_psort(struct LispValue *coll) {
+  struct ParallelJob job = {
+      .who = "psort", .chunk = sort_chunk, .combine = merge_ranges};
+  size_t count = collection_elements(&job, coll);
+  PROFILE_ENTRY(PROF_MAKE_VECTOR, count * sizeof(double));
+  struct LispValue *sorted = alloc_vector(count, "psort");
+  job.data = sorted->value.vec_val->data;
+  for (size_t i = 0; i < count; ++i) {
+    job.data[i] = job.items ? checked_number(job.items[i], "psort")
+                            : job.numbers[i];
+  }
+  job.scratch = checked_malloc((count ? count : 1) * sizeof(double), "psort");
+  run_parallel(&job, count, 2 * sizeof(double));
+  free(job.scratch);
+  if (!job.items) {
+    return sorted;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    job.items[i] = lisp_make_number(job.data[i]);
+  }
+  struct LispValue *result = lisp_list(count, job.items);
+  free(job.items);
+  return result;
+}
+
+// --- Memoization ---
+// A define-memo function calls lisp_memo_lookup with its parameter slots
+// once they are stored, and returns the result if there is one; otherwise
+// it runs its body and hands the result to lisp_memo_store. The slots are
+// in frame order, so args[0] is the last parameter. Calls with an argument
+// that is not a number are neither looked up nor stored.
+
+#define MEMO_INITIAL_CAPACITY 16
+
+static int memo_numeric_args(struct LispMemo *memo, struct LispValue **args) {
+  for (size_t i = 0; i < memo->num_args; ++i) {
+    if (lisp_is_pair(args[i]) || args[i]->type != LVAL_NUM) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static uint64_t memo_mix(uint64_t hash, double key) {
+  uint64_t bits;
+  memcpy(&bits, &key, sizeof(bits));
+  hash = (hash ^ bits) * 0x9e3779b97f4a7c15ULL;
+  return hash ^ (hash >> 32);
+}
+
+static size_t memo_args_slot(struct LispMemo *memo, struct LispValue **args) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < memo->num_args; ++i) {
+    hash = memo_mix(hash, args[i]->value.num_val);
+  }
+  return (size_t)hash & (memo->capacity - 1);
+}
+
+static size_t memo_key_slot(struct LispMemo *memo, const double *key) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < memo->num_args; ++i) {
+    hash = memo_mix(hash, key[i]);
+  }
+  return (size_t)hash & (memo->capacity - 1);
+}
+
+static int memo_key_equals(struct LispMemo *memo, size_t slot,
+                           struct LispValue **args) {
+  const double *key = &memo->keys[slot * memo->num_args];
+  for (size_t i = 0; i < memo->num_args; ++i) {
+    if (memcmp(&key[i], &args[i]->value.num_val, sizeof(double)) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// The slot holding args, or the empty slot where they would go
+static size_t memo_find(struct LispMemo *memo, struct LispValue **args) {
+  size_t mask = memo->capacity - 1;
+  size_t slot = memo_args_slot(memo, args);
+  while (memo->values[slot] && !memo_key_equals(memo, slot, args)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static void memo_alloc(struct LispMemo *memo, size_t capacity) {
+  memo->capacity = capacity;
+  memo->keys = malloc(capacity * (memo->num_args ? memo->num_args : 1) *
+                      sizeof(double));
+  memo->values = calloc(capacity, sizeof(struct LispValue *));
+  if (!memo->keys || !memo->values) {
+    perror("malloc failed in lisp_memo_store");
+    exit(1);
+  }
+}
+
+static void memo_move(struct LispMemo *memo, size_t to, const double *key,
+                      struct LispValue *value) {
+  memcpy(&memo->keys[to * memo->num_args], key,
+         memo->num_args * sizeof(double));
+  memo->values[to] = value;
+}
+
+static void memo_grow(struct LispMemo *memo) {
+  size_t old_capacity = memo->capacity;
+  double *old_keys = memo->keys;
+  struct LispValue **old_values = memo->values;
+  memo_alloc(memo, old_capacity * 2);
+  for (size_t i = 0; i < old_capacity; ++i) {
+    if (!old_values[i]) {
+      continue;
+    }
+    const double *key = &old_keys[i * memo->num_args];
+    size_t slot = memo_key_slot(memo, key);
+    while (memo->values[slot]) {
+      slot = (slot + 1) & (memo->capacity - 1);
+    }
+    memo_move(memo, slot, key, old_values[i]);
+  }
+  free(old_keys);
+  free(old_values);
+}
+
+// Empties slot and shifts back the entries after it that would no longer be
+// found past the hole, so that no tombstones are needed
+static void memo_remove(struct LispMemo *memo, size_t slot) {
+  size_t mask = memo->capacity - 1;
+  size_t hole = slot;
+  for (size_t i = (slot + 1) & mask; memo->values[i]; i = (i + 1) & mask) {
+    const double *key = &memo->keys[i * memo->num_args];
+    size_t home = memo_key_slot(memo, key);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      memo_move(memo, hole, key, memo->values[i]);
+      hole = i;
+    }
+  }
+  memo->values[hole] = NULL;
+  memo->count--;
+}
+
+struct LispValue *lisp_memo_lookup(struct LispMemo *memo,
+                                   struct LispValue **args) {
+  if (!memo_numeric_args(memo, args)) {
+    return NULL;
+  }
+  runtime_lock(&memo->lock);
+  struct LispValue *value =
+      memo->values ? memo->values[memo_find(memo, args)] : NULL;
+  if (value) {
+    memo->hits++;
+  } else {
+    memo->misses++;
+  }
+  runtime_unlock(&memo->lock);
+  return value;
+}
+
+// A bounded table that is full makes room by evicting the entry where args
+// would be probed from, which keeps the entries used most recently in each
+// neighbourhood at no bookkeeping cost.
+struct LispValue *lisp_memo_store(struct LispMemo *memo,
+                                  struct LispValue **args,
+                                  struct LispValue *result) {
+  if (!memo_numeric_args(memo, args)) {
+    return result;
+  }
+  runtime_lock(&memo->lock);
+  if (!memo->values) {
+    memo_alloc(memo, MEMO_INITIAL_CAPACITY);
+    PROFILE_MEMO(memo);
+  }
+
+  size_t slot = memo_find(memo, args);
+  if (!memo->values[slot]) {
+    if (memo->limit > 0 && memo->count >= memo->limit) {
+      size_t victim = memo_args_slot(memo, args);
+      while (!memo->values[victim]) {
+        victim = (victim + 1) & (memo->capacity - 1);
+      }
+      memo_remove(memo, victim);
+      memo->evictions++;
+    } else if ((memo->count + 1) * 2 > memo->capacity) {
+      memo_grow(memo);
+    }
+    slot = memo_find(memo, args);
+    for (size_t i = 0; i < memo->num_args; ++i) {
+      memo->keys[slot * memo->num_args + i] = args[i]->value.num_val;
+    }
+    memo->count++;
+  }
+  memo->values[slot] = result;
+  runtime_unlock(&memo->lock);
+  return result;
+}
+
+// --- Profile-guided optimization ---
+// Programs compiled with --profile-generate count function entries and
+// branches in LispPgoCounter records and pass the newest to lisp_pgo_start
+// from main. The counters are written at exit to LISP_PGO_OUT, or else to
+// the file the compiler named, for --profile-use. They are plain increments,
+// so tasks running at the same time may lose a few counts.
+
+static const struct LispPgoCounter *pgo_counters;
+static const char *pgo_filename;
+
+static void pgo_write(void) {
+  const char *path = getenv("LISP_PGO_OUT");
+  if (!path) {
+    path = pgo_filename;
+  }
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    perror("Could not open the profile file");
+    return;
+  }
+  fprintf(out, "# lisp profile\n");
+  for (const struct LispPgoCounter *c = pgo_counters; c; c = c->prev) {
+    fprintf(out, "%s", c->key);
+    for (size_t i = 0; i < c->num_counts; ++i) {
+      fprintf(out, " %lu", c->counts[i]);
+    }
+    fprintf(out, "\n");
+  }
+  fclose(out);
+}
+
+void lisp_pgo_start(const struct LispPgoCounter *counters,
+                    const char *filename) {
+  pgo_counters = counters;
+  pgo_filename = filename;
+  atexit(pgo_write);
+}
+
+// --- Output ---
+// display, print and newline append to one runtime-owned buffer that is
+// written out with write(2) only when it fills up and at exit, so printing
+// costs neither stdio locking nor a system call per value. Numbers go
+// through format_number below instead of printf.
+
+#define OUTPUT_BUFFER_SIZE (1 << 18)
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_len;
+
+static void write_all(const char *bytes, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t n = write(STDOUT_FILENO, bytes + written, len - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("write failed while flushing output");
+      return;
+    }
+    written += (size_t)n;
+  }
+}
+
+static void output_flush(void) {
+  write_all(output_buffer, output_len);
+  output_len = 0;
+}
+
+__attribute__((constructor)) static void output_init(void) {
+  atexit(output_flush);
+}
+
+static void output_bytes(const char *bytes, size_t len) {
+  if (output_len + len > OUTPUT_BUFFER_SIZE) {
+    output_flush();
+    if (len > OUTPUT_BUFFER_SIZE) {
+      write_all(bytes, len);
+      return;
+    }
+  }
+  memcpy(output_buffer + output_len, bytes, len);
+  output_len += len;
+}
+
+static void output_char(char c) {
+  if (output_len == OUTPUT_BUFFER_SIZE) {
+    output_flush();
+  }
+  output_buffer[output_len++] = c;
+}
+
+// Writes the decimal digits of value to the end of buf and returns a
+// pointer to the first one.
+static char *format_uint(uint64_t value, char *buf_end) {
+  char *p = buf_end;
+  do {
+    *--p = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  return p;
+}
+
+#define MAX_EXACT_INTEGER 9007199254740992.0 // 2^53
+
+// Formats num as the shortest decimal that reads back as the same double.
+// Integers take a digit loop. Other values try k = 1, 2, ... decimals:
+// with m = round(num * 10^k) exact and 10^k exact, m / 10^k is the correctly
+// rounded value of the decimal m * 10^-k, so if it equals num that decimal
+// round-trips. Values out of that range fall back to %.15g-%.17g.
+static size_t format_number(double num, char *buf) {
+  static const double powers_of_ten[] = {
+      1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,
+      1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17};
+  char digits[24];
+  char *end = digits + sizeof(digits);
+
+  if (num != num) {
+    memcpy(buf, "+nan.0", 6);
+    return 6;
+  }
+  double magnitude = num < 0 ? -num : num;
+  if (magnitude > DBL_MAX) {
+    memcpy(buf, num < 0 ? "-inf.0" : "+inf.0", 6);
+    return 6;
+  }
+  size_t len = 0;
+  if (num < 0) {
+    buf[len++] = '-';
+  }
+
+  if (magnitude < MAX_EXACT_INTEGER &&
+      magnitude == (double)(uint64_t)magnitude) {
+    char *p = format_uint((uint64_t)magnitude, end);
+    memcpy(buf + len, p, (size_t)(end - p));
+    return len + (size_t)(end - p);
+  }
+
+  for (int k = 1; k < 18; ++k) {
+    double scaled = magnitude * powers_of_ten[k];
+    if (!(scaled < MAX_EXACT_INTEGER)) {
+      break;
+    }
+    uint64_t m = (uint64_t)(scaled + 0.5);
+    if ((double)m / powers_of_ten[k] != magnitude) {
+      continue;
+    }
+    char *p = format_uint(m, end);
+    size_t num_digits = (size_t)(end - p);
+    // Pad with leading zeros so that there is at least one integer digit
+    while (num_digits <= (size_t)k) {
+      *--p = '0';
+      num_digits++;
+    }
+    size_t int_digits = num_digits - (size_t)k;
+    memcpy(buf + len, p, int_digits);
+    len += int_digits;
+    buf[len++] = '.';
+    memcpy(buf + len, p + int_digits, (size_t)k);
+    return len + (size_t)k;
+  }
+
+  for (int precision = 15; precision <= 17; ++precision) {
+    int n = snprintf(buf, 32, "%.*g", precision, num);
+    if (precision == 17 || strtod(buf, NULL) == num) {
+      return (size_t)n;
+    }
+  }
+  return 0;
+}
+
+static void output_value(struct LispValue *value, int write_strings) {
+  if (lisp_is_pair(value)) {
+    output_char('(');
+    for (;;) {
+      struct LispPair *cell = (struct LispPair *)value;
+      output_value(cell->car, write_strings);
+      value = cell->cdr;
+      if (value == &G_LISP_NIL) {
+        break;
+      }
+      if (!lisp_is_pair(value)) {
+        output_bytes(" . ", 3);
+        output_value(value, write_strings);
+        break;
+      }
+      output_char(' ');
+    }
+    output_char(')');
+    return;
+  }
+
+  char buf[32];
+  switch (value->type) {
+  case LVAL_NUM:
+    output_bytes(buf, format_number(value->value.num_val, buf));
+    break;
+  case LVAL_STR: {
+    struct LispString *s = value->value.string_val;
+    if (write_strings) {
+      output_char('"');
+    }
+    output_bytes(s->chars, s->len);
+    if (write_strings) {
+      output_char('"');
+    }
+    break;
+  }
+  case LVAL_VEC: {
+    struct LispVector *vec = value->value.vec_val;
+    output_bytes("#(", 2);
+    for (size_t i = 0; i < vec->len; ++i) {
+      if (i > 0) {
+        output_char(' ');
+      }
+      output_bytes(buf, format_number(vec->data[i], buf));
+    }
+    output_char(')');
+    break;
+  }
+  case LVAL_NIL:
+    output_bytes("()", 2);
+    break;
+  case LVAL_TRUE:
+    output_bytes("#t", 2);
+    break;
+  case LVAL_SYM:
+    output_bytes(value->value.str_val, strlen(value->value.str_val));
+    break;
+  case LVAL_FUTURE:
+    output_bytes("#<future>", 9);
+    break;
+  default:
+    output_bytes("#<procedure>", 12);
+    break;
+  }
+}
+
+// Each call prints as a whole when tasks print at the same time
+static int output_lock;
+
+struct LispValue *lisp_display(struct LispValue *value) {
+  runtime_lock(&output_lock);
+  output_value(value, 0);
+  runtime_unlock(&output_lock);
+  return &G_LISP_NIL;
+}
+
+// Like display, but strings are quoted and a newline follows
+struct LispValue *lisp_print(struct LispValue *value) {
+  runtime_lock(&output_lock);
+  output_value(value, 1);
+  output_char('\n');
+  runtime_unlock(&output_lock);
+  return &G_LISP_NIL;
+}
+
+struct LispValue *lisp_newline(void) {
+  runtime_lock(&output_lock);
+  output_char('\n');
+  runtime_unlock(&output_lock);
+  return &G_LISP_NIL;
+}
+
 void lisp_debug_print(struct LispValue *arg) {
+  if (lisp_is_pair(arg)) {
+    printf("PAIR");
+    return;
+  }
   switch (arg->type) {
   case LVAL_NUM:
     printf("Double %lf", arg->value.num_val);
@@ -82,7 +1868,8 @@ void lisp_debug_print(struct LispValue *arg) {
     printf("Symbol; name: %s", arg->value.str_val);
     break;
   case LVAL_STR:
-    printf("String: %s", arg->value.str_val);
+    printf("String: %.*s", (int)arg->value.string_val->len,
+           arg->value.string_val->chars);
     break;
   case LVAL_PAIR:
     printf("PAIR");
@@ -102,6 +1889,12 @@ void lisp_debug_print(struct LispValue *arg) {
   case LVAL_UNDEFINED:
     printf("Undefined");
     break;
+  case LVAL_VEC:
+    printf("Vector of %zu doubles", arg->value.vec_val->len);
+    break;
+  case LVAL_FUTURE:
+    printf("Future");
+    break;
   default:
     printf("Printing error: unknown lisp value type");
   }
@@ -0,0 +1,121 @@
+#include "stats.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long heap_in_use(void) {
+  struct mallinfo2 info = mallinfo2();
+  return (long)(info.uordblks + info.hblkhd);
+}
+
+static long peak_rss(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+  return usage.ru_maxrss * 1024L; // ru_maxrss is in KiB on Linux
+}
+
+void stats_pass_begin(struct CompilerStats *stats, const char *name) {
+  if (stats->num_passes >= STATS_MAX_PASSES) {
+    fprintf(stderr, "Warning: too many passes to record '%s'\n", name);
+    return;
+  }
+  stats->passes[stats->num_passes].name = name;
+  stats->pass_start_heap = heap_in_use();
+  stats->pass_start_seconds = now_seconds();
+}
+
+void stats_pass_end(struct CompilerStats *stats) {
+  if (stats->num_passes >= STATS_MAX_PASSES) {
+    return;
+  }
+  struct PassStats *pass = &stats->passes[stats->num_passes++];
+  pass->seconds = now_seconds() - stats->pass_start_seconds;
+  pass->heap_in_use_bytes = heap_in_use();
+  pass->heap_delta_bytes = pass->heap_in_use_bytes - stats->pass_start_heap;
+  pass->peak_rss_bytes = peak_rss();
+}
+
+void stats_add_counter(struct CompilerStats *stats, const char *group,
+                       const char *name, long value) {
+  if (stats->num_counters >= STATS_MAX_COUNTERS) {
+    fprintf(stderr, "Warning: too many counters to record '%s.%s'\n", group,
+            name);
+    return;
+  }
+  stats->counters[stats->num_counters++] =
+      (struct StatsCounter){.group = group, .name = name, .value = value};
+}
+
+static void write_passes(const struct CompilerStats *stats, FILE *out) {
+  fprintf(out, "  \"passes\": [\n");
+  double total = 0;
+  for (size_t i = 0; i < stats->num_passes; ++i) {
+    const struct PassStats *pass = &stats->passes[i];
+    total += pass->seconds;
+    fprintf(out,
+            "    {\"name\": \"%s\", \"seconds\": %.9f, "
+            "\"heap_in_use_bytes\": %ld, \"heap_delta_bytes\": %ld, "
+            "\"peak_rss_bytes\": %ld}%s\n",
+            pass->name, pass->seconds, pass->heap_in_use_bytes,
+            pass->heap_delta_bytes, pass->peak_rss_bytes,
+            i + 1 < stats->num_passes ? "," : "");
+  }
+  fprintf(out, "  ],\n");
+  fprintf(out, "  \"total_seconds\": %.9f", total);
+}
+
+// Counters are grouped into one JSON object per group, in insertion order.
+static void write_counters(const struct CompilerStats *stats, FILE *out) {
+  fprintf(out, "  \"stats\": {");
+  bool first_group = true;
+  for (size_t i = 0; i < stats->num_counters; ++i) {
+    const char *group = stats->counters[i].group;
+    bool seen = false;
+    for (size_t j = 0; j < i; ++j) {
+      if (strcmp(stats->counters[j].group, group) == 0) {
+        seen = true;
+        break;
+      }
+    }
+    if (seen) {
+      continue;
+    }
+
+    fprintf(out, "%s\n    \"%s\": {", first_group ? "" : ",", group);
+    first_group = false;
+    bool first_counter = true;
+    for (size_t j = i; j < stats->num_counters; ++j) {
+      if (strcmp(stats->counters[j].group, group) != 0) {
+        continue;
+      }
+      fprintf(out, "%s\"%s\": %ld", first_counter ? "" : ", ",
+              stats->counters[j].name, stats->counters[j].value);
+      first_counter = false;
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  }");
+}
+
+void stats_write_json(const struct CompilerStats *stats, FILE *out,
+                      bool time_passes, bool counters) {
+  fprintf(out, "{\n");
+  if (time_passes) {
+    write_passes(stats, out);
+  }
+  if (counters) {
+    fprintf(out, "%s", time_passes ? ",\n" : "");
+    write_counters(stats, out);
+  }
+  fprintf(out, "\n}\n");
+}
@@ -0,0 +1,47 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define STATS_MAX_PASSES 16
+#define STATS_MAX_COUNTERS 32
+
+struct PassStats
+{
+  const char *name;
+  double seconds;
+  long heap_in_use_bytes;  // malloc'd bytes in use at the end of the pass
+  long heap_delta_bytes;   // growth of heap_in_use_bytes over the pass
+  long peak_rss_bytes;     // process high-water mark at the end of the pass
+};
+
+struct StatsCounter
+{
+  const char *group;
+  const char *name;
+  long value;
+};
+
+struct CompilerStats
+{
+  struct PassStats passes[STATS_MAX_PASSES];
+  size_t num_passes;
+  struct StatsCounter counters[STATS_MAX_COUNTERS];
+  size_t num_counters;
+
+  double pass_start_seconds;
+  long pass_start_heap;
+};
+
+void stats_pass_begin (struct CompilerStats *stats, const char *name);
+void stats_pass_end (struct CompilerStats *stats);
+
+void stats_add_counter (struct CompilerStats *stats, const char *group,
+                        const char *name, long value);
+
+void stats_write_json (const struct CompilerStats *stats, FILE *out,
+                       bool time_passes, bool counters);
+
+#endif
@@ -46,7 +46,7 @@ static char *mutate_func_name(const char *cFunctionName) {
 
 struct SymbolInfo *symbol_make_local_var(const char *name, int stack_offset,
                                          struct Expr *definition_node) {
-  struct SymbolInfo *info = malloc(sizeof(struct SymbolInfo));
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
   if (!info) {
     perror("malloc");
     exit(EXIT_FAILURE);
@@ -66,7 +66,7 @@ struct SymbolInfo *symbol_make_local_var(const char *name, int stack_offset,
 struct SymbolInfo *symbol_make_global_var(const char *name,
                                           const char *global_asm_label,
                                           struct Expr *definition_node) {
-  struct SymbolInfo *info = malloc(sizeof(struct SymbolInfo));
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
   if (!info) {
     perror("malloc");
     exit(EXIT_FAILURE);
@@ -92,7 +92,7 @@ struct SymbolInfo *symbol_make_global_var(const char *name,
 struct SymbolInfo *symbol_make_builtin_func(const char *name,
                                             struct LispValue *builtin_val,
                                             struct Expr *definition_node) {
-  struct SymbolInfo *info = malloc(sizeof(struct SymbolInfo));
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
   if (!info) {
     perror("malloc");
     exit(EXIT_FAILURE);
@@ -112,7 +112,7 @@ struct SymbolInfo *symbol_make_builtin_func(const char *name,
 struct SymbolInfo *symbol_make_user_func(const char *name,
                                          const char *global_asm_label,
                                          struct Expr *definition_node) {
-  struct SymbolInfo *info = malloc(sizeof(struct SymbolInfo));
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
   if (!info) {
     perror("malloc");
     exit(EXIT_FAILURE);
@@ -137,7 +137,7 @@ struct SymbolInfo *symbol_make_user_func(const char *name,
 
 struct SymbolInfo *symbol_make_special_form(const char *name,
                                             struct Expr *definition_node) {
-  struct SymbolInfo *info = malloc(sizeof(struct SymbolInfo));
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
   if (!info) {
     perror("malloc");
     exit(EXIT_FAILURE);
@@ -153,6 +153,107 @@ struct SymbolInfo *symbol_make_special_form(const char *name,
   return info;
 }
 
+struct SymbolInfo *symbol_make_loop(const char *name, int label_id,
+                                    int first_slot_offset, size_t num_vars,
+                                    struct Expr *definition_node) {
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
+  if (!info) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  info->name = strdup(name);
+  if (!info->name) {
+    perror("strdup");
+    free(info);
+    exit(EXIT_FAILURE);
+  }
+  info->kind = SYM_LOOP;
+  info->location.loop.label_id = label_id;
+  info->location.loop.first_slot_offset = first_slot_offset;
+  info->location.loop.num_vars = num_vars;
+  info->definition_node = definition_node;
+  return info;
+}
+
+struct SymbolInfo *symbol_make_free_var(const char *name, int env_offset,
+                                        size_t index,
+                                        struct Expr *definition_node) {
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
+  if (!info) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  info->name = strdup(name);
+  if (!info->name) {
+    perror("strdup");
+    free(info);
+    exit(EXIT_FAILURE);
+  }
+  info->kind = SYM_FREE_VAR;
+  info->location.free_var.env_offset = env_offset;
+  info->location.free_var.index = index;
+  info->definition_node = definition_node;
+  return info;
+}
+
+struct SymbolInfo *symbol_make_lifted_func(const char *name,
+                                           const char *asm_label,
+                                           size_t num_params, size_t num_vars,
+                                           char *const *var_names,
+                                           struct Expr *const *var_nodes,
+                                           struct Expr *definition_node) {
+  struct SymbolInfo *info = calloc(1, sizeof(struct SymbolInfo));
+  char **names = calloc(num_vars + 1, sizeof(char *));
+  struct Expr **nodes = calloc(num_vars + 1, sizeof(struct Expr *));
+  if (!info || !names || !nodes) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  info->name = strdup(name);
+  info->location.lifted.asm_label = strdup(asm_label);
+  if (!info->name || !info->location.lifted.asm_label) {
+    perror("strdup");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < num_vars; ++i) {
+    names[i] = strdup(var_names[i]);
+    if (!names[i]) {
+      perror("strdup");
+      exit(EXIT_FAILURE);
+    }
+    nodes[i] = var_nodes[i];
+  }
+  info->kind = SYM_LIFTED_FUNC;
+  info->location.lifted.num_params = num_params;
+  info->location.lifted.num_vars = num_vars;
+  info->location.lifted.var_names = names;
+  info->location.lifted.var_nodes = nodes;
+  info->definition_node = definition_node;
+  return info;
+}
+
+// Deep copy, for declaring the same symbol in another scope
+struct SymbolInfo *symbol_info_copy(const struct SymbolInfo *info) {
+  switch (info->kind) {
+  case SYM_LOCAL_VAR:
+    return symbol_make_local_var(info->name, info->location.stack_offset,
+                                 info->definition_node);
+  case SYM_FREE_VAR:
+    return symbol_make_free_var(info->name, info->location.free_var.env_offset,
+                                info->location.free_var.index,
+                                info->definition_node);
+  case SYM_LIFTED_FUNC:
+    return symbol_make_lifted_func(
+        info->name, info->location.lifted.asm_label,
+        info->location.lifted.num_params, info->location.lifted.num_vars,
+        info->location.lifted.var_names, info->location.lifted.var_nodes,
+        info->definition_node);
+  default:
+    fprintf(stderr, "Error: Cannot copy symbol '%s'.\n", info->name);
+    exit(EXIT_FAILURE);
+  }
+}
+
 void symbol_info_free(struct SymbolInfo *info) {
   if (!info)
     return;
@@ -160,11 +261,31 @@ void symbol_info_free(struct SymbolInfo *info) {
   if (info->kind == SYM_GLOBAL_VAR || info->kind == SYM_USER_FUNC) {
     free(info->location.global_asm_label);
   }
+  if (info->kind == SYM_LIFTED_FUNC) {
+    free(info->location.lifted.asm_label);
+    for (size_t i = 0; i < info->location.lifted.num_vars; ++i) {
+      free(info->location.lifted.var_names[i]);
+    }
+    free(info->location.lifted.var_names);
+    free(info->location.lifted.var_nodes);
+  }
   // No need to free builtin_val, as it points to static runtime data.
   // No need to free definition_node, as the AST owns that memory.
   free(info);
 }
 
+static struct SymbolMapStats symbol_map_stats;
+
+static void record_probe_length(size_t probes) {
+  if (probes > symbol_map_stats.max_probe_length) {
+    symbol_map_stats.max_probe_length = probes;
+  }
+}
+
+const struct SymbolMapStats *symbol_map_get_stats(void) {
+  return &symbol_map_stats;
+}
+
 //  hash function for strings (DJB2)
 static size_t hash_string(const char *str, size_t capacity) {
   unsigned long hash = 5381;
@@ -221,20 +342,25 @@ struct SymbolMap *symbol_map_create(void) {
 
 void symbol_map_emplace(struct SymbolMap *map, const char *key,
                         struct SymbolInfo *val) {
-  const unsigned int LOAD_FACTOR_THRESHOLD = 0.7;
+  const double LOAD_FACTOR_THRESHOLD = 0.7;
   if ((double)map->size / map->capacity > LOAD_FACTOR_THRESHOLD) {
-    _symbol_map_resize(map, find_next_prime(map->capacity + 1));
+    _symbol_map_resize(map, find_next_prime(map->capacity * 2));
   }
 
   size_t index = hash_string(key, map->capacity);
   size_t original_index = index;
+  size_t probes = 1;
+  symbol_map_stats.emplaces++;
 
   while (map->buckets[index].key != NULL) {
     if (strcmp(map->buckets[index].key, key) == 0) {
+      symbol_map_stats.emplace_probes += probes;
+      record_probe_length(probes);
       symbol_info_free(map->buckets[index].val);
       map->buckets[index].val = val;
       return;
     }
+    probes++;
     index = (index + 1) % map->capacity;
     if (index == original_index) {
       fprintf(stderr, "Error: Symbol map is full, cannot emplace key '%s'.\n",
@@ -243,6 +369,8 @@ void symbol_map_emplace(struct SymbolMap *map, const char *key,
     }
   }
 
+  symbol_map_stats.emplace_probes += probes;
+  record_probe_length(probes);
   map->buckets[index].key = strdup(key);
   if (!map->buckets[index].key) {
     perror("strdup");
@@ -255,17 +383,25 @@ void symbol_map_emplace(struct SymbolMap *map, const char *key,
 struct SymbolInfo *symbol_map_lookup(struct SymbolMap *map, const char *key) {
   size_t index = hash_string(key, map->capacity);
   size_t original_index = index;
+  size_t probes = 1;
+  struct SymbolInfo *found = NULL;
 
   while (map->buckets[index].key != NULL) {
     if (strcmp(map->buckets[index].key, key) == 0) {
-      return map->buckets[index].val;
+      found = map->buckets[index].val;
+      break;
     }
+    probes++;
     index = (index + 1) % map->capacity;
     if (index == original_index) {
       break;
     }
   }
-  return NULL;
+
+  symbol_map_stats.lookups++;
+  symbol_map_stats.lookup_probes += probes;
+  record_probe_length(probes);
+  return found;
 }
 
 void symbol_map_free(struct SymbolMap *map) {
@@ -285,6 +421,7 @@ void symbol_map_free(struct SymbolMap *map) {
 static void _symbol_map_resize(struct SymbolMap *map, size_t new_capacity) {
   struct SymbolMapElement *old_buckets = map->buckets;
   size_t old_capacity = map->capacity;
+  symbol_map_stats.resizes++;
 
   map->capacity = new_capacity;
   map->buckets = calloc(map->capacity, sizeof(struct SymbolMapElement));
@@ -13,6 +13,10 @@ struct SymbolInfo
     SYM_BUILTIN_FUNC,
     SYM_USER_FUNC,
     SYM_SPECIAL_FORM,
+    SYM_LOOP, // name bound by a named let, callable only in tail position
+    SYM_FREE_VAR,    // variable captured in the closure record of a lambda
+    SYM_LIFTED_FUNC, // local function compiled to a global one that takes
+                     // its free variables as extra arguments
   } kind;
 
   union
@@ -21,8 +25,34 @@ struct SymbolInfo
     char *global_asm_label; // For SYM_KIND_GLOBAL_VAR, SYM_KIND_USER_FUNC
     struct LispValue *builtin_val; // Points to a pre-initialized
                                    // LispValue in runtime.c
+    struct
+    {
+      int label_id;          // L_loop_<id> at the top of the loop body
+      int first_slot_offset; // loop variables live in consecutive slots
+      size_t num_vars;
+    } loop; // For SYM_LOOP
+    struct
+    {
+      int env_offset; // [rbp - env_offset] holds the closure record
+      size_t index;   // slot in the record's free variables
+    } free_var;       // For SYM_FREE_VAR
+    struct
+    {
+      char *asm_label;
+      size_t num_params;
+      // Free variables, passed after the parameters. Call sites look them up
+      // by name and check that they still resolve to the same definition.
+      size_t num_vars;
+      char **var_names;
+      struct Expr **var_nodes;
+    } lifted; // For SYM_LIFTED_FUNC
   } location;
 
+  // For SYM_USER_FUNC and SYM_BUILTIN_FUNC: bit i is set if argument i never
+  // escapes the call, so that a closure or number passed there can live in
+  // the caller's frame.
+  unsigned int noescape_params;
+
   struct Expr *definition_node;
 };
 
@@ -39,6 +69,19 @@ struct SymbolInfo *symbol_make_user_func (const char *name,
                                           struct Expr *definition_node);
 struct SymbolInfo *symbol_make_special_form (const char *name,
                                              struct Expr *definition_node);
+struct SymbolInfo *symbol_make_loop (const char *name, int label_id,
+                                     int first_slot_offset, size_t num_vars,
+                                     struct Expr *definition_node);
+struct SymbolInfo *symbol_make_free_var (const char *name, int env_offset,
+                                         size_t index,
+                                         struct Expr *definition_node);
+struct SymbolInfo *symbol_make_lifted_func (const char *name,
+                                            const char *asm_label,
+                                            size_t num_params, size_t num_vars,
+                                            char *const *var_names,
+                                            struct Expr *const *var_nodes,
+                                            struct Expr *definition_node);
+struct SymbolInfo *symbol_info_copy (const struct SymbolInfo *info);
 
 struct SymbolMap
 {
@@ -52,10 +95,22 @@ struct SymbolMap
   size_t size;
 };
 
+// Process-wide counters over every symbol map, for --stats.
+struct SymbolMapStats
+{
+  size_t lookups;
+  size_t lookup_probes;
+  size_t emplaces;
+  size_t emplace_probes;
+  size_t max_probe_length;
+  size_t resizes;
+};
+
 struct SymbolMap *symbol_map_create (void);
 void symbol_map_emplace (struct SymbolMap *map, const char *key,
                          struct SymbolInfo *val);
 struct SymbolInfo *symbol_map_lookup (struct SymbolMap *map, const char *key);
 void symbol_map_free (struct SymbolMap *map);
+const struct SymbolMapStats *symbol_map_get_stats (void);
 
 #endif
\ No newline at end of file